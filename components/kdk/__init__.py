@@ -1,9 +1,15 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import uart
+from esphome.components import sensor, text_sensor, uart
+from esphome.core import CORE
 from esphome.const import (
     CONF_ID,
     CONF_RECEIVE_TIMEOUT,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
 )
 
 CODEOWNERS = ["TzeWey"]
@@ -13,20 +19,102 @@ MULTI_CONF = True
 
 CONF_KDK_CONN_ID = "kdk_conn_id"
 CONF_KDK_CONN_POLL_INTERVAL = "poll_interval"
+CONF_KDK_CONN_WRITE_INTERVAL = "write_interval"
+CONF_KDK_CONN_STATS_INTERVAL = "stats_interval"
+CONF_KDK_CONN_PROFILE_LOOP = "profile_loop"
+CONF_KDK_CONN_EVENT_DRIVEN = "event_driven"
+
+# Link statistics counters, each one is an optional sensor that only increases
+KDK_LINK_COUNTER_SENSORS = [
+    "rx_frames",
+    "tx_frames",
+    "checksum_errors",
+    "oversize_frames",
+    "byte_timeouts",
+    "response_timeouts",
+    "retransmits",
+    "recoveries",
+]
+CONF_KDK_CONN_RESPONSE_TIME_P50 = "response_time_p50"
+CONF_KDK_CONN_RESPONSE_TIME_P95 = "response_time_p95"
+CONF_KDK_CONN_BUS_DUTY_CYCLE = "bus_duty_cycle"
+CONF_KDK_CONN_TIME_TO_READY = "time_to_ready"
+CONF_KDK_CONN_RESPONSE_TIMES = "response_times"
+
+KDK_SENSOR_KEYS = KDK_LINK_COUNTER_SENSORS + [
+    CONF_KDK_CONN_RESPONSE_TIME_P50,
+    CONF_KDK_CONN_RESPONSE_TIME_P95,
+    CONF_KDK_CONN_BUS_DUTY_CYCLE,
+    CONF_KDK_CONN_TIME_TO_READY,
+]
 
 kdk_ns = cg.esphome_ns.namespace("kdk")
 KdkConnectionManager = kdk_ns.class_("KdkConnectionManager", cg.PollingComponent, uart.UARTDevice)
 
-CONFIG_SCHEMA = (
+
+def validate_diagnostic_sensors(config):
+    # The sensor platforms are not auto-loaded, so they cost nothing unless a statistics sensor is configured
+    if any(key in config for key in KDK_SENSOR_KEYS) and "sensor" not in CORE.loaded_integrations:
+        raise cv.Invalid("The statistics sensors need the sensor component, add 'sensor:' to the configuration")
+    if CONF_KDK_CONN_RESPONSE_TIMES in config and "text_sensor" not in CORE.loaded_integrations:
+        raise cv.Invalid(
+            f"'{CONF_KDK_CONN_RESPONSE_TIMES}' needs the text_sensor component, add 'text_sensor:' to the configuration"
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
     cv.COMPONENT_SCHEMA.extend(
         {
             cv.GenerateID(): cv.declare_id(KdkConnectionManager),
             cv.Optional(CONF_RECEIVE_TIMEOUT, default="500ms"): cv.positive_time_period_milliseconds,
             cv.Optional(CONF_KDK_CONN_POLL_INTERVAL, default="15s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_KDK_CONN_WRITE_INTERVAL, default="250ms"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_KDK_CONN_STATS_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_KDK_CONN_PROFILE_LOOP, default=False): cv.boolean,
+            cv.Optional(CONF_KDK_CONN_EVENT_DRIVEN, default=False): cv.boolean,
+            cv.Optional(CONF_KDK_CONN_RESPONSE_TIME_P50): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_KDK_CONN_RESPONSE_TIME_P95): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_KDK_CONN_BUS_DUTY_CYCLE): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_KDK_CONN_TIME_TO_READY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_KDK_CONN_RESPONSE_TIMES): text_sensor.text_sensor_schema(
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+        }
+    )
+    .extend(
+        {
+            cv.Optional(key): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            )
+            for key in KDK_LINK_COUNTER_SENSORS
         }
     )
     .extend(cv.polling_component_schema("5ms"))
-    .extend(uart.UART_DEVICE_SCHEMA)
+    .extend(uart.UART_DEVICE_SCHEMA),
+    validate_diagnostic_sensors,
 )
 
 KDK_CLIENT_SCHEMA = cv.Schema(
@@ -48,3 +136,20 @@ async def to_code(config):
 
     cg.add(var.set_receive_timeout(config[CONF_RECEIVE_TIMEOUT]))
     cg.add(var.set_poll_interval(config[CONF_KDK_CONN_POLL_INTERVAL]))
+    cg.add(var.set_write_interval(config[CONF_KDK_CONN_WRITE_INTERVAL]))
+    cg.add(var.set_stats_interval(config[CONF_KDK_CONN_STATS_INTERVAL]))
+
+    if config[CONF_KDK_CONN_EVENT_DRIVEN]:
+        cg.add(var.set_event_driven(True))
+
+    if config[CONF_KDK_CONN_PROFILE_LOOP]:
+        cg.add_define("USE_KDK_PROFILER")
+
+    for key in KDK_SENSOR_KEYS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(getattr(var, f"set_{key}_sensor")(sens))
+
+    if CONF_KDK_CONN_RESPONSE_TIMES in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_KDK_CONN_RESPONSE_TIMES])
+        cg.add(var.set_response_times_text_sensor(sens))
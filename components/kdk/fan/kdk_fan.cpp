@@ -1,3 +1,4 @@
+#include <cinttypes>
 #include "esphome/core/log.h"
 
 #include "../kdk_conn.h"
@@ -47,6 +48,10 @@ uint8_t KdkFan::from_direction(fan::FanDirection v) const {
 }
 
 bool KdkFan::is_state_changed(uint8_t state, uint8_t speed, uint8_t direction) {
+  if (!this->state_valid_) {
+    return true;
+  }
+
   if (this->fan_state_ != state) {
     return true;
   }
@@ -99,7 +104,8 @@ void KdkFan::control(const fan::FanCall &call) {
   // Always turn OFF Yuragi
   parameters.push_back({.id = KDK_PARAM_FAN_YURAGI, .data = {KDK_FAN_YURAGI_OFF}});
 
-  conn->update_parameter_data(parameters);
+  conn->update_parameter_data(this, parameters,
+                              [this](const struct KdkWriteCompletion &c) { this->on_write_complete(c); });
 }
 
 void KdkFan::on_parameter_update(void) {
@@ -130,6 +136,7 @@ void KdkFan::on_parameter_update(void) {
   this->fan_state_ = fan_state;
   this->fan_speed_ = fan_speed;
   this->fan_direction_ = fan_direction;
+  this->state_valid_ = true;
 
   // Publish states
   this->state = this->to_state(fan_state);
@@ -11,11 +11,11 @@ class KdkFan : public fan::Fan, public KdkConnectionClient {
  protected:
   std::string name() override { return "KDK Fan"; }
 
+  bool state_valid_{false};  // The cached states match the device
   uint8_t fan_state_{0};
   uint8_t fan_speed_{0};
   uint8_t fan_direction_{0};
 
-  
   bool to_state(const uint8_t b) const;
   uint8_t from_state(bool v) const;
 
@@ -28,6 +28,8 @@ class KdkFan : public fan::Fan, public KdkConnectionClient {
   bool is_valid(const std::vector<uint8_t> &data) const;
   bool is_state_changed(uint8_t state, uint8_t speed, uint8_t direction);
 
+  void invalidate_state(void) override { this->state_valid_ = false; }
+
  public:
   fan::FanTraits get_traits() override;
 
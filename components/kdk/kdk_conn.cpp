@@ -1,6 +1,13 @@
+#include <cinttypes>
+#include <cstddef>
 #include "esphome/core/log.h"
 
 #include "kdk_conn.h"
+#include "kdk_trace_store.h"
+
+#ifdef USE_ESP32
+#include <esp_attr.h>
+#endif
 
 namespace esphome {
 namespace kdk {
@@ -10,9 +17,76 @@ static const char *const TAG = "kdk.conn";
 // All responses have bit 15 of the command set
 #define IS_RESPONSE_MESSAGE(cmd) ((cmd & 0x8000) != 0)
 #define SET_RESPONSE_MESSAGE(cmd) (cmd | 0x8000)
-
 #define GET_COMMAND(cmd) (cmd & 0x7FFF)
 
+// List of IDs that are not polled periodically
+static const uint16_t KDK_INIT_PARAMETER_IDS[] = {
+    0x8100,  //
+    0x8600,  //
+    0x8C00,  //
+    0x9300,  //
+    0xFC00,  //
+    0xFD00,  //
+    0xFE00,  //
+    0xF001,  //
+    0xF101,  //
+    0xF201,  //
+    0xF301,  //
+    0xF401,  //
+    0xF501,  //
+};
+static const size_t KDK_INIT_PARAMETER_COUNT = sizeof(KDK_INIT_PARAMETER_IDS) / sizeof(KDK_INIT_PARAMETER_IDS[0]);
+
+// List of IDs to poll
+static const uint16_t KDK_POLL_PARAMETER_IDS[] = {
+    0x8000,  // Fan ON/OFF
+    0xF000,  // Fan Speed
+    // 0x8600,  // UNKNOWN, large 46-bytes parameter
+    0x8800,  // UNKNOWN, always 0x42
+    0xF800,  // Some kind of parameter mask, sent when changing the fan states
+    0xF200,  // Fan Yuragi
+    0xF100,  // Fan Direction
+    0xF900,  // UNKNOWN, always 0x00 0x00
+    0xFA00,  // Some kind of parameter mask, sent when changing the fan states
+    0xFB00,  // UNKNOWN, always 0x00 0x00
+    0xF300,  // Light ON/OFF
+    0xF500,  // Light Brightness
+    0xF400,  // Light Mode
+    0xF700,  // NightLight Brightness
+    0xF600,  // Light Color
+};
+static_assert(sizeof(KDK_POLL_PARAMETER_IDS) / sizeof(KDK_POLL_PARAMETER_IDS[0]) == KDK_POLL_PARAMETER_COUNT,
+              "KDK_POLL_PARAMETER_COUNT does not match the poll list");
+
+/*******************************************************************************
+ * KdkConnectionClient
+ ******************************************************************************/
+
+/**
+ * Log the outcome of a write. A failed write leaves the device states unknown,
+ * the client drops its cached states so the next poll publishes them.
+ */
+void KdkConnectionClient::on_write_complete(const struct KdkWriteCompletion &completion) {
+  const auto conn = this->get_parent();
+
+  switch (completion.result) {
+    case KDK_WRITE_RESULT_ACKNOWLEDGED: {
+      ESP_LOGD(TAG, "%s: Update acknowledged after %" PRIu32 " ms", this->name().c_str(), completion.latency);
+    } break;
+
+    case KDK_WRITE_RESULT_SUPERSEDED: {
+      ESP_LOGV(TAG, "%s: Update superseded after %" PRIu32 " ms", this->name().c_str(), completion.latency);
+    } break;
+
+    case KDK_WRITE_RESULT_FAILED:
+    default: {
+      ESP_LOGW(TAG, "%s: Update %s after %" PRIu32 " ms", this->name().c_str(),
+               conn->get_write_result_name(completion.result).c_str(), completion.latency);
+      this->invalidate_state();
+    } break;
+  }
+}
+
 /*******************************************************************************
  * KdkConnectionManager
  ******************************************************************************/
@@ -42,7 +116,7 @@ std::string KdkConnectionManager::hex2str(const uint8_t *buffer, size_t length)
 
   constexpr char hexmap[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
   std::string str(length * 3, ' ');
-  for (int i = 0; i < length; ++i) {
+  for (size_t i = 0; i < length; ++i) {
     str[3 * i] = hexmap[(buffer[i] & 0xF0) >> 4];
     str[3 * i + 1] = hexmap[buffer[i] & 0x0F];
   }
@@ -51,12 +125,28 @@ std::string KdkConnectionManager::hex2str(const uint8_t *buffer, size_t length)
 
 std::string KdkConnectionManager::hex2str(std::vector<uint8_t> v) { return this->hex2str(v.data(), v.size()); }
 
+/**
+ * Format the buffer into the provided string without allocating, the output is
+ * truncated to fit the string size.
+ */
+const char *KdkConnectionManager::hex2str(char *str, size_t size, const uint8_t *buffer, size_t length) {
+  constexpr char hexmap[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+  size_t pos = 0;
+  for (size_t i = 0; (i < length) && ((pos + 3) < size); ++i) {
+    str[pos++] = hexmap[(buffer[i] & 0xF0) >> 4];
+    str[pos++] = hexmap[buffer[i] & 0x0F];
+    str[pos++] = ' ';
+  }
+  str[pos] = '\0';
+  return str;
+}
+
 /**
  * Calculates the sum of the provided buffer.
  */
 uint8_t KdkConnectionManager::calculate_sum(const uint8_t *buffer, size_t length) {
   uint8_t sum = 0;
-  for (int i = 0; i < length; i++) {
+  for (size_t i = 0; i < length; i++) {
     sum += buffer[i];
   }
   return ((0 - sum) & 0xFF);
@@ -72,6 +162,106 @@ void KdkConnectionManager::notify_clients_on_parameter_update(void) {
   }
 }
 
+/**
+ * Resolve a write completion callback, at most once per write request.
+ */
+void KdkConnectionManager::resolve_write(KdkWriteCallback &callback, uint32_t request_timestamp,
+                                         KdkWriteResult result) {
+  const uint32_t latency = millis() - request_timestamp;
+
+  switch (result) {
+    case KDK_WRITE_RESULT_ACKNOWLEDGED: {
+      this->state_.write_acknowledged_count++;
+      this->state_.last_write_latency = latency;
+      this->state_.max_write_latency = std::max(this->state_.max_write_latency, latency);
+    } break;
+    case KDK_WRITE_RESULT_SUPERSEDED: {
+      this->state_.write_superseded_count++;
+    } break;
+    case KDK_WRITE_RESULT_FAILED: {
+      this->state_.write_failed_count++;
+    } break;
+  }
+
+  if (callback == nullptr) {
+    return;
+  }
+
+  // Release the callback before invoking it, the callback may issue a new write
+  auto resolved = std::move(callback);
+  callback = nullptr;
+  resolved({.result = result, .latency = latency});
+}
+
+void KdkConnectionManager::resolve_in_flight_writes(KdkWriteResult result) {
+  for (auto &it : this->state_.write_debouncers) {
+    auto &debouncer = it.second;
+    if (debouncer.in_flight) {
+      debouncer.in_flight = false;
+      this->resolve_write(debouncer.in_flight_callback, debouncer.in_flight_request_timestamp, result);
+    }
+  }
+}
+
+bool KdkConnectionManager::is_write_due(const struct KdkWriteDebouncer &debouncer, uint32_t now) const {
+  return debouncer.pending && ((now - debouncer.last_write_timestamp) >= this->cfg_.write_interval);
+}
+
+bool KdkConnectionManager::is_update_pending(void) {
+  const uint32_t now = millis();
+  for (auto &it : this->state_.write_debouncers) {
+    if (this->is_write_due(it.second, now)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Whether update() has anything to do, used in event driven mode. Covers every
+ * source of work: received bytes, the FSM, the response timeout, the scheduler,
+ * due writes, the poll interval and the statistics window.
+ */
+bool KdkConnectionManager::is_update_due(uint32_t now) {
+  if (this->available()) {
+    return true;
+  }
+
+  // The init sequence and pending events are driven by the FSM loop handlers
+  if ((this->fsm_.state != KDK_COMM_STATE_IDLE) || (this->fsm_.event_count > 0) || this->is_message_pending()) {
+    return true;
+  }
+
+  // Nothing can be dispatched until the response arrives or times out
+  if (this->is_waiting_response()) {
+    return (now - this->tx_.timestamp) >= this->cfg_.receive_timeout;
+  }
+
+  return (this->sched_.queue_depth > 0) || this->is_update_pending() ||
+         ((now - this->state_.last_update_timestamp) > this->cfg_.poll_interval) ||
+         ((now - this->link_.window_timestamp) >= this->cfg_.stats_interval);
+}
+
+/**
+ * A parameter is held while a client has a pending or unacknowledged write for
+ * it. Polled values of held parameters are echoes of an older state and must not
+ * overwrite the value the client is moving towards.
+ */
+bool KdkConnectionManager::is_parameter_held(uint16_t id) const {
+  for (auto &it : this->state_.write_debouncers) {
+    auto &debouncer = it.second;
+    if (!debouncer.pending && !debouncer.in_flight) {
+      continue;
+    }
+    for (auto &parameter : debouncer.parameters) {
+      if (parameter.id == id) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void KdkConnectionManager::receiver_reset_states(void) {
   this->rx_.index = 0;
   this->rx_.sum = 0;
@@ -85,6 +275,9 @@ void KdkConnectionManager::receiver_process_byte(uint8_t byte) {
   const uint32_t elapsed = (now - this->rx_.timestamp);
   if (elapsed > this->cfg_.byte_timeout) {
     ESP_LOGV(TAG, "RX> Inter-byte timeout after %d ms", elapsed);
+    if (this->rx_.index > 0) {
+      this->link_.counters.byte_timeouts++;  // Only count partial frames that were dropped
+    }
     this->receiver_reset_states();
   } else {
     // Update receive timestamp
@@ -125,6 +318,7 @@ void KdkConnectionManager::receiver_process_byte(uint8_t byte) {
   // Verify that the frame will fit in our receive buffer
   if (expected_length > KDK_MESSAGE_BUFFER_SIZE) {
     ESP_LOGW(TAG, "RX> Length %d is larger than the receive buffer of %d", expected_length, KDK_MESSAGE_BUFFER_SIZE);
+    this->link_.counters.oversize_frames++;
     this->receiver_reset_states();
     return;
   }
@@ -140,6 +334,7 @@ void KdkConnectionManager::receiver_process_byte(uint8_t byte) {
   uint8_t checksum = cmd->payload[cmd->length];
   if (checksum != sum) {
     ESP_LOGW(TAG, "RX> Invalid checksum: got=%02X, exp=%02X", checksum, sum);
+    this->link_.counters.checksum_errors++;
     this->receiver_reset_states();
     return;
   }
@@ -154,14 +349,30 @@ void KdkConnectionManager::receiver_process_byte(uint8_t byte) {
   // A valid command was received, reset the receiver states
   this->receiver_reset_states();
   this->state_.message_pending = true;
-
-  // Clear flag if message is a command response
-  if (IS_RESPONSE_MESSAGE(cmd->command)) {
+  this->link_.counters.rx_frames++;
+  this->trace_frame(KDK_TRACE_RX, this->rx_.buffer);
+
+  // Clear flag if message is the response to the last request, responses with
+  // a stale counter are treated as lost and the request is retransmitted.
+  if (IS_RESPONSE_MESSAGE(cmd->command) && (cmd->counter == this->tx_.counter)) {
+    if (this->state_.waiting_response) {
+      this->link_record_rtt(GET_COMMAND(cmd->command), now - this->tx_.timestamp);
+    }
     this->clear_waiting_response();
   }
 }
 
 void KdkConnectionManager::send_request(uint16_t command, const uint8_t *payload, uint16_t length, bool posted) {
+  if ((payload != NULL) && (length > 0)) {
+    memcpy(this->request_payload(), payload, length);
+  }
+  this->commit_request(command, length, posted);
+}
+
+/**
+ * Send the request whose payload was written in place at `request_payload()`.
+ */
+void KdkConnectionManager::commit_request(uint16_t command, uint16_t length, bool posted) {
   struct KdkMsg *cmd = (struct KdkMsg *) this->tx_.buffer;
 
   this->tx_.counter++;  // Advance TX counter before transmitting, value is reset to 0xFF on SYNC
@@ -172,10 +383,6 @@ void KdkConnectionManager::send_request(uint16_t command, const uint8_t *payload
   cmd->command = command;
   cmd->length = length;
 
-  if ((payload != NULL) && (length > 0)) {
-    memcpy(cmd->payload, payload, length);
-  }
-
   size_t buf_length = sizeof(struct KdkMsg) + cmd->length;  // Length of bytes to compute the checksum
   uint8_t checksum = this->calculate_sum(this->tx_.buffer, buf_length);
   this->tx_.buffer[buf_length++] = checksum;  // Add checksum to the final buffer length
@@ -197,7 +404,14 @@ void KdkConnectionManager::send_request(uint16_t command, const uint8_t *payload
 }
 
 void KdkConnectionManager::send_response(uint8_t counter, uint16_t command, const uint8_t *payload, uint16_t length) {
-  struct KdkMsg *cmd = (struct KdkMsg *) this->tx_.buffer;
+  // Responses are built in a separate buffer, they may be sent while a request is waiting to be retransmitted
+  struct KdkMsg *cmd = (struct KdkMsg *) this->tx_.response_buffer;
+
+  const size_t max_length = sizeof(this->tx_.response_buffer) - sizeof(struct KdkMsg) - KDK_MESSAGE_CHECKSUM_SIZE;
+  if (length > max_length) {
+    ESP_LOGE(TAG, "TX> Response length %d is larger than %zu", length, max_length);
+    return;
+  }
 
   cmd->start = KDK_MESSAGE_START;
   cmd->dummy = 0;
@@ -210,10 +424,12 @@ void KdkConnectionManager::send_response(uint8_t counter, uint16_t command, cons
   }
 
   size_t buf_length = sizeof(struct KdkMsg) + cmd->length;  // Length of bytes to compute the checksum
-  uint8_t checksum = this->calculate_sum(this->tx_.buffer, buf_length);
-  this->tx_.buffer[buf_length++] = checksum;  // Add checksum to the final buffer length
-  this->tx_.buffer_length = buf_length;
-  this->transmit_message();
+  uint8_t checksum = this->calculate_sum(this->tx_.response_buffer, buf_length);
+  this->tx_.response_buffer[buf_length++] = checksum;  // Add checksum to the final buffer length
+  this->write_array(this->tx_.response_buffer, buf_length);
+  this->trace_frame(KDK_TRACE_TX, this->tx_.response_buffer);
+  this->link_.counters.tx_frames++;
+  this->link_.counters.tx_bytes += buf_length;
 
   ESP_LOGV(TAG, "TX> Send Response:");
   ESP_LOGV(TAG, "TX>   counter: %d", cmd->counter);
@@ -225,7 +441,10 @@ void KdkConnectionManager::send_response(uint8_t counter, uint16_t command, cons
 
 void KdkConnectionManager::transmit_message(void) {
   this->write_array(this->tx_.buffer, this->tx_.buffer_length);
+  this->trace_frame(KDK_TRACE_TX, this->tx_.buffer);
   this->tx_.timestamp = millis();
+  this->link_.counters.tx_frames++;
+  this->link_.counters.tx_bytes += this->tx_.buffer_length;
 }
 
 void KdkConnectionManager::check_response_timeout() {
@@ -240,18 +459,233 @@ void KdkConnectionManager::check_response_timeout() {
   }
 
   ESP_LOGW(TAG, "RX> Response timeout after %d ms", elapsed);
+  this->link_.counters.response_timeouts++;
 
   if (this->tx_.retry_count < KDK_SEND_MAX_RETRY) {
     this->tx_.retry_count++;
     ESP_LOGW(TAG, "TX> Retransmit message, retry #%d", this->tx_.retry_count);
+    this->link_.counters.retransmits++;
+    this->fsm_.state_stats[this->fsm_.state].retries++;
     this->transmit_message();
   } else {
     ESP_LOGE(TAG, "TX> Retransmit retries exhausted, attempt recovery");
+    this->link_.counters.recoveries++;
+    this->fsm_.state_stats[this->fsm_.state].recoveries++;
     this->state_.waiting_response = false;
     this->fsm_push_event(KdkCommFsmEvent::KDK_COMM_FSM_EVENT_SYNC_RECOVERY);
   }
 }
 
+/*******************************************************************************
+ * PROTECTED - Trace
+ ******************************************************************************/
+
+#ifdef USE_ESP32
+static RTC_NOINIT_ATTR struct KdkTraceStore kdk_trace_stores[KDK_TRACE_STORE_SLOTS];
+static uint8_t kdk_trace_store_count = 0;  // Number of slots assigned to instances
+#endif
+
+/**
+ * Assign a trace slot to this instance. A valid trace left in the slot by the
+ * previous boot is copied out before the slot is reset.
+ */
+void KdkConnectionManager::trace_setup(void) {
+#ifdef USE_ESP32
+  this->trace_ = trace_store_assign(kdk_trace_stores, kdk_trace_store_count, KDK_TRACE_STORE_MAGIC,
+                                    this->recovered_trace_);
+#endif
+  if (this->trace_ == nullptr) {
+    this->trace_ = new KdkTraceStore();  // Not persistent, no RTC memory or too many instances
+  }
+}
+
+/**
+ * The RTC memory does not survive a power loss or a brownout. When it held no
+ * trace, report the snapshot last saved to flash instead.
+ */
+void KdkConnectionManager::trace_snapshot_load(void) {
+#ifdef USE_ESP32
+  const ptrdiff_t slot = this->trace_ - kdk_trace_stores;
+  if ((slot < 0) || (slot >= KDK_TRACE_STORE_SLOTS)) {
+    return;
+  }
+
+  this->trace_snapshot_pref_ = global_preferences->make_preference<KdkTraceStore>(KDK_TRACE_SNAPSHOT_KEY + slot, true);
+  if (this->recovered_trace_ != nullptr) {
+    return;
+  }
+
+  std::unique_ptr<KdkTraceStore> snapshot(new KdkTraceStore());
+  if (this->trace_snapshot_pref_.load(snapshot.get()) && trace_store_valid(*snapshot, KDK_TRACE_STORE_MAGIC)) {
+    this->recovered_trace_ = std::move(snapshot);
+    this->trace_snapshot_loaded_ = true;
+  }
+#endif
+}
+
+/**
+ * Copy the trace to flash, at most every KDK_TRACE_SNAPSHOT_INTERVAL to limit
+ * the flash wear. The write happens at the next sync of the preferences.
+ */
+void KdkConnectionManager::trace_snapshot_save(void) {
+#ifdef USE_ESP32
+  const uint32_t now = millis();
+  if (this->trace_snapshot_saved_ && ((now - this->trace_snapshot_timestamp_) < KDK_TRACE_SNAPSHOT_INTERVAL)) {
+    return;
+  }
+  if (this->trace_snapshot_pref_.save(this->trace_)) {
+    ESP_LOGD(TAG, "TRACE> Snapshot saved to flash");
+    this->trace_snapshot_saved_ = true;
+    this->trace_snapshot_timestamp_ = now;
+  }
+#endif
+}
+
+void KdkConnectionManager::trace_record(enum KdkTraceType type, uint8_t counter, uint16_t command,
+                                        const uint8_t *payload, size_t length) {
+  auto &trace = *this->trace_;
+  auto &entry = trace.entries[trace.head];
+  entry.timestamp = millis();
+  entry.command = command;
+  entry.type = type;
+  entry.counter = counter;
+  entry.length = length;
+  memcpy(entry.payload, payload, std::min(length, (size_t) KDK_TRACE_PAYLOAD_SIZE));
+  trace_store_commit(trace);
+}
+
+/*******************************************************************************
+ * PROTECTED - Link Statistics
+ ******************************************************************************/
+
+void KdkConnectionManager::link_record_rtt(uint16_t command, uint32_t rtt) {
+  uint8_t index = 0;
+  while ((index < KDK_RTT_COMMAND_COUNT) && (KDK_RTT_COMMANDS[index] != command)) {
+    index++;
+  }
+  auto &histogram = this->link_.rtt[index];
+  histogram.command = (index < KDK_RTT_COMMAND_COUNT) ? KDK_RTT_COMMANDS[index] : KDK_RTT_COMMAND_OTHER;
+
+  uint8_t bucket = 0;
+  while ((bucket < (KDK_RTT_BUCKET_COUNT - 1)) && (rtt > KDK_RTT_BUCKET_LIMITS[bucket])) {
+    bucket++;
+  }
+
+  histogram.buckets[bucket]++;
+  histogram.count++;
+  if (rtt > histogram.max) {
+    histogram.max = rtt;
+  }
+
+  ESP_LOGVV(TAG, "LINK> CMD=%04X RTT=%" PRIu32 " ms", command, rtt);
+}
+
+/**
+ * Estimate a percentile as the upper bound of the bucket it falls in, the
+ * last bucket is unbounded and reports the largest RTT seen instead.
+ */
+uint32_t KdkConnectionManager::link_rtt_percentile(const struct KdkRttHistogram &histogram, uint8_t percentile) const {
+  if (histogram.count == 0) {
+    return 0;
+  }
+
+  const uint32_t rank = ((histogram.count * percentile) + 99) / 100;  // Round up, 1-based
+  uint32_t cumulative = 0;
+  for (int i = 0; i < (KDK_RTT_BUCKET_COUNT - 1); i++) {
+    cumulative += histogram.buckets[i];
+    if (cumulative >= rank) {
+      return std::min((uint32_t) KDK_RTT_BUCKET_LIMITS[i], histogram.max);
+    }
+  }
+  return histogram.max;
+}
+
+void KdkConnectionManager::link_update_stats(uint32_t now) {
+  const uint32_t elapsed = now - this->link_.window_timestamp;
+  if (elapsed < this->cfg_.stats_interval) {
+    return;
+  }
+
+  // Time the bus was busy over the window, both directions are counted as the link is half-duplex in practice
+  const uint32_t bytes = this->link_.counters.rx_bytes + this->link_.counters.tx_bytes;
+  const float busy = ((bytes - this->link_.window_bytes) * KDK_UART_BITS_PER_BYTE * 1000.0f) / KDK_SUPPORTED_BAUD_RATE;
+  this->link_.duty_cycle = std::min(100.0f, (busy * 100.0f) / elapsed);
+  this->link_.window_bytes = bytes;
+  this->link_.window_timestamp = now;
+
+  this->link_publish_stats();
+}
+
+void KdkConnectionManager::link_publish_stats(void) {
+#ifdef USE_SENSOR
+  auto &counters = this->link_.counters;
+  auto &sensors = this->sensors_;
+
+  if (sensors.rx_frames != nullptr) {
+    sensors.rx_frames->publish_state(counters.rx_frames);
+  }
+  if (sensors.tx_frames != nullptr) {
+    sensors.tx_frames->publish_state(counters.tx_frames);
+  }
+  if (sensors.checksum_errors != nullptr) {
+    sensors.checksum_errors->publish_state(counters.checksum_errors);
+  }
+  if (sensors.oversize_frames != nullptr) {
+    sensors.oversize_frames->publish_state(counters.oversize_frames);
+  }
+  if (sensors.byte_timeouts != nullptr) {
+    sensors.byte_timeouts->publish_state(counters.byte_timeouts);
+  }
+  if (sensors.response_timeouts != nullptr) {
+    sensors.response_timeouts->publish_state(counters.response_timeouts);
+  }
+  if (sensors.retransmits != nullptr) {
+    sensors.retransmits->publish_state(counters.retransmits);
+  }
+  if (sensors.recoveries != nullptr) {
+    sensors.recoveries->publish_state(counters.recoveries);
+  }
+  if (sensors.bus_duty_cycle != nullptr) {
+    sensors.bus_duty_cycle->publish_state(this->link_.duty_cycle);
+  }
+
+  if ((sensors.response_time_p50 != nullptr) || (sensors.response_time_p95 != nullptr)) {
+    // Merge the histograms of all commands
+    struct KdkRttHistogram total;
+    for (auto &it : this->link_.rtt) {
+      for (int i = 0; i < KDK_RTT_BUCKET_COUNT; i++) {
+        total.buckets[i] += it.buckets[i];
+      }
+      total.count += it.count;
+      total.max = std::max(total.max, it.max);
+    }
+    if (sensors.response_time_p50 != nullptr) {
+      sensors.response_time_p50->publish_state(this->link_rtt_percentile(total, 50));
+    }
+    if (sensors.response_time_p95 != nullptr) {
+      sensors.response_time_p95->publish_state(this->link_rtt_percentile(total, 95));
+    }
+  }
+#endif
+
+#ifdef USE_TEXT_SENSOR
+  if (this->text_sensors_.response_times != nullptr) {
+    // Format: "0810=40/75 0910=50/100", p50/p95 in ms of every request command
+    std::string summary;
+    for (auto &it : this->link_.rtt) {
+      if (it.count == 0) {
+        continue;
+      }
+      char entry[32];
+      snprintf(entry, sizeof(entry), "%s%04X=%" PRIu32 "/%" PRIu32, summary.empty() ? "" : " ", it.command,
+               this->link_rtt_percentile(it, 50), this->link_rtt_percentile(it, 95));
+      summary += entry;
+    }
+    this->text_sensors_.response_times->publish_state(summary);
+  }
+#endif
+}
+
 /*******************************************************************************
  * PROTECTED - Message Helpers
  ******************************************************************************/
@@ -292,21 +726,27 @@ void KdkConnectionManager::fill_parameter_table_id(uint8_t *buffer) {
   buffer[2] = (id >> 16) & 0xFF;
 }
 
-void KdkConnectionManager::fill_parameter_requests(uint8_t *buffer, std::vector<uint16_t> id_list) {
-  if (id_list.size() > 80) {
-    ESP_LOGE(TAG, "CMD> fill_parameter_requests list size %d is larger than 80", id_list.size());
-    return;
+/**
+ * Fill the parameter table ID, count and parameter ID list into the provided buffer.
+ * Returns the number of bytes written.
+ */
+size_t KdkConnectionManager::fill_parameter_requests(uint8_t *buffer, const uint16_t *id_list, size_t count) {
+  if (count > KDK_MSG_PARAM_REQ_MAX_COUNT) {
+    ESP_LOGE(TAG, "CMD> fill_parameter_requests list size %zu is larger than %d", count, KDK_MSG_PARAM_REQ_MAX_COUNT);
+    count = KDK_MSG_PARAM_REQ_MAX_COUNT;
   }
 
   this->fill_parameter_table_id(&buffer[0]);  // 3-bytes
-  buffer[3] = id_list.size();
+  buffer[3] = count;
 
-  for (int i = 0; i < id_list.size(); i++) {
+  for (size_t i = 0; i < count; i++) {
     auto id = id_list[i];
     buffer[4 + ((i * KDK_MSG_PARAM_ID_REQ_SIZE) + 0)] = ((id >> 0) & 0xFF);
     buffer[4 + ((i * KDK_MSG_PARAM_ID_REQ_SIZE) + 1)] = ((id >> 8) & 0xFF);
     buffer[4 + ((i * KDK_MSG_PARAM_ID_REQ_SIZE) + 2)] = 0;  // Appears to be always 0
   }
+
+  return KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE + (KDK_MSG_PARAM_ID_REQ_SIZE * count);
 }
 
 /**
@@ -338,8 +778,15 @@ void KdkConnectionManager::parse_parameter_response(const uint8_t *buffer) {
 
     auto &param = it->second;
 
+    // Do not let a polled echo overwrite a value that is still being written
+    if (this->is_ready() && this->is_parameter_held(id)) {
+      ESP_LOGV(TAG, "PARAM> Parameter %04X is held by a pending write, ignoring", id);
+      index += length;  // Advance the buffer index by the data length to process the next entry
+      continue;
+    }
+
     if (param.data.size() != length) {
-      ESP_LOGW(TAG, "PARAM> Parameter %04X size mismatch : got=%d, exp=%d", id, length, param.data.size());
+      ESP_LOGW(TAG, "PARAM> Parameter %04X size mismatch : got=%d, exp=%zu", id, length, param.data.size());
       index += length;  // Advance the buffer index by the data length to process the next entry
       continue;
     }
@@ -348,7 +795,9 @@ void KdkConnectionManager::parse_parameter_response(const uint8_t *buffer) {
       param.data[j] = buffer[index++];
     }
 
-    ESP_LOGD(TAG, "PARAM> GET ID=%04X, SIZE=%d, DATA=%s", id, length, this->hex2str(param.data).c_str());
+    char data_str[KDK_HEX_STR_SIZE];
+    ESP_LOGD(TAG, "PARAM> GET ID=%04X, SIZE=%d, DATA=%s", id, length,
+             this->hex2str(data_str, sizeof(data_str), param.data.data(), length));
   }
 }
 
@@ -524,7 +973,12 @@ void KdkConnectionManager::process_response_0910(void) {
  * PROTECTED - MESSAGE BUILDER
  ******************************************************************************/
 
-void KdkConnectionManager::send_message_0810(std::vector<struct KdkParamUpdate> values) {
+/**
+ * Send the pending values of all in-flight writes in a single request, the
+ * payload is written in place in the TX buffer. Returns false without sending
+ * when none of their parameters is valid.
+ */
+bool KdkConnectionManager::send_message_0810(void) {
   /* Captured request from MOD to FAN:
    * 5A 21 10 08 00 2C // Header (not part of 'payload')
    * 02                // Type??? (not sure what this means, seems to always be 0x2)
@@ -536,57 +990,74 @@ void KdkConnectionManager::send_message_0810(std::vector<struct KdkParamUpdate>
    * E1                // Checksum
    */
 
-  std::map<uint16_t, std::vector<uint8_t>> param_update_map;  // Unique parameter updates to be sent
+  static const size_t max_length = KDK_MESSAGE_BUFFER_SIZE - sizeof(struct KdkMsg) - KDK_MESSAGE_CHECKSUM_SIZE;
 
-  // Validate parameters
   auto &parameters = this->state_.parameters;
+  uint8_t *payload = this->request_payload();
 
-  for (auto &value : values) {
-    auto id = value.id;
-    auto it = parameters.find(id);
-    if (it == parameters.end()) {
-      ESP_LOGW(TAG, "0810> Failed to find parameter ID %04X", id);
-      return;
-    }
-    auto size = it->second.size;
-    if (size != value.data.size()) {
-      ESP_LOGW(TAG, "0810> Failed to update parameter %04X, data size mismatch: got=%d, exp=%d", id, value.data.size(),
-               size);
-      return;
-    }
+  payload[0] = 0x02;
+  this->fill_parameter_table_id(&payload[1]);  // 3-bytes
+  uint8_t count = 0;
+  size_t length = KDK_MSG_TYPE_SIZE + KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE;
 
-    // Update if duplicate, else insert
-    auto param_it = param_update_map.find(id);
-    if (param_it != param_update_map.end()) {
-      param_it->second = value.data;  // Overwrite existing data
-    } else {
-      param_update_map.insert({id, value.data});  // Insert new parameter update
+  for (auto &it : this->state_.write_debouncers) {
+    if (!it.second.in_flight) {
+      continue;
     }
-  }
 
-  std::vector<uint8_t> payload(KDK_MSG_TYPE_SIZE + KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE);
+    for (auto &value : it.second.parameters) {
+      auto id = value.id;
+      auto size = value.data.size();
 
-  payload[0] = 0x02;
-  this->fill_parameter_table_id(&payload[1]);  // 3-bytes
-  payload[4] = values.size();
-
-  for (auto values_it = param_update_map.begin(); values_it != param_update_map.end(); values_it++) {
-    auto id = values_it->first;
-    auto &value = values_it->second;
-    payload.push_back((id >> 0) & 0xFF);
-    payload.push_back((id >> 8) & 0xFF);
-    payload.push_back((uint8_t) (value.size() & 0xFF));
-    for (auto b : value) {
-      payload.push_back(b);
+      // Validate parameters
+      auto param_it = parameters.find(id);
+      if (param_it == parameters.end()) {
+        ESP_LOGW(TAG, "0810> Failed to find parameter ID %04X", id);
+        continue;
+      }
+      if (param_it->second.size != size) {
+        ESP_LOGW(TAG, "0810> Failed to update parameter %04X, data size mismatch: got=%zu, exp=%d", id, size,
+                 param_it->second.size);
+        continue;
+      }
+
+      // Find the entry if the parameter was already added by another write, entries are: ID, SIZE, DATA
+      size_t entry = KDK_MSG_TYPE_SIZE + KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE;
+      while ((entry < length) && ((payload[entry] | (payload[entry + 1] << 8)) != id)) {
+        entry += 3 + payload[entry + 2];
+      }
+
+      // Update if duplicate, else append
+      if (entry == length) {
+        if ((length + 3 + size) > max_length) {
+          ESP_LOGW(TAG, "0810> Failed to update parameter %04X, request is full", id);
+          continue;
+        }
+        payload[length++] = (id >> 0) & 0xFF;
+        payload[length++] = (id >> 8) & 0xFF;
+        payload[length++] = (uint8_t) (size & 0xFF);
+        length += size;
+        count++;
+      }
+      memcpy(&payload[entry + 3], value.data.data(), size);
+
+      char data_str[KDK_HEX_STR_SIZE];
+      ESP_LOGD(TAG, "PARAM> SET ID=%04X, SIZE=%zu, DATA=%s", id, size,
+               this->hex2str(data_str, sizeof(data_str), value.data.data(), size));
     }
+  }
 
-    ESP_LOGD(TAG, "PARAM> SET ID=%04X, SIZE=%d, DATA=%s", id, value.size(), this->hex2str(value).c_str());
+  if (count == 0) {
+    ESP_LOGW(TAG, "0810> No valid parameter to write, request dropped");
+    return false;
   }
+  payload[4] = count;
 
-  this->send_request(0x0810, payload.data(), payload.size());
+  this->commit_request(0x0810, length);
+  return true;
 }
 
-void KdkConnectionManager::send_message_0910(std::vector<uint16_t> id_list) {
+void KdkConnectionManager::send_message_0910(const uint16_t *id_list, size_t count) {
   /* Captured request from MOD to FAN:
    * 5A 20 10 09 00 32 // Header (not part of 'payload')
    * 02                // Type??? (not sure what this means, seems to always be 0x2)
@@ -598,12 +1069,11 @@ void KdkConnectionManager::send_message_0910(std::vector<uint16_t> id_list) {
    * DE                // Checksum
    */
 
-  std::vector<uint8_t> payload(KDK_MSG_TYPE_SIZE + KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE +
-                               (KDK_MSG_PARAM_ID_REQ_SIZE * id_list.size()));
+  uint8_t *payload = this->request_payload();
 
   payload[0] = 0x02;
-  this->fill_parameter_requests(&payload[1], id_list);
-  this->send_request(0x0910, payload.data(), payload.size());
+  size_t length = KDK_MSG_TYPE_SIZE + this->fill_parameter_requests(&payload[1], id_list, count);
+  this->commit_request(0x0910, length);
 }
 
 void KdkConnectionManager::send_message_0210_init(void) {
@@ -621,64 +1091,66 @@ void KdkConnectionManager::send_message_0210_init(void) {
    * 51                // Checksum
    */
 
+  uint8_t *payload = this->request_payload();
+
   // Get list of IDs with metadata that is 0x40
-  std::vector<uint16_t> id_list;
-  for (auto i : this->state_.parameters) {
-    auto param = i.second;
-    if (param.metadata == 0x40) {
-      id_list.push_back(param.id);
+  this->fill_parameter_table_id(&payload[0]);  // 3-bytes
+  uint8_t count = 0;
+  size_t length = KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE;
+  for (auto &i : this->state_.parameters) {
+    auto &param = i.second;
+    if ((param.metadata != 0x40) || (count >= KDK_MSG_PARAM_REQ_MAX_COUNT)) {
+      continue;
     }
+    payload[length++] = (param.id >> 0) & 0xFF;
+    payload[length++] = (param.id >> 8) & 0xFF;
+    payload[length++] = 0;  // Appears to be always 0
+    count++;
   }
+  payload[3] = count;
 
-  std::vector<uint8_t> payload(KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE +
-                               (KDK_MSG_PARAM_ID_REQ_SIZE * id_list.size()));
-
-  this->fill_parameter_requests(&payload[0], id_list);
-  this->send_request(0x0210, payload.data(), payload.size());
+  this->commit_request(0x0210, length);
 }
 
 void KdkConnectionManager::send_message_0910_init(void) {
-  // List of IDs that are not polled periodically
-  std::vector<uint16_t> id_list{
-      0x8100,  //
-      0x8600,  //
-      0x8C00,  //
-      0x9300,  //
-      0xFC00,  //
-      0xFD00,  //
-      0xFE00,  //
-      0xF001,  //
-      0xF101,  //
-      0xF201,  //
-      0xF301,  //
-      0xF401,  //
-      0xF501,  //
-  };
-
-  this->send_message_0910(id_list);
+  this->send_message_0910(KDK_INIT_PARAMETER_IDS, KDK_INIT_PARAMETER_COUNT);
 }
 
+/**
+ * Send the periodic poll request.
+ * The frame only changes with the parameter table ID, it is encoded once and
+ * only the counter and checksum are patched for every request.
+ */
 void KdkConnectionManager::send_message_0910_poll(void) {
-  // List of IDs to poll
-  std::vector<uint16_t> id_list{
-      0x8000,  // Fan ON/OFF
-      0xF000,  // Fan Speed
-      // 0x8600,  // UNKNOWN, large 46-bytes parameter
-      0x8800,  // UNKNOWN, always 0x42
-      0xF800,  // Some kind of parameter mask, sent when changing the fan states
-      0xF200,  // Fan Yuragi
-      0xF100,  // Fan Direction
-      0xF900,  // UNKNOWN, always 0x00 0x00
-      0xFA00,  // Some kind of parameter mask, sent when changing the fan states
-      0xFB00,  // UNKNOWN, always 0x00 0x00
-      0xF300,  // Light ON/OFF
-      0xF500,  // Light Brightness
-      0xF400,  // Light Mode
-      0xF700,  // NightLight Brightness
-      0xF600,  // Light Color
-  };
-
-  this->send_message_0910(id_list);
+  auto &poll = this->tx_.poll_template;
+
+  if ((poll.length == 0) || (poll.parameter_table_id != this->state_.parameter_table_id)) {
+    this->send_message_0910(KDK_POLL_PARAMETER_IDS, KDK_POLL_PARAMETER_COUNT);
+
+    // Save the encoded frame, excluding the counter from the sum
+    memcpy(poll.buffer, this->tx_.buffer, this->tx_.buffer_length);
+    poll.length = this->tx_.buffer_length;
+    poll.parameter_table_id = this->state_.parameter_table_id;
+    poll.sum = 0;
+    for (int i = 0; i < (poll.length - KDK_MESSAGE_CHECKSUM_SIZE); i++) {
+      poll.sum += poll.buffer[i];
+    }
+    poll.sum -= poll.buffer[offsetof(struct KdkMsg, counter)];
+    return;
+  }
+
+  this->tx_.counter++;  // Advance TX counter before transmitting, value is reset to 0xFF on SYNC
+
+  memcpy(this->tx_.buffer, poll.buffer, poll.length);
+  this->tx_.buffer[offsetof(struct KdkMsg, counter)] = this->tx_.counter;
+  this->tx_.buffer[poll.length - KDK_MESSAGE_CHECKSUM_SIZE] = (0 - (poll.sum + this->tx_.counter)) & 0xFF;
+  this->tx_.buffer_length = poll.length;
+  this->transmit_message();
+
+  this->state_.waiting_response = true;
+
+  ESP_LOGV(TAG, "TX> Send Poll Request:");
+  ESP_LOGV(TAG, "TX>   counter: %d", this->tx_.counter);
 }
 
 /*******************************************************************************
@@ -691,10 +1163,8 @@ void KdkConnectionManager::send_message_0910_poll(void) {
  * Observed to be every 600s. Return a status that it is happy with.
  */
 void KdkConnectionManager::process_message_0101(const KdkMsg *msg) {
-  const uint8_t counter = msg->counter;
-  const uint16_t command = SET_RESPONSE_MESSAGE(msg->command);
-  uint8_t payload[] = {0x00, 0x11, 0x13};
-  this->send_response(counter, command, payload, sizeof(payload));
+  this->scheduler_enqueue(KDK_TRANSACTION_RESPONSE_0101, KDK_TRANSACTION_PRIORITY_RESPONSE,
+                          KDK_SCHEDULER_RESPONSE_DEADLINE, msg->counter);
   this->state_.last_ping_timestamp = millis();
 }
 
@@ -720,13 +1190,15 @@ void KdkConnectionManager::process_message_0A10(const KdkMsg *msg) {
   // Parse new state(s)
   this->parse_parameter_response(&payload[4]);
 
-  // Send response
-  const uint8_t counter = msg->counter;
-  const uint16_t command = SET_RESPONSE_MESSAGE(msg->command);
-  this->send_response(counter, command, &payload[0], 4);  // Return the Status? and Parameter Table ID
+  // Send response, return the Status? and Parameter Table ID
+  this->scheduler_enqueue(KDK_TRANSACTION_RESPONSE_0A10, KDK_TRANSACTION_PRIORITY_RESPONSE,
+                          KDK_SCHEDULER_RESPONSE_DEADLINE, msg->counter, &payload[0]);
 
   // Pull the other states
-  this->fsm_push_event(KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PULL_STATES);
+  if (this->is_ready()) {
+    this->scheduler_enqueue(KDK_TRANSACTION_PULL_STATES_0910, KDK_TRANSACTION_PRIORITY_VERIFY,
+                            KDK_SCHEDULER_VERIFY_DEADLINE);
+  }
 }
 
 void KdkConnectionManager::process_message(void) {
@@ -740,6 +1212,7 @@ void KdkConnectionManager::process_message(void) {
     // Log warning if we are seeing a RESPONSE message,
     // they should always be handled by the FSM earlier.
     ESP_LOGW(TAG, "MSG> Unhandled RESPONSE CMD=%04X", msg->command);
+    this->clear_message_pending();
     return;
   }
 
@@ -756,13 +1229,291 @@ void KdkConnectionManager::process_message(void) {
   }
 }
 
+/*******************************************************************************
+ * PROTECTED - SCHEDULER
+ ******************************************************************************/
+
+/* Once the module is initialized, all transactions are queued in the scheduler.
+ * Responses to device requests are posted and are sent as soon as they are
+ * queued. Requests are sent one at a time, the highest priority class first and
+ * the oldest transaction first within a class. A transaction is promoted by one
+ * class for every KDK_SCHEDULER_AGING_TIME it has waited to prevent starvation.
+ */
+
+bool KdkConnectionManager::scheduler_is_queued(KdkTransactionType type) {
+  if (this->sched_.active_valid && (this->sched_.active.type == type)) {
+    return true;
+  }
+  for (int i = 0; i < this->sched_.queue_depth; i++) {
+    if (this->sched_.queue[i].type == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void KdkConnectionManager::scheduler_enqueue(KdkTransactionType type, KdkTransactionPriority priority,
+                                             uint32_t deadline, uint8_t counter, const uint8_t *payload) {
+  // Coalesce requests, a queued request is upgraded to the higher priority class
+  if ((type == KDK_TRANSACTION_PUSH_STATES_0810) || (type == KDK_TRANSACTION_PULL_STATES_0910)) {
+    for (int i = 0; i < this->sched_.queue_depth; i++) {
+      auto &queued = this->sched_.queue[i];
+      if (queued.type == type) {
+        if (priority < queued.priority) {
+          queued.priority = priority;
+          queued.deadline = deadline;
+        }
+        return;
+      }
+    }
+  }
+
+  if (this->sched_.queue_depth >= KDK_SCHEDULER_QUEUE_SIZE) {
+    ESP_LOGW(TAG, "SCHED> Queue full, dropping %s transaction", this->get_priority_name(priority).c_str());
+    this->sched_.overflow_count++;
+    return;
+  }
+
+  auto &transaction = this->sched_.queue[this->sched_.queue_depth++];
+  transaction.type = type;
+  transaction.priority = priority;
+  transaction.enqueue_timestamp = millis();
+  transaction.deadline = deadline;
+  transaction.counter = counter;
+  if (payload != nullptr) {
+    memcpy(transaction.payload, payload, sizeof(transaction.payload));
+  }
+
+  this->sched_.max_queue_depth = std::max(this->sched_.max_queue_depth, this->sched_.queue_depth);
+}
+
+void KdkConnectionManager::scheduler_reset(void) {
+  this->sched_.queue_depth = 0;
+  this->sched_.active_valid = false;
+}
+
+/**
+ * Complete the active request once its response is received.
+ */
+void KdkConnectionManager::scheduler_complete(void) {
+  if (!this->sched_.active_valid) {
+    return;
+  }
+
+  auto &active = this->sched_.active;
+
+  switch (active.type) {
+    case KDK_TRANSACTION_PUSH_STATES_0810: {
+      if (!this->is_message_response(0x0810)) {
+        return;
+      }
+      this->clear_message_pending();
+
+      this->resolve_in_flight_writes(KDK_WRITE_RESULT_ACKNOWLEDGED);
+
+      // Read back the states that were written
+      this->scheduler_enqueue(KDK_TRANSACTION_PULL_STATES_0910, KDK_TRANSACTION_PRIORITY_VERIFY,
+                              KDK_SCHEDULER_VERIFY_DEADLINE);
+    } break;
+
+    case KDK_TRANSACTION_PULL_STATES_0910: {
+      if (!this->is_message_response(0x0910)) {
+        return;
+      }
+      this->parse_parameter_response(&this->message()->payload[4]);
+      this->clear_message_pending();
+
+      this->state_.last_update_timestamp = millis();
+      this->notify_clients_on_parameter_update();
+    } break;
+
+    default:
+      break;
+  }
+
+  this->sched_.active_valid = false;
+}
+
+/**
+ * Drop queued transactions that have waited longer than their deadline.
+ */
+void KdkConnectionManager::scheduler_expire(uint32_t now) {
+  uint8_t depth = 0;
+  for (int i = 0; i < this->sched_.queue_depth; i++) {
+    auto &transaction = this->sched_.queue[i];
+    const uint32_t wait = now - transaction.enqueue_timestamp;
+    if ((transaction.deadline != 0) && (wait > transaction.deadline)) {
+      // Pending writes remain in their debouncers and are queued again
+      ESP_LOGW(TAG, "SCHED> %s transaction expired after %d ms", this->get_priority_name(transaction.priority).c_str(),
+               wait);
+      this->sched_.stats[transaction.priority].expired++;
+      continue;
+    }
+    this->sched_.queue[depth++] = transaction;
+  }
+  this->sched_.queue_depth = depth;
+}
+
+void KdkConnectionManager::scheduler_dispatch(uint32_t now) {
+  // Responses are posted and do not wait for the active request
+  uint8_t depth = 0;
+  for (int i = 0; i < this->sched_.queue_depth; i++) {
+    auto &transaction = this->sched_.queue[i];
+    if (transaction.priority == KDK_TRANSACTION_PRIORITY_RESPONSE) {
+      this->scheduler_start(transaction);
+      continue;
+    }
+    this->sched_.queue[depth++] = transaction;
+  }
+  this->sched_.queue_depth = depth;
+
+  // Only a single request may wait for a response
+  if (this->sched_.active_valid || this->is_waiting_response() || (this->sched_.queue_depth == 0)) {
+    return;
+  }
+
+  // Select by effective priority, then by age
+  int selected = -1;
+  int selected_priority = 0;
+  for (int i = 0; i < this->sched_.queue_depth; i++) {
+    auto &transaction = this->sched_.queue[i];
+    const int promotion = (now - transaction.enqueue_timestamp) / KDK_SCHEDULER_AGING_TIME;
+    const int priority = std::max((int) transaction.priority - promotion, (int) KDK_TRANSACTION_PRIORITY_WRITE);
+    if ((selected < 0) || (priority < selected_priority) ||
+        ((priority == selected_priority) &&
+         ((now - transaction.enqueue_timestamp) > (now - this->sched_.queue[selected].enqueue_timestamp)))) {
+      selected = i;
+      selected_priority = priority;
+    }
+  }
+
+  struct KdkTransaction transaction = this->sched_.queue[selected];
+  for (int i = selected + 1; i < this->sched_.queue_depth; i++) {
+    this->sched_.queue[i - 1] = this->sched_.queue[i];
+  }
+  this->sched_.queue_depth--;
+
+  if (selected_priority < transaction.priority) {
+    this->sched_.stats[transaction.priority].promoted++;
+  }
+
+  this->scheduler_start(transaction);
+}
+
+void KdkConnectionManager::scheduler_start(const struct KdkTransaction &transaction) {
+  const uint32_t now = millis();
+  const uint32_t wait = now - transaction.enqueue_timestamp;
+
+  auto &stats = this->sched_.stats[transaction.priority];
+  stats.dispatched++;
+  stats.total_wait += wait;
+  stats.max_wait = std::max(stats.max_wait, wait);
+
+  switch (transaction.type) {
+    case KDK_TRANSACTION_RESPONSE_0101: {
+      uint8_t payload[] = {0x00, 0x11, 0x13};
+      this->send_response(transaction.counter, SET_RESPONSE_MESSAGE(0x0101), payload, sizeof(payload));
+    } break;
+
+    case KDK_TRANSACTION_RESPONSE_0A10: {
+      this->send_response(transaction.counter, SET_RESPONSE_MESSAGE(0x0A10), transaction.payload,
+                          sizeof(transaction.payload));
+    } break;
+
+    case KDK_TRANSACTION_PUSH_STATES_0810: {
+      // Batch the writes of all clients that are due into a single request
+      bool due = false;
+      for (auto &it : this->state_.write_debouncers) {
+        auto &debouncer = it.second;
+        if (!this->is_write_due(debouncer, now)) {
+          continue;
+        }
+        due = true;
+        debouncer.last_write_timestamp = now;
+        debouncer.pending = false;
+        debouncer.in_flight = true;
+        debouncer.in_flight_callback = std::move(debouncer.callback);
+        debouncer.in_flight_request_timestamp = debouncer.request_timestamp;
+        debouncer.callback = nullptr;
+      }
+      if (!due) {
+        return;
+      }
+      if (!this->send_message_0810()) {
+        this->resolve_in_flight_writes(KDK_WRITE_RESULT_FAILED);
+        return;
+      }
+      this->sched_.active = transaction;
+      this->sched_.active_valid = true;
+    } break;
+
+    case KDK_TRANSACTION_PULL_STATES_0910: {
+      this->send_message_0910_poll();
+      this->sched_.active = transaction;
+      this->sched_.active_valid = true;
+    } break;
+  }
+
+  ESP_LOGV(TAG, "SCHED> Started %s transaction after %d ms, queue depth %d",
+           this->get_priority_name(transaction.priority).c_str(), wait, this->sched_.queue_depth);
+}
+
+void KdkConnectionManager::scheduler_run(void) {
+  const uint32_t now = millis();
+
+  // Requests are only scheduled once the module is initialized
+  if (this->fsm_.state == KDK_COMM_STATE_IDLE) {
+    this->scheduler_complete();
+
+    if (this->is_update_pending()) {
+      this->scheduler_enqueue(KDK_TRANSACTION_PUSH_STATES_0810, KDK_TRANSACTION_PRIORITY_WRITE,
+                              KDK_SCHEDULER_WRITE_DEADLINE);
+    }
+
+    const uint32_t elapsed = (now - this->state_.last_update_timestamp);
+    if ((elapsed > this->cfg_.poll_interval) && !this->scheduler_is_queued(KDK_TRANSACTION_PULL_STATES_0910)) {
+      this->scheduler_enqueue(KDK_TRANSACTION_PULL_STATES_0910, KDK_TRANSACTION_PRIORITY_POLL,
+                              this->cfg_.poll_interval);
+    }
+
+    this->scheduler_expire(now);
+  }
+
+  this->scheduler_dispatch(now);
+}
+
 /*******************************************************************************
  * PROTECTED - FSM
  ******************************************************************************/
 
 void KdkConnectionManager::fsm_push_event(KdkCommFsmEvent event) {
+  auto &fsm = this->fsm_;
+
+  // Coalesce with an identical pending event, handling it twice would not change the outcome
+  for (int i = 0; i < fsm.event_count; i++) {
+    if (fsm.event_queue[(fsm.event_head + i) % KDK_FSM_EVENT_QUEUE_SIZE] == event) {
+      fsm.event_coalesced_count++;
+      return;
+    }
+  }
+
+  if (fsm.event_count >= KDK_FSM_EVENT_QUEUE_SIZE) {
+    ESP_LOGW(TAG, "FSM> Event queue full, dropping %s", this->get_event_name(event).c_str());
+    fsm.event_overflow_count++;
+    return;
+  }
+
   // Push event to the queue
-  this->fsm_.event_queue.push(event);
+  fsm.event_queue[(fsm.event_head + fsm.event_count) % KDK_FSM_EVENT_QUEUE_SIZE] = event;
+  fsm.event_count++;
+}
+
+KdkCommFsmEvent KdkConnectionManager::fsm_pop_event(void) {
+  auto &fsm = this->fsm_;
+  KdkCommFsmEvent event = fsm.event_queue[fsm.event_head];
+  fsm.event_head = (fsm.event_head + 1) % KDK_FSM_EVENT_QUEUE_SIZE;
+  fsm.event_count--;
+  return event;
 }
 
 void KdkConnectionManager::fsm_run(void) {
@@ -771,11 +1522,10 @@ void KdkConnectionManager::fsm_run(void) {
     return;
   }
 
-  while (!this->fsm_.event_queue.empty()) {
+  while (this->fsm_.event_count > 0) {
     KdkCommFsmState curr_state = this->fsm_.state;
-    KdkCommFsmEvent event = this->fsm_.event_queue.front();
+    KdkCommFsmEvent event = this->fsm_pop_event();
     KdkCommFsmState next_state = this->fsm_next_state(curr_state, event);
-    this->fsm_.event_queue.pop();
 
     if (next_state == KdkCommFsmState::KDK_COMM_STATE_NONE) {
       continue;
@@ -784,6 +1534,14 @@ void KdkConnectionManager::fsm_run(void) {
     if (next_state != curr_state) {
       ESP_LOGD(TAG, "FSM> EVENT: %s", this->get_event_name(event).c_str());
       this->fsm_state_handlers(KdkCommFsmMethod::KDK_COMM_FSM_EXIT);
+      const uint8_t states[2] = {(uint8_t) curr_state, (uint8_t) next_state};
+      this->trace_record(KDK_TRACE_FSM, 0, event, states, sizeof(states));
+      // Keep what led to a recovery or a resync of a ready link, should the power fail next
+      if ((next_state == KDK_COMM_STATE_INIT_SYNC) &&
+          ((event == KDK_COMM_FSM_EVENT_SYNC_RECOVERY) || (this->fsm_.ready_count > 0))) {
+        this->trace_snapshot_save();
+      }
+      this->fsm_record_transition(curr_state, next_state, millis());
       this->fsm_.state = next_state;
     }
 
@@ -793,6 +1551,61 @@ void KdkConnectionManager::fsm_run(void) {
   this->fsm_state_handlers(KdkCommFsmMethod::KDK_COMM_FSM_LOOP);
 }
 
+/**
+ * Account the time spent in 'curr_state' and the start of init sequences.
+ */
+void KdkConnectionManager::fsm_record_transition(KdkCommFsmState curr_state, KdkCommFsmState next_state,
+                                                 uint32_t now) {
+  auto &fsm = this->fsm_;
+
+  auto &curr = fsm.state_stats[curr_state];
+  curr.last_dwell = now - curr.entry_timestamp;
+  curr.dwell += curr.last_dwell;
+
+  auto &next = fsm.state_stats[next_state];
+  next.entry_timestamp = now;
+  next.entries++;
+
+  if (next_state == KDK_COMM_STATE_INIT_SYNC) {
+    fsm.init_timestamp = now;
+    fsm.init_count++;
+  } else if (next_state == KDK_COMM_STATE_INIT_DONE) {
+    fsm.last_time_to_ready = now - fsm.init_timestamp;
+    fsm.max_time_to_ready = std::max(fsm.max_time_to_ready, fsm.last_time_to_ready);
+    if (fsm.ready_count++ == 0) {
+      fsm.boot_time_to_ready = now;
+    }
+    ESP_LOGD(TAG, "FSM> Ready after %" PRIu32 " ms", fsm.last_time_to_ready);
+
+#ifdef USE_SENSOR
+    if (this->sensors_.time_to_ready != nullptr) {
+      this->sensors_.time_to_ready->publish_state(fsm.last_time_to_ready);
+    }
+#endif
+  }
+}
+
+void KdkConnectionManager::fsm_dump_stats(uint32_t now) {
+  auto &fsm = this->fsm_;
+
+  ESP_LOGCONFIG(TAG, "  Init: started=%" PRIu32 ", completed=%" PRIu32, fsm.init_count, fsm.ready_count);
+  ESP_LOGCONFIG(TAG, "    Time To Ready: boot=%" PRIu32 " ms, last=%" PRIu32 " ms, max=%" PRIu32 " ms",
+                fsm.boot_time_to_ready, fsm.last_time_to_ready, fsm.max_time_to_ready);
+  for (int i = 0; i < KDK_COMM_STATE_COUNT; i++) {
+    auto &stats = fsm.state_stats[i];
+    if ((stats.entries == 0) && (stats.dwell == 0) && (i != fsm.state)) {
+      continue;  // Never visited, the initial state has no entry but a dwell time
+    }
+    // Include the ongoing visit of the current state
+    const uint32_t dwell = stats.dwell + ((i == fsm.state) ? (now - stats.entry_timestamp) : 0);
+    ESP_LOGCONFIG(TAG,
+                  "    %-13s: entries=%" PRIu32 ", dwell=%" PRIu32 " ms, last=%" PRIu32 " ms, retries=%" PRIu32
+                  ", recoveries=%" PRIu32,
+                  this->get_state_name((KdkCommFsmState) i).c_str(), stats.entries, dwell, stats.last_dwell,
+                  stats.retries, stats.recoveries);
+  }
+}
+
 KdkCommFsmState KdkConnectionManager::fsm_next_state(KdkCommFsmState state, KdkCommFsmEvent event) {
   // Special handling for SYNC
   if ((event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_SYNC_RECEIVED) ||
@@ -897,29 +1710,12 @@ KdkCommFsmState KdkConnectionManager::fsm_next_state(KdkCommFsmState state, KdkC
 
     case KdkCommFsmState::KDK_COMM_STATE_INIT_DONE: {
       if (event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_INIT_DONE) {
-        return KdkCommFsmState::KDK_COMM_STATE_PULL_STATES_0910; /* Pull initial state */
-      }
-    } break;
-
-    case KdkCommFsmState::KDK_COMM_STATE_IDLE: {
-      if (event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PULL_STATES) {
-        return KdkCommFsmState::KDK_COMM_STATE_PULL_STATES_0910;
-      }
-      if (event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PUSH_STATES) {
-        return KdkCommFsmState::KDK_COMM_STATE_PUSH_STATES_0810;
-      }
-    } break;
-
-    case KdkCommFsmState::KDK_COMM_STATE_PULL_STATES_0910: {
-      if (event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_RESPONSE_RECEIVED) {
         return KdkCommFsmState::KDK_COMM_STATE_IDLE;
       }
     } break;
 
-    case KdkCommFsmState::KDK_COMM_STATE_PUSH_STATES_0810: {
-      if (event == KdkCommFsmEvent::KDK_COMM_FSM_EVENT_RESPONSE_RECEIVED) {
-        return KdkCommFsmState::KDK_COMM_STATE_IDLE;
-      }
+    case KdkCommFsmState::KDK_COMM_STATE_IDLE: {
+      // Only SYNC leaves the steady state, transactions are handled by the scheduler
     } break;
   }
 
@@ -969,6 +1765,11 @@ void KdkConnectionManager::fsm_state_handlers(KdkCommFsmMethod method) {
           this->state_.waiting_response = false;
           this->state_.message_pending = false;
 
+          this->scheduler_reset();
+
+          // Writes that were not acknowledged are lost, pending writes are sent once initialized
+          this->resolve_in_flight_writes(KDK_WRITE_RESULT_FAILED);
+
           this->send_request(0x0600, NULL, 0, true);  // No response expected
         } break;
         case KdkCommFsmMethod::KDK_COMM_FSM_LOOP: {
@@ -1172,54 +1973,16 @@ void KdkConnectionManager::fsm_state_handlers(KdkCommFsmMethod method) {
     case KdkCommFsmState::KDK_COMM_STATE_IDLE: {
       switch (method) {
         case KdkCommFsmMethod::KDK_COMM_FSM_ENTRY: {
+          // Pull initial state
+          this->scheduler_enqueue(KDK_TRANSACTION_PULL_STATES_0910, KDK_TRANSACTION_PRIORITY_VERIFY,
+                                  KDK_SCHEDULER_VERIFY_DEADLINE);
         } break;
         case KdkCommFsmMethod::KDK_COMM_FSM_LOOP: {
-          if (this->is_update_pending()) {
-            this->fsm_push_event(KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PUSH_STATES);
-            return;
-          }
-
-          const uint32_t elapsed = (now - this->state_.last_update_timestamp);
-          if (elapsed > this->cfg_.poll_interval) {
-            this->fsm_push_event(KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PULL_STATES);
-            return;
-          }
         } break;
         case KdkCommFsmMethod::KDK_COMM_FSM_EXIT: {
         } break;
       }
     } break;
-
-    case KdkCommFsmState::KDK_COMM_STATE_PULL_STATES_0910: {
-      switch (method) {
-        case KdkCommFsmMethod::KDK_COMM_FSM_ENTRY: {
-          this->send_message_0910_poll();
-        } break;
-        case KdkCommFsmMethod::KDK_COMM_FSM_LOOP: {
-          this->process_response_0910();
-        } break;
-        case KdkCommFsmMethod::KDK_COMM_FSM_EXIT: {
-          this->state_.last_update_timestamp = now;
-          this->notify_clients_on_parameter_update();
-        } break;
-      }
-    } break;
-
-    case KdkCommFsmState::KDK_COMM_STATE_PUSH_STATES_0810: {
-      switch (method) {
-        case KdkCommFsmMethod::KDK_COMM_FSM_ENTRY: {
-          auto &list = this->state_.pending_parameter_update_list;
-          this->send_message_0810(list);
-          list.clear();
-        } break;
-        case KdkCommFsmMethod::KDK_COMM_FSM_LOOP: {
-          this->process_response_default(0x0810);
-        } break;
-        case KdkCommFsmMethod::KDK_COMM_FSM_EXIT: {
-          this->fsm_push_event(KdkCommFsmEvent::KDK_COMM_FSM_EVENT_PULL_STATES);
-        } break;
-      }
-    } break;
   }
 }
 
@@ -1227,6 +1990,8 @@ void KdkConnectionManager::fsm_state_handlers(KdkCommFsmMethod method) {
  * PUBLIC
  ******************************************************************************/
 
+void KdkConnectionManager::setup() { this->trace_snapshot_load(); }
+
 void KdkConnectionManager::dump_config() {
   const uint32_t now = millis();
 
@@ -1234,11 +1999,57 @@ void KdkConnectionManager::dump_config() {
 
   LOG_UPDATE_INTERVAL(this);
 
+  ESP_LOGCONFIG(TAG, "  Poll Interval: %" PRIu32 " ms", this->cfg_.poll_interval);
+  ESP_LOGCONFIG(TAG, "  Write Interval: %" PRIu32 " ms", this->cfg_.write_interval);
+  ESP_LOGCONFIG(TAG, "  Stats Interval: %" PRIu32 " ms", this->cfg_.stats_interval);
+  ESP_LOGCONFIG(TAG, "  Event Driven: %s", YESNO(this->cfg_.event_driven));
+
   ESP_LOGCONFIG(TAG, "  Last Ping: %ds ago", ((uint) (now - this->state_.last_ping_timestamp) / 1000U));
 
   ESP_LOGCONFIG(TAG, "  FSM State: %s", this->get_state_name(this->fsm_.state).c_str());
+  ESP_LOGCONFIG(TAG, "  FSM Events: coalesced=%" PRIu32 ", overflow=%" PRIu32, this->fsm_.event_coalesced_count,
+                this->fsm_.event_overflow_count);
+  this->fsm_dump_stats(now);
+
+  ESP_LOGCONFIG(TAG, "  Scheduler:");
+  ESP_LOGCONFIG(TAG, "    Queue Depth: %d (max %d, overflow %" PRIu32 ")", this->sched_.queue_depth,
+                this->sched_.max_queue_depth, this->sched_.overflow_count);
+  for (int i = 0; i < KDK_TRANSACTION_PRIORITY_COUNT; i++) {
+    auto &stats = this->sched_.stats[i];
+    const uint32_t mean_wait = (stats.dispatched > 0) ? (stats.total_wait / stats.dispatched) : 0;
+    ESP_LOGCONFIG(TAG,
+                  "    %-8s: dispatched=%" PRIu32 ", expired=%" PRIu32 ", promoted=%" PRIu32 ", wait=%" PRIu32
+                  "/%" PRIu32 " ms (mean/max)",
+                  this->get_priority_name((KdkTransactionPriority) i).c_str(), stats.dispatched, stats.expired,
+                  stats.promoted, mean_wait, stats.max_wait);
+  }
+
+  auto &link = this->link_.counters;
+  ESP_LOGCONFIG(TAG, "  Link:");
+  ESP_LOGCONFIG(TAG, "    Frames: rx=%" PRIu32 ", tx=%" PRIu32 ", duty cycle=%.1f%%", link.rx_frames, link.tx_frames,
+                this->link_.duty_cycle);
+  ESP_LOGCONFIG(TAG, "    Errors: checksum=%" PRIu32 ", oversize=%" PRIu32 ", byte timeout=%" PRIu32,
+                link.checksum_errors, link.oversize_frames, link.byte_timeouts);
+  ESP_LOGCONFIG(TAG, "    Timeouts: response=%" PRIu32 ", retransmits=%" PRIu32 ", recoveries=%" PRIu32,
+                link.response_timeouts, link.retransmits, link.recoveries);
+  for (auto &it : this->link_.rtt) {
+    if (it.count == 0) {
+      continue;
+    }
+    ESP_LOGCONFIG(TAG, "    RTT %04X: count=%" PRIu32 ", p50=%" PRIu32 " ms, p95=%" PRIu32 " ms, max=%" PRIu32 " ms",
+                  it.command, it.count, this->link_rtt_percentile(it, 50), this->link_rtt_percentile(it, 95), it.max);
+  }
 
-  ESP_LOGCONFIG(TAG, "  Clients (%d):", this->state_.clients.size());
+  this->profiler_.dump(TAG, KDK_PROFILE_PHASE_NAMES);
+
+  ESP_LOGCONFIG(TAG, "  Writes:");
+  ESP_LOGCONFIG(TAG, "    Acknowledged: %" PRIu32, this->state_.write_acknowledged_count);
+  ESP_LOGCONFIG(TAG, "    Superseded: %" PRIu32, this->state_.write_superseded_count);
+  ESP_LOGCONFIG(TAG, "    Failed: %" PRIu32, this->state_.write_failed_count);
+  ESP_LOGCONFIG(TAG, "    Latency: last=%" PRIu32 " ms, max=%" PRIu32 " ms", this->state_.last_write_latency,
+                this->state_.max_write_latency);
+
+  ESP_LOGCONFIG(TAG, "  Clients (%zu):", this->state_.clients.size());
   for (auto *client : this->state_.clients) {
     ESP_LOGCONFIG(TAG, "  - %s", client->name().c_str());
   }
@@ -1247,7 +2058,7 @@ void KdkConnectionManager::dump_config() {
   ESP_LOGCONFIG(TAG, "  Product Serial: %s", this->state_.product_serial.c_str());
   ESP_LOGCONFIG(TAG, "  Parameter Table ID: 0x%06X", this->state_.parameter_table_id);
 
-  ESP_LOGCONFIG(TAG, "  Parameter Count: %d", this->state_.parameters.size());
+  ESP_LOGCONFIG(TAG, "  Parameter Count: %zu", this->state_.parameters.size());
   auto i = 0;
   for (auto const &x : this->state_.parameters) {
     auto &param = x.second;
@@ -1256,22 +2067,102 @@ void KdkConnectionManager::dump_config() {
   }
 
   this->check_uart_settings(KDK_SUPPORTED_BAUD_RATE, 1, uart::UART_CONFIG_PARITY_EVEN, 8);
+
+#ifdef USE_ESP32
+  if (this->trace_snapshot_loaded_) {
+    ESP_LOGW(TAG, "TRACE> Snapshot from flash of the last recovery, reset reason: %s", get_reset_reason_name());
+    this->trace_print(*this->recovered_trace_);
+  } else if (this->recovered_trace_ != nullptr) {
+    ESP_LOGW(TAG, "TRACE> Recovered trace of the previous boot, reset reason: %s", get_reset_reason_name());
+    this->trace_print(*this->recovered_trace_);
+  }
+#endif
+
+  this->dump_trace();
+}
+
+/**
+ * Log the trace ring, oldest entry first. Safe to call from a lambda.
+ */
+void KdkConnectionManager::dump_trace(void) {
+  ESP_LOGI(TAG, "TRACE> %d entries, now=%" PRIu32 " ms", this->trace_->count, millis());
+  this->trace_print(*this->trace_);
+}
+
+void KdkConnectionManager::trace_print(const struct KdkTraceStore &trace) {
+  for (int i = 0; i < trace.count; i++) {
+    auto &entry = trace.entries[(trace.head + KDK_TRACE_SIZE - trace.count + i) % KDK_TRACE_SIZE];
+    if (entry.check != trace_entry_check(entry)) {
+      ESP_LOGI(TAG, "TRACE> (corrupted entry)");
+      continue;
+    }
+
+    switch (entry.type) {
+      case KDK_TRACE_RX:
+      case KDK_TRACE_TX: {
+        char data_str[KDK_HEX_STR_SIZE];
+        ESP_LOGI(TAG, "TRACE> %10" PRIu32 " %s CNT=%02X CMD=%04X LEN=%-3d %s%s", entry.timestamp,
+                 (entry.type == KDK_TRACE_RX) ? "RX" : "TX", entry.counter, entry.command, entry.length,
+                 this->hex2str(data_str, sizeof(data_str), entry.payload,
+                               std::min(entry.length, KDK_TRACE_PAYLOAD_SIZE)),
+                 (entry.length > KDK_TRACE_PAYLOAD_SIZE) ? "..." : "");
+      } break;
+
+      case KDK_TRACE_FSM: {
+        ESP_LOGI(TAG, "TRACE> %10" PRIu32 " FSM %s -> %s (%s)", entry.timestamp,
+                 this->get_state_name((KdkCommFsmState) entry.payload[0]).c_str(),
+                 this->get_state_name((KdkCommFsmState) entry.payload[1]).c_str(),
+                 this->get_event_name((KdkCommFsmEvent) entry.command).c_str());
+      } break;
+    }
+  }
+}
+
+void KdkConnectionManager::loop() {
+  // In event driven mode update() is not scheduled, it runs only when work is due
+  if (this->cfg_.event_driven && this->is_update_due(millis())) {
+    this->update();
+  }
 }
 
 void KdkConnectionManager::update() {
+  this->profiler_.begin();
+
   // Process received bytes
   while (this->available() && (!this->is_message_pending())) {
     uint8_t byte;
-    this->read_byte(&byte);
+    if (!this->read_byte(&byte)) {
+      break;
+    }
+    this->link_.counters.rx_bytes++;
     this->receiver_process_byte(byte);
   }
+  this->profiler_.mark(KDK_PROFILE_PHASE_RX);
 
   // Check response timeout
   this->check_response_timeout();
+  this->profiler_.mark(KDK_PROFILE_PHASE_TIMEOUT);
 
   this->fsm_run();
+  this->profiler_.mark(KDK_PROFILE_PHASE_FSM);
+
+  this->scheduler_run();
+  this->profiler_.mark(KDK_PROFILE_PHASE_SCHEDULER);
 
   this->process_message();
+  this->profiler_.mark(KDK_PROFILE_PHASE_PROCESS);
+
+  this->link_update_stats(millis());
+  this->profiler_.mark(KDK_PROFILE_PHASE_STATS);
+
+  this->profiler_.end();
+}
+
+void KdkConnectionManager::set_event_driven(bool value) {
+  this->cfg_.event_driven = value;
+  if (value) {
+    this->set_update_interval(SCHEDULER_DONT_RUN);
+  }
 }
 
 void KdkConnectionManager::register_client(KdkConnectionClient *client) {
@@ -1289,10 +2180,28 @@ const std::vector<uint8_t> KdkConnectionManager::get_parameter_data(uint16_t id)
   return it->second.data;
 }
 
-void KdkConnectionManager::update_parameter_data(std::vector<struct KdkParamUpdate> parameters) {
-  auto &update_list = this->state_.pending_parameter_update_list;
-  update_list.clear();  // Only single batch update is supported
-  update_list.insert(update_list.end(), parameters.begin(), parameters.end());
+void KdkConnectionManager::update_parameter_data(KdkConnectionClient *client,
+                                                 std::vector<struct KdkParamUpdate> parameters,
+                                                 KdkWriteCallback callback) {
+  auto &debouncer = this->state_.write_debouncers[client];
+
+  // Replace the pending values, only the most recent values of a client are written
+  if (debouncer.pending) {
+    this->resolve_write(debouncer.callback, debouncer.request_timestamp, KDK_WRITE_RESULT_SUPERSEDED);
+  }
+  debouncer.parameters = std::move(parameters);
+  debouncer.pending = true;
+  debouncer.callback = std::move(callback);
+  debouncer.request_timestamp = millis();
+
+  // Reflect the requested values immediately so clients read back their target
+  auto &store = this->state_.parameters;
+  for (auto &parameter : debouncer.parameters) {
+    auto it = store.find(parameter.id);
+    if ((it != store.end()) && (it->second.data.size() == parameter.data.size())) {
+      it->second.data = parameter.data;
+    }
+  }
 }
 
 }  // namespace kdk
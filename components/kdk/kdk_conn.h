@@ -2,13 +2,21 @@
 
 #include "esphome/core/component.h"
 #include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_TEXT_SENSOR
+#include "esphome/components/text_sensor/text_sensor.h"
+#endif
 
 #include <map>
-#include <queue>
+#include <memory>
 #include <vector>
 
 #include "kdk_conn_client.h"
+#include "kdk_profiler.h"
 
 namespace esphome {
 namespace kdk {
@@ -23,7 +31,40 @@ static const uint32_t KDK_RECV_TIMEOUT = 300;  // Message response timeout in ms
 static const uint32_t KDK_SEND_MAX_RETRY = 5;  // Number of retry attempts when a response is not received
 
 static const uint32_t KDK_DEFAULT_POLL_INTERVAL = 5000;
+static const uint32_t KDK_DEFAULT_WRITE_INTERVAL = 250;  // Minimum time in ms between writes from the same client
 static const uint32_t KDK_WAIT_SYNC_TIMEOUT = 7500;
+static const uint32_t KDK_DEFAULT_STATS_INTERVAL = 60000;  // Time in ms between link statistics updates
+
+// FSM Constants
+static const uint8_t KDK_FSM_EVENT_QUEUE_SIZE = 8;
+
+// Transaction Scheduler Constants
+static const uint8_t KDK_SCHEDULER_QUEUE_SIZE = 8;
+static const uint32_t KDK_SCHEDULER_AGING_TIME = 2000;         // Time in ms a transaction waits before promotion
+static const uint32_t KDK_SCHEDULER_RESPONSE_DEADLINE = 1000;  // Time in ms to respond to a device request
+static const uint32_t KDK_SCHEDULER_WRITE_DEADLINE = 10000;    // Time in ms a write may wait before it is re-queued
+static const uint32_t KDK_SCHEDULER_VERIFY_DEADLINE = 5000;    // Time in ms a verification read may wait
+
+// Link Statistics Constants
+static const uint8_t KDK_RTT_BUCKET_COUNT = 12;
+static const uint16_t KDK_RTT_BUCKET_LIMITS[KDK_RTT_BUCKET_COUNT] = {
+    10, 20, 30, 40, 50, 75, 100, 150, 200, 300, 500, UINT16_MAX,  // Upper bound in ms of each RTT bucket
+};
+static const uint8_t KDK_UART_BITS_PER_BYTE = 11;  // START + 8 DATA + PARITY + STOP
+
+// Request commands with a response, any other command is counted in the last RTT slot as FFFF
+static const uint16_t KDK_RTT_COMMANDS[] = {0x0001, 0x0010, 0x0110, 0x0210, 0x0810, 0x0910, 0x0C00,
+                                            0x1000, 0x1100, 0x1200, 0x1800, 0x4100, 0x4C01};
+static const uint8_t KDK_RTT_COMMAND_COUNT = sizeof(KDK_RTT_COMMANDS) / sizeof(KDK_RTT_COMMANDS[0]);
+static const uint16_t KDK_RTT_COMMAND_OTHER = 0xFFFF;
+
+// Trace Constants
+static const uint8_t KDK_TRACE_SIZE = 32;                    // Number of entries kept in the trace ring
+static const uint8_t KDK_TRACE_PAYLOAD_SIZE = 8;             // Number of payload bytes kept per entry
+static const uint8_t KDK_TRACE_STORE_SLOTS = 2;              // Number of instances whose trace survives a reset
+static const uint32_t KDK_TRACE_STORE_MAGIC = 0x4B545201;    // 'KTR' and the layout version
+static const uint32_t KDK_TRACE_SNAPSHOT_KEY = 0x4B545301;   // 'KTS' and the layout version, plus the slot index
+static const uint32_t KDK_TRACE_SNAPSHOT_INTERVAL = 600000;  // Minimum time in ms between two snapshots in flash
 
 // KDK Frame Constants
 static const uint8_t KDK_MESSAGE_SYNC = 0x66;   // First byte sent by the device on power up
@@ -33,6 +74,10 @@ static const uint8_t KDK_MSG_TYPE_SIZE = 1;
 static const uint8_t KDK_MSG_TABLE_ID_SIZE = 3;
 static const uint8_t KDK_MSG_PARAM_COUNT_SIZE = 1;
 static const uint8_t KDK_MSG_PARAM_ID_REQ_SIZE = 3;
+static const uint8_t KDK_MSG_PARAM_REQ_MAX_COUNT = 80;  // Maximum number of IDs in a single parameter request
+
+static const uint8_t KDK_POLL_PARAMETER_COUNT = 14;  // Number of parameters in the periodic poll request
+static const size_t KDK_HEX_STR_SIZE = 3 * 32 + 1;   // Log buffer size, data longer than 32 bytes are truncated
 
 struct KdkMsg {
   uint8_t start;
@@ -55,6 +100,24 @@ struct KdkParamUpdate {
   std::vector<uint8_t> data;
 };
 
+/**
+ * Per-client write debouncer.
+ * Holds the most recent parameter values requested by a client. The values are
+ * written at most once every `write_interval`, the last requested values are
+ * always written once the interval has elapsed (trailing edge).
+ */
+struct KdkWriteDebouncer {
+  std::vector<struct KdkParamUpdate> parameters;  // Most recent values requested by the client
+  uint32_t last_write_timestamp = 0;              // Timestamp of the last write sent for the client
+  bool pending = false;                           // True when 'parameters' has not been written yet
+  bool in_flight = false;                         // True when the last write has not been acknowledged yet
+
+  KdkWriteCallback callback;                 // Completion callback of the pending write
+  uint32_t request_timestamp = 0;            // Timestamp of the pending write request
+  KdkWriteCallback in_flight_callback;       // Completion callback of the unacknowledged write
+  uint32_t in_flight_request_timestamp = 0;  // Timestamp of the unacknowledged write request
+};
+
 enum KdkCommFsmState {
   KDK_COMM_STATE_NONE = 0,
   KDK_COMM_STATE_UNINITIALIZED,
@@ -73,10 +136,9 @@ enum KdkCommFsmState {
   KDK_COMM_STATE_INIT_0001_11,  // Publish module status? 0x11
   KDK_COMM_STATE_INIT_0910,     // Initial state poll batch 1
   KDK_COMM_STATE_INIT_DONE,     // Final INIT state, module is considered INITIALIZED after this state
-  KDK_COMM_STATE_IDLE,
-  KDK_COMM_STATE_PULL_STATES_0910,
-  KDK_COMM_STATE_PUSH_STATES_0810,
+  KDK_COMM_STATE_IDLE,          // Steady state, transactions are handled by the scheduler
 };
+static const uint8_t KDK_COMM_STATE_COUNT = KDK_COMM_STATE_IDLE + 1;
 
 enum KdkCommFsmMethod {
   KDK_COMM_FSM_ENTRY,
@@ -90,33 +152,139 @@ enum KdkCommFsmEvent {
   KDK_COMM_FSM_EVENT_SYNC_RECOVERY,
   KDK_COMM_FSM_EVENT_RESPONSE_RECEIVED,
   KDK_COMM_FSM_EVENT_INIT_DONE,
-  KDK_COMM_FSM_EVENT_PULL_STATES,
-  KDK_COMM_FSM_EVENT_PUSH_STATES,
+};
+
+enum KdkTransactionPriority {
+  KDK_TRANSACTION_PRIORITY_RESPONSE = 0,  // Responses to device initiated requests (0101, 0A10)
+  KDK_TRANSACTION_PRIORITY_WRITE,         // Client parameter writes (0810)
+  KDK_TRANSACTION_PRIORITY_VERIFY,        // State reads after a write or a device notification (0910)
+  KDK_TRANSACTION_PRIORITY_POLL,          // Periodic background state reads (0910)
+  KDK_TRANSACTION_PRIORITY_COUNT,
+};
+
+enum KdkTransactionType {
+  KDK_TRANSACTION_RESPONSE_0101,
+  KDK_TRANSACTION_RESPONSE_0A10,
+  KDK_TRANSACTION_PUSH_STATES_0810,
+  KDK_TRANSACTION_PULL_STATES_0910,
+};
+
+struct KdkTransaction {
+  KdkTransactionType type;
+  KdkTransactionPriority priority;
+  uint32_t enqueue_timestamp;  // Timestamp when the transaction was queued
+  uint32_t deadline;           // Time in ms the transaction may wait in the queue, 0 to wait indefinitely
+  uint8_t counter;             // Device request counter, only used by responses
+  uint8_t payload[4];          // Response payload, only used by responses
+};
+
+struct KdkSchedulerStats {
+  uint32_t dispatched = 0;  // Number of transactions started
+  uint32_t expired = 0;     // Number of transactions dropped after their deadline
+  uint32_t promoted = 0;    // Number of transactions started ahead of their priority class
+  uint32_t total_wait = 0;  // Sum of the time in ms spent waiting in the queue
+  uint32_t max_wait = 0;    // Longest time in ms spent waiting in the queue
+};
+
+struct KdkLinkStats {
+  uint32_t rx_frames = 0;          // Number of valid frames received
+  uint32_t tx_frames = 0;          // Number of frames sent, including retransmissions and responses
+  uint32_t rx_bytes = 0;           // Number of bytes read from the UART
+  uint32_t tx_bytes = 0;           // Number of bytes written to the UART
+  uint32_t checksum_errors = 0;    // Number of frames dropped with an invalid checksum
+  uint32_t oversize_frames = 0;    // Number of frames dropped for not fitting the receive buffer
+  uint32_t byte_timeouts = 0;      // Number of partial frames dropped by the inter-byte timeout
+  uint32_t response_timeouts = 0;  // Number of requests without a response within the receive timeout
+  uint32_t retransmits = 0;        // Number of requests sent again after a response timeout
+  uint32_t recoveries = 0;         // Number of times the retries were exhausted and the link re-synchronized
+};
+
+enum KdkTraceType : uint8_t {
+  KDK_TRACE_RX,   // Valid frame received
+  KDK_TRACE_TX,   // Frame sent, including retransmissions
+  KDK_TRACE_FSM,  // FSM transition, payload is the previous and next state
+};
+
+struct KdkTraceEntry {
+  uint32_t timestamp;                       // Time the entry was recorded
+  uint16_t command;                         // Frame command, or the FSM event
+  enum KdkTraceType type;                   // Entry type
+  uint8_t counter;                          // Frame counter
+  uint8_t length;                           // Full payload length, only KDK_TRACE_PAYLOAD_SIZE bytes are kept
+  uint8_t payload[KDK_TRACE_PAYLOAD_SIZE];  // Truncated payload
+  uint8_t check;                            // Checksum of the entry, detects entries torn by a reset
+};
+
+/**
+ * Trace ring that is kept in no-init RTC memory on ESP32, so the last entries
+ * before a software or watchdog reset can be reported on the next boot.
+ */
+struct KdkTraceStore {
+  uint32_t magic;  // KDK_TRACE_STORE_MAGIC when the store was initialized
+  uint8_t head;    // Index of the next entry to write
+  uint8_t count;   // Number of valid entries
+  uint8_t check;   // Checksum of the header
+  struct KdkTraceEntry entries[KDK_TRACE_SIZE];
+};
+
+struct KdkRttHistogram {
+  uint16_t command = KDK_RTT_COMMAND_OTHER;     // Request command of the responses
+  uint32_t buckets[KDK_RTT_BUCKET_COUNT] = {};  // Number of responses per bucket of KDK_RTT_BUCKET_LIMITS
+  uint32_t count = 0;                           // Number of responses recorded
+  uint32_t max = 0;                             // Longest RTT in ms
+};
+
+/**
+ * Phases of update() timed by the loop profiler, TOTAL is the whole call.
+ */
+enum KdkProfilePhase {
+  KDK_PROFILE_PHASE_RX = 0,
+  KDK_PROFILE_PHASE_TIMEOUT,
+  KDK_PROFILE_PHASE_FSM,
+  KDK_PROFILE_PHASE_SCHEDULER,
+  KDK_PROFILE_PHASE_PROCESS,
+  KDK_PROFILE_PHASE_STATS,
+  KDK_PROFILE_PHASE_TOTAL,
+  KDK_PROFILE_PHASE_COUNT,
+};
+
+// Loop profiler, compiled in with 'profile_loop: true'
+#ifdef USE_KDK_PROFILER
+static const bool KDK_PROFILER_ENABLED = true;
+#else
+static const bool KDK_PROFILER_ENABLED = false;
+#endif
+
+struct KdkFsmStateStats {
+  uint32_t entry_timestamp = 0;  // Time in ms of the last entry
+  uint32_t entries = 0;          // Number of times the state was entered
+  uint32_t dwell = 0;            // Cumulative time in ms spent in the state, excluding the current visit
+  uint32_t last_dwell = 0;       // Time in ms spent in the state on the last completed visit
+  uint32_t retries = 0;          // Retransmissions while in the state
+  uint32_t recoveries = 0;       // Retries exhausted while in the state
 };
 
 template<typename T> using EnumStrMap = std::map<T, std::string>;
 
 static const EnumStrMap<enum KdkCommFsmState> KDK_COMM_FSM_STATE_STR_MAP = {
-    {KDK_COMM_STATE_NONE, "NONE"},                          // Should never enter this state
-    {KDK_COMM_STATE_UNINITIALIZED, "UNINITIALIZED"},        //
-    {KDK_COMM_STATE_INIT_SYNC, "INIT_SYNC"},                //
-    {KDK_COMM_STATE_INIT_0C00, "INIT_0C00"},                //
-    {KDK_COMM_STATE_INIT_1000, "INIT_1000"},                //
-    {KDK_COMM_STATE_INIT_1100, "INIT_1100"},                //
-    {KDK_COMM_STATE_INIT_1200, "INIT_1200"},                //
-    {KDK_COMM_STATE_INIT_4100, "INIT_4100"},                //
-    {KDK_COMM_STATE_INIT_4C01, "INIT_4C01"},                //
-    {KDK_COMM_STATE_INIT_0010, "INIT_0010"},                //
-    {KDK_COMM_STATE_INIT_0110, "INIT_0110"},                //
-    {KDK_COMM_STATE_INIT_0210, "INIT_0210"},                //
-    {KDK_COMM_STATE_INIT_1800, "INIT_1800"},                //
-    {KDK_COMM_STATE_INIT_0001_10, "INIT_0001_10"},          //
-    {KDK_COMM_STATE_INIT_0001_11, "INIT_0001_11"},          //
-    {KDK_COMM_STATE_INIT_0910, "INIT_0910"},                //
-    {KDK_COMM_STATE_INIT_DONE, "INIT_DONE"},                //
-    {KDK_COMM_STATE_IDLE, "IDLE"},                          //
-    {KDK_COMM_STATE_PULL_STATES_0910, "PULL_STATES_0910"},  //
-    {KDK_COMM_STATE_PUSH_STATES_0810, "PUSH_STATES_0810"},  //
+    {KDK_COMM_STATE_NONE, "NONE"},                    // Should never enter this state
+    {KDK_COMM_STATE_UNINITIALIZED, "UNINITIALIZED"},  //
+    {KDK_COMM_STATE_INIT_SYNC, "INIT_SYNC"},          //
+    {KDK_COMM_STATE_INIT_0C00, "INIT_0C00"},          //
+    {KDK_COMM_STATE_INIT_1000, "INIT_1000"},          //
+    {KDK_COMM_STATE_INIT_1100, "INIT_1100"},          //
+    {KDK_COMM_STATE_INIT_1200, "INIT_1200"},          //
+    {KDK_COMM_STATE_INIT_4100, "INIT_4100"},          //
+    {KDK_COMM_STATE_INIT_4C01, "INIT_4C01"},          //
+    {KDK_COMM_STATE_INIT_0010, "INIT_0010"},          //
+    {KDK_COMM_STATE_INIT_0110, "INIT_0110"},          //
+    {KDK_COMM_STATE_INIT_0210, "INIT_0210"},          //
+    {KDK_COMM_STATE_INIT_1800, "INIT_1800"},          //
+    {KDK_COMM_STATE_INIT_0001_10, "INIT_0001_10"},    //
+    {KDK_COMM_STATE_INIT_0001_11, "INIT_0001_11"},    //
+    {KDK_COMM_STATE_INIT_0910, "INIT_0910"},          //
+    {KDK_COMM_STATE_INIT_DONE, "INIT_DONE"},          //
+    {KDK_COMM_STATE_IDLE, "IDLE"},                    //
 };
 
 static const EnumStrMap<enum KdkCommFsmMethod> KDK_COMM_FSM_METHOD_STR_MAP = {
@@ -125,6 +293,12 @@ static const EnumStrMap<enum KdkCommFsmMethod> KDK_COMM_FSM_METHOD_STR_MAP = {
     {KDK_COMM_FSM_EXIT, "EXIT"},
 };
 
+static const EnumStrMap<enum KdkWriteResult> KDK_WRITE_RESULT_STR_MAP = {
+    {KDK_WRITE_RESULT_ACKNOWLEDGED, "ACKNOWLEDGED"},
+    {KDK_WRITE_RESULT_SUPERSEDED, "SUPERSEDED"},
+    {KDK_WRITE_RESULT_FAILED, "FAILED"},
+};
+
 static const EnumStrMap<enum KdkCommFsmEvent> KDK_COMM_FSM_EVENT_STR_MAP = {
     {KDK_COMM_FSM_EVENT_SYNC_RECEIVED, "SYNC_RECEIVED"},          //
     {KDK_COMM_FSM_EVENT_SYNC_OK, "SYNC_OK"},                      //
@@ -132,16 +306,28 @@ static const EnumStrMap<enum KdkCommFsmEvent> KDK_COMM_FSM_EVENT_STR_MAP = {
     {KDK_COMM_FSM_EVENT_SYNC_RECOVERY, "SYNC_RECOVERY"},          //
     {KDK_COMM_FSM_EVENT_RESPONSE_RECEIVED, "RESPONSE_RECEIVED"},  //
     {KDK_COMM_FSM_EVENT_INIT_DONE, "INIT_DONE"},                  //
-    {KDK_COMM_FSM_EVENT_PULL_STATES, "PULL_STATES"},              //
-    {KDK_COMM_FSM_EVENT_PUSH_STATES, "PUSH_STATES"},              //
+};
+
+static const char *const KDK_PROFILE_PHASE_NAMES[KDK_PROFILE_PHASE_COUNT] = {
+    "RX", "TIMEOUT", "FSM", "SCHEDULER", "PROCESS", "STATS", "TOTAL",
+};
+
+static const EnumStrMap<enum KdkTransactionPriority> KDK_TRANSACTION_PRIORITY_STR_MAP = {
+    {KDK_TRANSACTION_PRIORITY_RESPONSE, "RESPONSE"},
+    {KDK_TRANSACTION_PRIORITY_WRITE, "WRITE"},
+    {KDK_TRANSACTION_PRIORITY_VERIFY, "VERIFY"},
+    {KDK_TRANSACTION_PRIORITY_POLL, "POLL"},
 };
 
 class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
  protected:
   struct {
-    uint32_t byte_timeout = KDK_BYTE_TIMEOUT;            // Time in ms to wait between bytes
-    uint32_t receive_timeout = KDK_RECV_TIMEOUT;         // Time in ms to wait for a response before retrying
-    uint32_t poll_interval = KDK_DEFAULT_POLL_INTERVAL;  // Time in ms between poll intervals
+    uint32_t byte_timeout = KDK_BYTE_TIMEOUT;              // Time in ms to wait between bytes
+    uint32_t receive_timeout = KDK_RECV_TIMEOUT;           // Time in ms to wait for a response before retrying
+    uint32_t poll_interval = KDK_DEFAULT_POLL_INTERVAL;    // Time in ms between poll intervals
+    uint32_t write_interval = KDK_DEFAULT_WRITE_INTERVAL;  // Minimum time in ms between writes from a client
+    uint32_t stats_interval = KDK_DEFAULT_STATS_INTERVAL;  // Time in ms between link statistics updates
+    bool event_driven = false;                             // Run update() from loop() only when work is due
   } cfg_;
 
   struct {
@@ -150,6 +336,17 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
     uint8_t buffer_length = 0;  // Number of valid bytes in the TX buffer, used when retransmitting the buffer.
     uint8_t buffer[KDK_MESSAGE_BUFFER_SIZE];
 
+    uint8_t response_buffer[sizeof(struct KdkMsg) + 4 + KDK_MESSAGE_CHECKSUM_SIZE];  // Keeps 'buffer' for retries
+
+    // Pre-encoded periodic poll request, rebuilt when the parameter table ID changes
+    struct {
+      uint32_t parameter_table_id = 0;
+      uint8_t sum = 0;     // Sum of all bytes excluding the counter and checksum
+      uint8_t length = 0;  // Frame length including the checksum, 0 when not encoded
+      uint8_t buffer[sizeof(struct KdkMsg) + KDK_MSG_TYPE_SIZE + KDK_MSG_TABLE_ID_SIZE + KDK_MSG_PARAM_COUNT_SIZE +
+                     (KDK_MSG_PARAM_ID_REQ_SIZE * KDK_POLL_PARAMETER_COUNT) + KDK_MESSAGE_CHECKSUM_SIZE];
+    } poll_template;
+
     bool retry_pending = 0;   // True to resend last message
     uint8_t retry_count = 0;  // Number of retry attempts
   } tx_;
@@ -178,37 +375,142 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
     uint32_t parameter_table_id = 0;
     std::map<uint16_t, struct KdkParam> parameters;
 
-    std::vector<struct KdkParamUpdate> pending_parameter_update_list;
+    std::map<KdkConnectionClient *, struct KdkWriteDebouncer> write_debouncers;
 
     uint32_t last_ping_timestamp = 0;
     uint32_t last_update_timestamp = 0;
 
+    /* Write Statistics */
+    uint32_t write_acknowledged_count = 0;
+    uint32_t write_superseded_count = 0;
+    uint32_t write_failed_count = 0;
+    uint32_t last_write_latency = 0;  // Time in ms from request to acknowledgement of the last write
+    uint32_t max_write_latency = 0;
+
   } state_;
 
   struct {
     KdkCommFsmState state = KdkCommFsmState::KDK_COMM_STATE_UNINITIALIZED;
-    std::queue<KdkCommFsmEvent> event_queue;
 
+    // Statically allocated ring of pending events
+    KdkCommFsmEvent event_queue[KDK_FSM_EVENT_QUEUE_SIZE];
+    uint8_t event_head = 0;   // Index of the oldest pending event
+    uint8_t event_count = 0;  // Number of pending events
+
+    uint32_t event_overflow_count = 0;   // Number of events dropped because the ring was full
+    uint32_t event_coalesced_count = 0;  // Number of events merged with an identical pending event
+
+    struct KdkFsmStateStats state_stats[KDK_COMM_STATE_COUNT];  // Dwell time and retries of each state
+    uint32_t init_timestamp = 0;      // Time in ms the current init sequence started
+    uint32_t init_count = 0;          // Number of init sequences started
+    uint32_t ready_count = 0;         // Number of init sequences completed
+    uint32_t boot_time_to_ready = 0;  // Time in ms from boot to the first completed init sequence
+    uint32_t last_time_to_ready = 0;  // Duration in ms of the last completed init sequence
+    uint32_t max_time_to_ready = 0;   // Longest completed init sequence in ms
   } fsm_;
 
+  struct {
+    struct KdkTransaction queue[KDK_SCHEDULER_QUEUE_SIZE];
+    uint8_t queue_depth = 0;      // Number of transactions in 'queue'
+    uint8_t max_queue_depth = 0;  // Highest number of transactions queued at once
+    uint32_t overflow_count = 0;  // Number of transactions rejected because the queue was full
+
+    struct KdkTransaction active;  // Request waiting for a response
+    bool active_valid = false;     // True when 'active' is valid
+
+    struct KdkSchedulerStats stats[KDK_TRANSACTION_PRIORITY_COUNT];
+  } sched_;
+
+  struct {
+    struct KdkLinkStats counters;
+    struct KdkRttHistogram rtt[KDK_RTT_COMMAND_COUNT + 1];  // Response time of each request command
+
+    uint32_t window_timestamp = 0;  // Start of the current duty cycle window
+    uint32_t window_bytes = 0;      // Total bytes on the bus at the start of the window
+    float duty_cycle = 0;           // Percentage of time the bus was busy over the last window
+  } link_;
+
+  struct KdkTraceStore *trace_ = nullptr;                  // Live trace
+  std::unique_ptr<struct KdkTraceStore> recovered_trace_;  // Trace of the previous boot, if any was recovered
+#ifdef USE_ESP32
+  ESPPreferenceObject trace_snapshot_pref_;  // Copy of the trace in flash, survives a power loss
+  uint32_t trace_snapshot_timestamp_ = 0;    // Time in ms of the last snapshot
+  bool trace_snapshot_saved_ = false;        // A snapshot was taken since boot
+  bool trace_snapshot_loaded_ = false;       // The recovered trace is the snapshot from flash
+#endif
+
+  // Time spent in each phase of update()
+  LoopProfiler<KDK_PROFILE_PHASE_COUNT, KDK_PROFILER_ENABLED> profiler_;
+
+#ifdef USE_SENSOR
+  struct {
+    sensor::Sensor *rx_frames = nullptr;
+    sensor::Sensor *tx_frames = nullptr;
+    sensor::Sensor *checksum_errors = nullptr;
+    sensor::Sensor *oversize_frames = nullptr;
+    sensor::Sensor *byte_timeouts = nullptr;
+    sensor::Sensor *response_timeouts = nullptr;
+    sensor::Sensor *retransmits = nullptr;
+    sensor::Sensor *recoveries = nullptr;
+    sensor::Sensor *response_time_p50 = nullptr;
+    sensor::Sensor *response_time_p95 = nullptr;
+    sensor::Sensor *bus_duty_cycle = nullptr;
+    sensor::Sensor *time_to_ready = nullptr;
+  } sensors_;
+#endif
+#ifdef USE_TEXT_SENSOR
+  struct {
+    text_sensor::TextSensor *response_times = nullptr;
+  } text_sensors_;
+#endif
+
   // Utilities
   std::string hex2str(const uint8_t *buffer, size_t length);
   std::string hex2str(std::vector<uint8_t> data);
+  const char *hex2str(char *str, size_t size, const uint8_t *buffer, size_t length);
   uint8_t calculate_sum(const uint8_t *buffer, size_t length);
 
+  // Trace
+  void trace_setup(void);
+  void trace_snapshot_load(void);
+  void trace_snapshot_save(void);
+  void trace_print(const struct KdkTraceStore &trace);
+  void trace_record(enum KdkTraceType type, uint8_t counter, uint16_t command, const uint8_t *payload, size_t length);
+  void trace_frame(enum KdkTraceType type, const uint8_t *buffer) {
+    const struct KdkMsg *msg = (const struct KdkMsg *) buffer;
+    this->trace_record(type, msg->counter, msg->command, msg->payload, msg->length);
+  }
+
+  // Link Statistics
+  void link_record_rtt(uint16_t command, uint32_t rtt);
+  uint32_t link_rtt_percentile(const struct KdkRttHistogram &histogram, uint8_t percentile) const;
+  void link_update_stats(uint32_t now);
+  void link_publish_stats(void);
+
   std::string get_state_name(enum KdkCommFsmState x) { return KDK_COMM_FSM_STATE_STR_MAP.find(x)->second; }
   std::string get_method_name(enum KdkCommFsmMethod x) { return KDK_COMM_FSM_METHOD_STR_MAP.find(x)->second; }
   std::string get_event_name(enum KdkCommFsmEvent x) { return KDK_COMM_FSM_EVENT_STR_MAP.find(x)->second; }
+  std::string get_priority_name(enum KdkTransactionPriority x) {
+    return KDK_TRANSACTION_PRIORITY_STR_MAP.find(x)->second;
+  }
 
-  bool is_update_pending(void) { return this->state_.pending_parameter_update_list.size() > 0; }
+  bool is_write_due(const struct KdkWriteDebouncer &debouncer, uint32_t now) const;
+  bool is_update_pending(void);
+  bool is_update_due(uint32_t now);
+  bool is_parameter_held(uint16_t id) const;
 
   // Internal
   void notify_clients_on_parameter_update(void);
 
+  void resolve_write(KdkWriteCallback &callback, uint32_t request_timestamp, KdkWriteResult result);
+  void resolve_in_flight_writes(KdkWriteResult result);
+
   void receiver_reset_states(void);
   void receiver_process_byte(uint8_t byte);
 
+  uint8_t *request_payload(void) { return ((struct KdkMsg *) this->tx_.buffer)->payload; }
   void send_request(uint16_t command, const uint8_t *payload, uint16_t length, bool posted = false);
+  void commit_request(uint16_t command, uint16_t length, bool posted = false);
   void send_response(uint8_t counter, uint16_t command, const uint8_t *payload, uint16_t length);
 
   void transmit_message(void);
@@ -217,7 +519,7 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
 
   // Message Helpers
   bool is_message_pending(void) { return this->state_.message_pending; };
-  void clear_message_pending(void) { 
+  void clear_message_pending(void) {
     this->state_.message_pending = false;
     this->tx_.retry_count = 0;
   };
@@ -229,7 +531,7 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
 
   void save_parameter_table_id(const uint8_t *buffer);
   void fill_parameter_table_id(uint8_t *buffer);
-  void fill_parameter_requests(uint8_t *buffer, std::vector<uint16_t> id_list);
+  size_t fill_parameter_requests(uint8_t *buffer, const uint16_t *id_list, size_t count);
 
   void parse_parameter_response(const uint8_t *buffer);
 
@@ -242,8 +544,8 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
   void process_response_0910(void);
 
   // Message builder
-  void send_message_0810(std::vector<struct KdkParamUpdate> key_value_pairs);
-  void send_message_0910(std::vector<uint16_t> id_list);
+  bool send_message_0810(void);
+  void send_message_0910(const uint16_t *id_list, size_t count);
 
   void send_message_0210_init(void);
   void send_message_0910_init(void);
@@ -256,29 +558,77 @@ class KdkConnectionManager : public PollingComponent, public uart::UARTDevice {
 
   void process_message(void);
 
+  // Scheduler
+  bool scheduler_is_queued(KdkTransactionType type);
+  void scheduler_enqueue(KdkTransactionType type, KdkTransactionPriority priority, uint32_t deadline,
+                         uint8_t counter = 0, const uint8_t *payload = nullptr);
+  void scheduler_reset(void);
+  void scheduler_complete(void);
+  void scheduler_expire(uint32_t now);
+  void scheduler_dispatch(uint32_t now);
+  void scheduler_start(const struct KdkTransaction &transaction);
+  void scheduler_run(void);
+
   // FSM
   void fsm_push_event(KdkCommFsmEvent event);
+  KdkCommFsmEvent fsm_pop_event(void);
   KdkCommFsmState fsm_next_state(KdkCommFsmState state, KdkCommFsmEvent event);
   void fsm_run(void);
   void fsm_state_handlers(KdkCommFsmMethod method);
+  void fsm_record_transition(KdkCommFsmState curr_state, KdkCommFsmState next_state, uint32_t now);
+  void fsm_dump_stats(uint32_t now);
 
   const struct KdkMsg *message(void) const { return (KdkMsg *) this->rx_.buffer; }
 
  public:
+  void setup() override;
   void dump_config() override;
+  void loop() override;
   void update() override;
 
   void register_client(KdkConnectionClient *client);
 
   const std::vector<uint8_t> get_parameter_data(uint16_t id) const;
-  void update_parameter_data(std::vector<struct KdkParamUpdate> parameters);
+  void update_parameter_data(KdkConnectionClient *client, std::vector<struct KdkParamUpdate> parameters,
+                             KdkWriteCallback callback = nullptr);
+
+  std::string get_write_result_name(enum KdkWriteResult x) { return KDK_WRITE_RESULT_STR_MAP.find(x)->second; }
 
   void set_receive_timeout(uint32_t value_ms) { this->cfg_.receive_timeout = value_ms; }
   void set_poll_interval(uint32_t value_ms) { this->cfg_.poll_interval = value_ms; }
+  void set_write_interval(uint32_t value_ms) { this->cfg_.write_interval = value_ms; }
+  void set_stats_interval(uint32_t value_ms) { this->cfg_.stats_interval = value_ms; }
+  void set_event_driven(bool value);
+
+#ifdef USE_SENSOR
+  void set_rx_frames_sensor(sensor::Sensor *sensor) { this->sensors_.rx_frames = sensor; }
+  void set_tx_frames_sensor(sensor::Sensor *sensor) { this->sensors_.tx_frames = sensor; }
+  void set_checksum_errors_sensor(sensor::Sensor *sensor) { this->sensors_.checksum_errors = sensor; }
+  void set_oversize_frames_sensor(sensor::Sensor *sensor) { this->sensors_.oversize_frames = sensor; }
+  void set_byte_timeouts_sensor(sensor::Sensor *sensor) { this->sensors_.byte_timeouts = sensor; }
+  void set_response_timeouts_sensor(sensor::Sensor *sensor) { this->sensors_.response_timeouts = sensor; }
+  void set_retransmits_sensor(sensor::Sensor *sensor) { this->sensors_.retransmits = sensor; }
+  void set_recoveries_sensor(sensor::Sensor *sensor) { this->sensors_.recoveries = sensor; }
+  void set_response_time_p50_sensor(sensor::Sensor *sensor) { this->sensors_.response_time_p50 = sensor; }
+  void set_response_time_p95_sensor(sensor::Sensor *sensor) { this->sensors_.response_time_p95 = sensor; }
+  void set_bus_duty_cycle_sensor(sensor::Sensor *sensor) { this->sensors_.bus_duty_cycle = sensor; }
+  void set_time_to_ready_sensor(sensor::Sensor *sensor) { this->sensors_.time_to_ready = sensor; }
+#endif
+#ifdef USE_TEXT_SENSOR
+  void set_response_times_text_sensor(text_sensor::TextSensor *sensor) { this->text_sensors_.response_times = sensor; }
+#endif
 
   bool is_ready(void) { return this->fsm_.state >= KDK_COMM_STATE_INIT_DONE; };
 
-  KdkConnectionManager() {};
+  uint8_t get_scheduler_queue_depth(void) const { return this->sched_.queue_depth; }
+  const struct KdkSchedulerStats &get_scheduler_stats(KdkTransactionPriority priority) const {
+    return this->sched_.stats[priority];
+  }
+  const struct KdkLinkStats &get_link_stats(void) const { return this->link_.counters; }
+
+  void dump_trace(void);
+
+  KdkConnectionManager() { this->trace_setup(); };
 };
 
 }  // namespace kdk
@@ -2,9 +2,24 @@
 
 #include "esphome/core/helpers.h"
 
+#include <functional>
+
 namespace esphome {
 namespace kdk {
 
+enum KdkWriteResult {
+  KDK_WRITE_RESULT_ACKNOWLEDGED,  // The write was acknowledged by the device
+  KDK_WRITE_RESULT_SUPERSEDED,    // The write was replaced by a newer write before it was sent
+  KDK_WRITE_RESULT_FAILED,        // The write was not acknowledged after all retry attempts
+};
+
+struct KdkWriteCompletion {
+  KdkWriteResult result;
+  uint32_t latency;  // Time in ms from the write request until it was resolved
+};
+
+using KdkWriteCallback = std::function<void(const struct KdkWriteCompletion &)>;
+
 class KdkConnectionManager;
 
 class KdkConnectionClient : public Parented<KdkConnectionManager> {
@@ -14,6 +29,11 @@ class KdkConnectionClient : public Parented<KdkConnectionManager> {
  protected:
   friend KdkConnectionManager;
   virtual std::string name() = 0;
+
+  // Drop the cached device states, so the next poll publishes the actual ones
+  virtual void invalidate_state(void) = 0;
+
+  void on_write_complete(const struct KdkWriteCompletion &completion);
 };
 
 }  // namespace kdk
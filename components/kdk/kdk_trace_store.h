@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#ifdef USE_ESP32
+#include <esp_system.h>
+#endif
+
+namespace esphome {
+namespace kdk {
+
+/**
+ * Helpers for a trace ring kept in no-init RTC memory. The store type must
+ * have the magic, head, count and check header fields followed by an entries
+ * array, and the entry type must end with a check field.
+ */
+
+#ifdef USE_ESP32
+inline const char *get_reset_reason_name(void) {
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:
+      return "POWER_ON";
+    case ESP_RST_EXT:
+      return "EXTERNAL";
+    case ESP_RST_SW:
+      return "SOFTWARE";
+    case ESP_RST_PANIC:
+      return "PANIC";
+    case ESP_RST_INT_WDT:
+      return "INTERRUPT_WATCHDOG";
+    case ESP_RST_TASK_WDT:
+      return "TASK_WATCHDOG";
+    case ESP_RST_WDT:
+      return "WATCHDOG";
+    case ESP_RST_DEEPSLEEP:
+      return "DEEP_SLEEP";
+    case ESP_RST_BROWNOUT:
+      return "BROWNOUT";
+    default:
+      return "UNKNOWN";
+  }
+}
+#endif
+
+template<typename Entry> uint8_t trace_entry_check(const Entry &entry) {
+  const uint8_t *data = (const uint8_t *) &entry;
+  uint8_t sum = 0xA5;  // Non-zero seed so a zeroed entry is invalid
+  for (size_t i = 0; i < offsetof(Entry, check); i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+template<typename Store> uint8_t trace_header_check(const Store &store) {
+  return (uint8_t) (0xA5 + store.magic + (store.magic >> 8) + (store.magic >> 16) + (store.magic >> 24) +
+                    store.head + store.count);
+}
+
+template<typename Store> constexpr size_t trace_size(const Store &store) {
+  return sizeof(store.entries) / sizeof(store.entries[0]);
+}
+
+/**
+ * A store holds a trace when its header is intact and it has at least one entry.
+ */
+template<typename Store> bool trace_store_valid(const Store &store, uint32_t magic) {
+  return (store.magic == magic) && (store.check == trace_header_check(store)) && (store.head < trace_size(store)) &&
+         (store.count <= trace_size(store)) && (store.count > 0);
+}
+
+/**
+ * Assign the next free slot of the no-init stores. A valid trace left in the
+ * slot by the previous boot is copied to recovered before the slot is reset.
+ * Returns nullptr when all slots are taken.
+ */
+template<typename Store, size_t N>
+Store *trace_store_assign(Store (&stores)[N], uint8_t &assigned, uint32_t magic, std::unique_ptr<Store> &recovered) {
+  if (assigned >= N) {
+    return nullptr;
+  }
+
+  auto &store = stores[assigned++];
+  if (trace_store_valid(store, magic)) {
+    recovered.reset(new Store(store));
+  }
+
+  memset(&store, 0, sizeof(store));
+  store.magic = magic;
+  store.check = trace_header_check(store);
+  return &store;
+}
+
+/**
+ * Seal the entry at head, then commit it by advancing the header.
+ */
+template<typename Store> void trace_store_commit(Store &store) {
+  auto &entry = store.entries[store.head];
+  entry.check = trace_entry_check(entry);
+
+  store.head = (store.head + 1) % trace_size(store);
+  if (store.count < trace_size(store)) {
+    store.count++;
+  }
+  store.check = trace_header_check(store);
+}
+
+}  // namespace kdk
+}  // namespace esphome
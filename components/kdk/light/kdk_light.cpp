@@ -1,3 +1,4 @@
+#include <cinttypes>
 #include "esphome/core/log.h"
 
 #include "../kdk_conn.h"
@@ -9,8 +10,6 @@ namespace kdk {
 
 static const char *const TAG = "kdk.light";
 
-static const uint32_t KDK_LIGHT_UPDATE_BLANKING_TIME = 1500;
-
 static const uint8_t KDK_LIGHT_STATE_ON = 0x30;
 static const uint8_t KDK_LIGHT_STATE_OFF = 0x31;
 
@@ -92,6 +91,10 @@ bool KdkLight::is_valid(const std::vector<uint8_t> &data) const {
 }
 
 bool KdkLight::is_state_changed(uint8_t mode, uint8_t state, uint8_t brightness, uint8_t color) {
+  if (!this->state_valid_) {
+    return true;
+  }
+
   if (this->light_mode_ != mode) {
     return true;
   }
@@ -194,10 +197,16 @@ void KdkLight::update_state(light::LightState *state) {
     }
   }
 
-  conn->update_parameter_data(parameters);
+  conn->update_parameter_data(this, parameters,
+                              [this](const struct KdkWriteCompletion &c) { this->on_write_complete(c); });
 
-  // Set last update timestamp to prevent slider jitter
-  this->last_update_timestamp_ = millis();
+  // Update internal cache with the requested states, the connection holds them until they are written
+  this->light_mode_ = light_mode;
+  this->light_state_ = light_state;
+  this->light_brightness_ = light_brightness;
+  if (this->type_ == KdkLightType::MAIN_LIGHT) {
+    this->light_color_ = light_color;
+  }
 }
 
 void KdkLight::on_parameter_update(void) {
@@ -235,18 +244,14 @@ void KdkLight::on_parameter_update(void) {
   this->light_state_ = light_state;
   this->light_brightness_ = light_brightness;
   this->light_color_ = light_color;
+  this->state_valid_ = true;
 
   auto call = this->state_->make_call();
 
   call.set_state(this->to_state(light_state, light_mode));
-
-  // Suppress if last update is too recent, but ignore if it is the night light
-  if ((this->type_ == KdkLightType::NIGHT_LIGHT) ||
-      (millis() - this->last_update_timestamp_) > KDK_LIGHT_UPDATE_BLANKING_TIME) {
-    call.set_brightness(this->to_brightness(light_brightness));
-    if (this->type_ == KdkLightType::MAIN_LIGHT) {
-      call.set_color_temperature(this->to_color(light_color));
-    }
+  call.set_brightness(this->to_brightness(light_brightness));
+  if (this->type_ == KdkLightType::MAIN_LIGHT) {
+    call.set_color_temperature(this->to_color(light_color));
   }
 
   // Since the most recent state was pulled, skip parameter update in `update_state`
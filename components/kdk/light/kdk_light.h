@@ -20,9 +20,9 @@ class KdkLight : public light::LightOutput, public KdkConnectionClient {
   float cold_white_temperature_{0};
   float warm_white_temperature_{0};
 
-  uint32_t last_update_timestamp_{0};
   bool skip_parameter_update_{false};
 
+  bool state_valid_{false};  // The cached states match the device
   uint8_t light_state_{0};
   uint8_t light_mode_{0};
   uint8_t light_brightness_{0};
@@ -47,6 +47,8 @@ class KdkLight : public light::LightOutput, public KdkConnectionClient {
   bool is_valid(const std::vector<uint8_t> &data) const;
   bool is_state_changed(uint8_t mode, uint8_t state, uint8_t brightness, uint8_t color);
 
+  void invalidate_state(void) override { this->state_valid_ = false; }
+
  public:
   void set_type(KdkLightType type) { type_ = type; }
   void set_cold_white_temperature(float cold_white_temperature) { cold_white_temperature_ = cold_white_temperature; }
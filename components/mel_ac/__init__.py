@@ -0,0 +1,23 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+
+CODEOWNERS = ["TzeWey"]
+
+CONF_MAX_IN_FLIGHT = "max_in_flight"
+CONF_POLL_BUDGET = "poll_budget"
+
+mel_ac_ns = cg.esphome_ns.namespace("mel").namespace("ac")
+
+# Optional top level block, sets the scheduler shared by all units on this device
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_MAX_IN_FLIGHT, default=0): cv.int_range(min=0, max=8),
+        cv.Optional(CONF_POLL_BUDGET, default=0): cv.int_range(min=0, max=255),
+    }
+)
+
+
+async def to_code(config):
+    scheduler = mel_ac_ns.mel_scheduler
+    cg.add(scheduler.set_max_in_flight(config[CONF_MAX_IN_FLIGHT]))
+    cg.add(scheduler.set_poll_budget(config[CONF_POLL_BUDGET]))
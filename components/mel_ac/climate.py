@@ -1,7 +1,13 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import climate, uart
+from esphome.components import binary_sensor, climate, sensor, uart
+from esphome.core import CORE
 from esphome.const import (
+    DEVICE_CLASS_CONNECTIVITY,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
     CONF_MAX_REFRESH_RATE,
     CONF_STARTUP_DELAY,
     CONF_VISUAL,
@@ -23,6 +29,39 @@ from esphome.components.climate import (
 CODEOWNERS = ["TzeWey"]
 DEPENDENCIES = ["climate", "uart"]
 
+CONF_STATS_INTERVAL = "stats_interval"
+CONF_RESPONSE_TIME = "response_time"
+CONF_PROFILE_LOOP = "profile_loop"
+CONF_EVENT_DRIVEN = "event_driven"
+CONF_MIN_FRAME_GAP = "min_frame_gap"
+CONF_PARAMS_REFRESH_RATE = "params_refresh_rate"
+CONF_TEMPERATURE_REFRESH_RATE = "temperature_refresh_rate"
+CONF_STATUS_REFRESH_RATE = "status_refresh_rate"
+CONF_FAST_FOLLOW_WINDOW = "fast_follow_window"
+CONF_OPTIMISTIC = "optimistic"
+CONF_AUTO_BAUD = "auto_baud"
+CONF_CONNECTED = "connected"
+CONF_CONNECT_TIME = "connect_time"
+CONF_CYCLE_TIME = "cycle_time"
+CONF_TEMPERATURE_DEADBAND = "temperature_deadband"
+CONF_TEMPERATURE_MIN_INTERVAL = "temperature_min_interval"
+CONF_TEMPERATURE_MAX_STALENESS = "temperature_max_staleness"
+CONF_ROOM_TEMPERATURE_SENSOR = "room_temperature_sensor"
+CONF_ROOM_TEMPERATURE_DEADBAND = "room_temperature_deadband"
+CONF_ROOM_TEMPERATURE_MIN_INTERVAL = "room_temperature_min_interval"
+CONF_ROOM_TEMPERATURE_TIMEOUT = "room_temperature_timeout"
+CONF_CONTROL_LATENCY = "control_latency"
+
+# Link statistics counters, each one is an optional sensor that only increases
+LINK_COUNTER_SENSORS = [
+    "timeouts",
+    "checksum_errors",
+    "version_errors",
+    "mismatches",
+]
+
+SENSOR_KEYS = LINK_COUNTER_SENSORS + [CONF_RESPONSE_TIME, CONF_CONTROL_LATENCY, CONF_CONNECT_TIME, CONF_CYCLE_TIME]
+
 PROTOCOL_MIN_TEMPERATURE = 16.0
 PROTOCOL_MAX_TEMPERATURE = 31.0
 PROTOCOL_TEMPERATURE_STEP_MIN = 0.5
@@ -91,12 +130,68 @@ def validate_visual(config):
     return config
 
 
+def validate_diagnostic_sensors(config):
+    # The sensor platforms are not auto-loaded, so they cost nothing unless a statistics sensor is configured
+    if any(key in config for key in SENSOR_KEYS) and "sensor" not in CORE.loaded_integrations:
+        raise cv.Invalid("The statistics sensors need the sensor component, add 'sensor:' to the configuration")
+    if CONF_CONNECTED in config and "binary_sensor" not in CORE.loaded_integrations:
+        raise cv.Invalid(
+            f"'{CONF_CONNECTED}' needs the binary_sensor component, add 'binary_sensor:' to the configuration"
+        )
+    return config
+
+
 CONFIG_SCHEMA = cv.All(
     climate.climate_schema(MelAirConditioner).extend(
         {
             cv.GenerateID(): cv.declare_id(MelAirConditioner),
             cv.Optional(CONF_MAX_REFRESH_RATE, default="1s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_PARAMS_REFRESH_RATE): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_TEMPERATURE_REFRESH_RATE): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_STATUS_REFRESH_RATE): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_FAST_FOLLOW_WINDOW, default="30s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_TEMPERATURE_DEADBAND, default=0.0): cv.positive_float,
+            cv.Optional(CONF_TEMPERATURE_MIN_INTERVAL, default="0s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_TEMPERATURE_MAX_STALENESS, default="0s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_ROOM_TEMPERATURE_SENSOR): cv.use_id(sensor.Sensor),
+            cv.Optional(CONF_ROOM_TEMPERATURE_DEADBAND, default=0.5): cv.positive_float,
+            cv.Optional(CONF_ROOM_TEMPERATURE_MIN_INTERVAL, default="30s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_ROOM_TEMPERATURE_TIMEOUT, default="10min"): cv.positive_time_period_milliseconds,
             cv.Optional(CONF_STARTUP_DELAY, default="0s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_STATS_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_PROFILE_LOOP, default=False): cv.boolean,
+            cv.Optional(CONF_EVENT_DRIVEN, default=False): cv.boolean,
+            cv.Optional(CONF_MIN_FRAME_GAP, default="0ms"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_OPTIMISTIC, default=True): cv.boolean,
+            cv.Optional(CONF_AUTO_BAUD, default=False): cv.boolean,
+            cv.Optional(CONF_RESPONSE_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CONTROL_LATENCY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CONNECT_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CYCLE_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CONNECTED): binary_sensor.binary_sensor_schema(
+                device_class=DEVICE_CLASS_CONNECTIVITY,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
             cv.Optional(CONF_SUPPORTED_MODES, default=[]
                         ): cv.ensure_list(cv.enum(SUPPORTED_MODES, upper=True)),
             cv.Optional(CONF_SUPPORTED_FAN_MODES, default=[]
@@ -105,9 +200,20 @@ CONFIG_SCHEMA = cv.All(
                         ): cv.ensure_list(cv.enum(SUPPORTED_SWING_MODES, upper=True)),
         }
     )
+    .extend(
+        {
+            cv.Optional(key): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            )
+            for key in LINK_COUNTER_SENSORS
+        }
+    )
     .extend(cv.polling_component_schema("25ms"))
     .extend(uart.UART_DEVICE_SCHEMA),
     validate_visual,
+    validate_diagnostic_sensors,
 )
 
 
@@ -117,7 +223,42 @@ async def to_code(config):
     await uart.register_uart_device(var, config)
 
     cg.add(var.set_poll_refresh_rate(config[CONF_MAX_REFRESH_RATE]))
+    if CONF_PARAMS_REFRESH_RATE in config:
+        cg.add(var.set_params_refresh_rate(config[CONF_PARAMS_REFRESH_RATE]))
+    if CONF_TEMPERATURE_REFRESH_RATE in config:
+        cg.add(var.set_temperature_refresh_rate(config[CONF_TEMPERATURE_REFRESH_RATE]))
+    if CONF_STATUS_REFRESH_RATE in config:
+        cg.add(var.set_status_refresh_rate(config[CONF_STATUS_REFRESH_RATE]))
+    cg.add(var.set_fast_follow_window(config[CONF_FAST_FOLLOW_WINDOW]))
+    cg.add(var.set_temperature_deadband(config[CONF_TEMPERATURE_DEADBAND]))
+    cg.add(var.set_temperature_min_interval(config[CONF_TEMPERATURE_MIN_INTERVAL]))
+    cg.add(var.set_temperature_max_staleness(config[CONF_TEMPERATURE_MAX_STALENESS]))
+    if CONF_ROOM_TEMPERATURE_SENSOR in config:
+        sens = await cg.get_variable(config[CONF_ROOM_TEMPERATURE_SENSOR])
+        cg.add(var.set_room_temperature_sensor(sens))
+    cg.add(var.set_room_temperature_deadband(config[CONF_ROOM_TEMPERATURE_DEADBAND]))
+    cg.add(var.set_room_temperature_min_interval(config[CONF_ROOM_TEMPERATURE_MIN_INTERVAL]))
+    cg.add(var.set_room_temperature_timeout(config[CONF_ROOM_TEMPERATURE_TIMEOUT]))
     cg.add(var.set_startup_delay(config[CONF_STARTUP_DELAY]))
+    cg.add(var.set_stats_interval(config[CONF_STATS_INTERVAL]))
+    cg.add(var.set_min_frame_gap(config[CONF_MIN_FRAME_GAP]))
+    cg.add(var.set_optimistic(config[CONF_OPTIMISTIC]))
+    cg.add(var.set_auto_baud(config[CONF_AUTO_BAUD]))
+
+    if config[CONF_EVENT_DRIVEN]:
+        cg.add(var.set_event_driven(True))
+
+    if config[CONF_PROFILE_LOOP]:
+        cg.add_define("USE_MEL_AC_PROFILER")
+
+    for key in SENSOR_KEYS:
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(getattr(var, f"set_{key}_sensor")(sens))
+
+    if CONF_CONNECTED in config:
+        sens = await binary_sensor.new_binary_sensor(config[CONF_CONNECTED])
+        cg.add(var.set_connected_binary_sensor(sens))
 
     cg.add(var.set_supported_modes(config[CONF_SUPPORTED_MODES]))
     cg.add(var.set_supported_fan_modes(config[CONF_SUPPORTED_FAN_MODES]))
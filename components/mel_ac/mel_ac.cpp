@@ -1,4 +1,5 @@
 #include <cinttypes>
+#include <cstring>
 #include "esphome/core/log.h"
 
 #include "mel_ac.h"
@@ -11,6 +12,83 @@ using namespace conn;
 
 static const char *const TAG = "mel.ac";
 
+MelScheduler mel_scheduler;
+
+/*******************************************************************************
+ * SCHEDULER
+ ******************************************************************************/
+
+/**
+ * Register a unit, returns its index or MEL_SCHEDULER_SLOTS when all slots are taken.
+ */
+uint8_t MelScheduler::add(MelAirConditioner *unit) {
+  if (this->unit_count_ >= MEL_SCHEDULER_SLOTS) {
+    return MEL_SCHEDULER_SLOTS;
+  }
+  this->units_[this->unit_count_] = unit;
+  return this->unit_count_++;
+}
+
+/**
+ * Ask for a poll request. The unit is marked waiting, and the request is granted
+ * when the limits allow it and no unit ahead of it in turn is waiting.
+ */
+bool MelScheduler::acquire(uint8_t index, uint32_t now) {
+  if (index >= this->unit_count_) {
+    return true;
+  }
+  this->waiting_ |= (1 << index);
+
+  if ((now - this->cycle_timestamp_) >= MEL_SCHEDULER_CYCLE) {
+    this->cycle_timestamp_ = now;
+    this->cycle_granted_ = 0;
+  }
+
+  bool granted = ((this->poll_budget_ == 0) || (this->cycle_granted_ < this->poll_budget_)) &&
+                 ((this->max_in_flight_ == 0) || (this->get_in_flight() < this->max_in_flight_));
+
+  // The first waiting unit, starting from the one whose turn it is, gets the request
+  for (uint8_t i = 0; granted && (i < this->unit_count_); i++) {
+    const uint8_t unit = (this->next_ + i) % this->unit_count_;
+    if (this->waiting_ & (1 << unit)) {
+      granted = (unit == index);
+      break;
+    }
+  }
+
+  if (!granted) {
+    this->deferred_++;
+    return false;
+  }
+
+  this->waiting_ &= ~(1 << index);
+  this->next_ = (index + 1) % this->unit_count_;
+  this->cycle_granted_++;
+  return true;
+}
+
+/**
+ * Give up the turn of a unit that stopped polling, so it does not hold back the others.
+ */
+void MelScheduler::release(uint8_t index) {
+  if (index < this->unit_count_) {
+    this->waiting_ &= ~(1 << index);
+  }
+}
+
+/**
+ * Number of units on this device waiting for a response.
+ */
+uint8_t MelScheduler::get_in_flight(void) const {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < this->unit_count_; i++) {
+    if (this->units_[i]->is_request_in_flight()) {
+      count++;
+    }
+  }
+  return count;
+}
+
 /*******************************************************************************
  * PROTECTED
  ******************************************************************************/
@@ -39,9 +117,46 @@ void MelAirConditioner::request_status(void) {
   this->conn_.send_command(MEL_COMMAND_FLAGS_GET, payload, sizeof(payload));
 }
 
+/**
+ * Report the room temperature of an external sensor, NAN reverts to the sensor of the unit.
+ */
+void MelAirConditioner::request_set_room_temperature(float value) {
+  uint8_t payload[16] = {MEL_COMMAND_TYPE_SET_TEMP};
+  if (std::isnan(value)) {
+    ESP_LOGV(TAG, "REQ> SET_TEMP: internal sensor");
+    payload[3] = 0x80;
+  } else {
+    value = clamp(value, MEL_ROOM_TEMPERATURE_MIN, MEL_ROOM_TEMPERATURE_MAX);
+    ESP_LOGV(TAG, "REQ> SET_TEMP: %.1f", value);
+    payload[1] = 0x01;
+    payload[2] = (uint8_t) round(3 + ((value - 10) * 2));
+    payload[3] = (uint8_t) round(value * 2) + 0x80;
+  }
+  this->conn_.send_command(MEL_COMMAND_FLAGS_SET, payload, sizeof(payload));
+  this->ac_room_temperature_sent_ = value;
+  this->ac_room_temperature_in_flight_ = true;
+}
+
 void MelAirConditioner::process_response(void) {
   if (this->conn_.is_response_timeout()) {
+    this->conn_.clear_response_timeout();
     ESP_LOGV(TAG, "RES> Response Timeout");
+    if (this->ac_room_temperature_in_flight_) {
+      this->room_temperature_done(false);
+    }
+    if (this->set_params().is_in_flight()) {
+      this->control_failed("SET timed out");
+    }
+
+    // The unit stopped responding, start over with CONNECT
+    if (this->get_connected() && (++this->ac_timeout_count_ >= MEL_RECONNECT_TIMEOUTS)) {
+      ESP_LOGW(TAG, "No response to %u requests, reconnecting", this->ac_timeout_count_);
+      this->set_connected(false);
+      // Keep what led to the reconnect, should the power fail next
+      if (this->conn_.trace_snapshot_save()) {
+        ESP_LOGD(TAG, "TRACE> Snapshot saved to flash");
+      }
+    }
     return;
   }
 
@@ -49,6 +164,7 @@ void MelAirConditioner::process_response(void) {
     return;
   }
   this->conn_.clear_response_pending();
+  this->ac_timeout_count_ = 0;
 
   const struct MelCommand *res = this->conn_.response();
 
@@ -57,6 +173,7 @@ void MelAirConditioner::process_response(void) {
     ESP_LOGV(TAG, "RES> CONNECT");
     ESP_LOGI(TAG, "Connected to Air Conditioner");
     this->set_connected(true);
+    this->auto_baud_lock();
     return;
   }
 
@@ -70,6 +187,16 @@ void MelAirConditioner::process_response(void) {
         ESP_LOGV(TAG, "RES> GET_PARAMS:");
         this->clear_poll_flag(MEL_POLL_GET_PARAMS);
 
+        // A change that was not requested here was made from the remote, follow it closely for a while
+        const bool changed = (this->ac_params_raw_length_ != res->length) ||
+                             (memcmp(this->ac_params_raw_, res->payload, res->length) != 0);
+        if (changed && (this->ac_params_raw_length_ != 0)) {
+          this->start_fast_follow("parameter change");
+        }
+        memcpy(this->ac_params_raw_, res->payload, res->length);
+        this->ac_params_raw_length_ = res->length;
+        this->ac_params_fresh_ = true;
+
         // POWER
         uint8_t power = res->payload[MEL_GET_PARAMS_OFFSET_POWER];
         if (params.set_power(power)) {
@@ -135,6 +262,7 @@ void MelAirConditioner::process_response(void) {
         ESP_LOGV(TAG, "RES>   temperature_mode: %d", params.get_temperature_mode());
         ESP_LOGV(TAG, "RES>   temperature_target: %.1f", params.get_temperature_target());
 
+        this->do_confirm();
         break;
       }
 
@@ -149,8 +277,17 @@ void MelAirConditioner::process_response(void) {
         } else {
           temperature = (float) (res->payload[3]) + 10.0;
         }
-        params.set_temperature_current(temperature);
-        ESP_LOGV(TAG, "RES>   temperature_current: %.1f", params.get_temperature_current());
+        ESP_LOGV(TAG, "RES>   temperature_current: %.1f", temperature);
+
+        // Small or frequent changes are held back, a stale value is published again
+        const uint32_t now = millis();
+        const bool stale = this->ac_temperature_filter_.is_stale(now);
+        if (this->ac_temperature_filter_.apply(temperature, now)) {
+          params.set_temperature_current(temperature);
+          if (stale) {
+            params.set_updated(MEL_AC_FIELD_REFRESH);
+          }
+        }
 
         break;
       }
@@ -172,13 +309,25 @@ void MelAirConditioner::process_response(void) {
         break;
       }
     }
+
+    // Publish the fields this response changed without waiting for the rest of the poll cycle
+    this->do_publish();
   }
 
   // SET
   if (this->conn_.check_response_flags(MEL_COMMAND_FLAGS_SET)) {
     const uint16_t last_error = res->payload[1] | (res->payload[2] << 8);
-    if (last_error) {
+    if (this->ac_room_temperature_in_flight_) {
+      if (last_error) {
+        ESP_LOGW(TAG, "RES> SET_TEMP failed with error 0x%04X", last_error);
+      }
+      this->room_temperature_done(last_error == 0);
+    } else if (last_error) {
       ESP_LOGW(TAG, "RES> SET failed with error 0x%04X", last_error);
+      this->control_failed("SET rejected");
+    } else {
+      ESP_LOGV(TAG, "RES> SET acknowledged");
+      this->set_params().acknowledge();
     }
   }
 }
@@ -187,137 +336,308 @@ void MelAirConditioner::do_publish(void) {
   // Publish Climate States
   auto &params = this->params();
 
-  if (!params.is_updated()) {
+  const uint16_t updated = params.get_updated();
+  if (updated == 0) {
     return;
   }
 
   params.clear_updated();
 
-  this->current_temperature = params.get_temperature_current();
-  this->target_temperature = params.get_temperature_target();
-
-  switch (params.get_power()) {
-    case MelAcParamPower::MEL_AC_PARAM_POWER_ON: {
-      auto operating = params.get_compressor_operating();
-      switch (params.get_mode()) {
-        case MelAcParamMode::MEL_AC_PARAM_MODE_HEAT: {
-          this->mode = climate::CLIMATE_MODE_HEAT;
-          this->action = operating ? climate::CLIMATE_ACTION_HEATING : climate::CLIMATE_ACTION_IDLE;
-        } break;
-
-        case MelAcParamMode::MEL_AC_PARAM_MODE_DRY: {
-          this->mode = climate::CLIMATE_MODE_DRY;
-          this->action = climate::CLIMATE_ACTION_DRYING;
-        } break;
-
-        case MelAcParamMode::MEL_AC_PARAM_MODE_COOL: {
-          this->mode = climate::CLIMATE_MODE_COOL;
-          this->action = operating ? climate::CLIMATE_ACTION_COOLING : climate::CLIMATE_ACTION_IDLE;
-        } break;
-
-        case MelAcParamMode::MEL_AC_PARAM_MODE_FAN: {
-          this->mode = climate::CLIMATE_MODE_FAN_ONLY;
-          this->action = climate::CLIMATE_ACTION_FAN;
-        } break;
-
-        case MelAcParamMode::MEL_AC_PARAM_MODE_AUTO: {
-          this->mode = climate::CLIMATE_MODE_HEAT_COOL;
-          if (operating && (this->current_temperature > this->target_temperature)) {
-            this->action = climate::CLIMATE_ACTION_COOLING;
-          } else if (this->current_temperature < this->target_temperature) {
-            this->action = climate::CLIMATE_ACTION_HEATING;
-          } else {
-            this->action = climate::CLIMATE_ACTION_IDLE;
-          }
-        } break;
-      }
-    } break;
+  // Only publish when a climate value actually changed
+  const auto last_mode = this->mode;
+  const auto last_action = this->action;
+  const auto last_current_temperature = this->current_temperature;
+  const auto last_target_temperature = this->target_temperature;
+  const auto last_fan_mode = this->fan_mode;
+  const auto last_swing_mode = this->swing_mode;
 
-    case MelAcParamPower::MEL_AC_PARAM_POWER_OFF:
-    default: {
-      this->mode = climate::CLIMATE_MODE_OFF;
-      this->action = climate::CLIMATE_ACTION_OFF;
-    } break;
+  if (updated & MEL_AC_FIELD_TEMPERATURE_CURRENT) {
+    this->current_temperature = params.get_temperature_current();
+  }
+  if (updated & MEL_AC_FIELD_TEMPERATURE_TARGET) {
+    this->target_temperature = params.get_temperature_target();
+  }
+
+  if (updated & MEL_AC_FIELD_ACTION) {
+    switch (params.get_power()) {
+      case MelAcParamPower::MEL_AC_PARAM_POWER_ON: {
+        auto operating = params.get_compressor_operating();
+        switch (params.get_mode()) {
+          case MelAcParamMode::MEL_AC_PARAM_MODE_HEAT: {
+            this->mode = climate::CLIMATE_MODE_HEAT;
+            this->action = operating ? climate::CLIMATE_ACTION_HEATING : climate::CLIMATE_ACTION_IDLE;
+          } break;
+
+          case MelAcParamMode::MEL_AC_PARAM_MODE_DRY: {
+            this->mode = climate::CLIMATE_MODE_DRY;
+            this->action = climate::CLIMATE_ACTION_DRYING;
+          } break;
+
+          case MelAcParamMode::MEL_AC_PARAM_MODE_COOL: {
+            this->mode = climate::CLIMATE_MODE_COOL;
+            this->action = operating ? climate::CLIMATE_ACTION_COOLING : climate::CLIMATE_ACTION_IDLE;
+          } break;
+
+          case MelAcParamMode::MEL_AC_PARAM_MODE_FAN: {
+            this->mode = climate::CLIMATE_MODE_FAN_ONLY;
+            this->action = climate::CLIMATE_ACTION_FAN;
+          } break;
+
+          case MelAcParamMode::MEL_AC_PARAM_MODE_AUTO: {
+            this->mode = climate::CLIMATE_MODE_HEAT_COOL;
+            if (operating && (this->current_temperature > this->target_temperature)) {
+              this->action = climate::CLIMATE_ACTION_COOLING;
+            } else if (this->current_temperature < this->target_temperature) {
+              this->action = climate::CLIMATE_ACTION_HEATING;
+            } else {
+              this->action = climate::CLIMATE_ACTION_IDLE;
+            }
+          } break;
+        }
+      } break;
+
+      case MelAcParamPower::MEL_AC_PARAM_POWER_OFF:
+      default: {
+        this->mode = climate::CLIMATE_MODE_OFF;
+        this->action = climate::CLIMATE_ACTION_OFF;
+      } break;
+    }
   }
 
-  switch (params.get_fan()) {
-    case MelAcParamFan::MEL_AC_PARAM_FAN_QUIET: {
-      this->fan_mode = climate::CLIMATE_FAN_QUIET;
-    } break;
+  if (updated & MEL_AC_FIELD_FAN) {
+    switch (params.get_fan()) {
+      case MelAcParamFan::MEL_AC_PARAM_FAN_QUIET: {
+        this->fan_mode = climate::CLIMATE_FAN_QUIET;
+      } break;
 
-    case MelAcParamFan::MEL_AC_PARAM_FAN_1: {
-      this->fan_mode = climate::CLIMATE_FAN_LOW;
-    } break;
+      case MelAcParamFan::MEL_AC_PARAM_FAN_1: {
+        this->fan_mode = climate::CLIMATE_FAN_LOW;
+      } break;
 
-    case MelAcParamFan::MEL_AC_PARAM_FAN_2: {
-      this->fan_mode = climate::CLIMATE_FAN_MEDIUM;
-    } break;
+      case MelAcParamFan::MEL_AC_PARAM_FAN_2: {
+        this->fan_mode = climate::CLIMATE_FAN_MEDIUM;
+      } break;
 
-    case MelAcParamFan::MEL_AC_PARAM_FAN_3: {
-      this->fan_mode = climate::CLIMATE_FAN_HIGH;
-    } break;
+      case MelAcParamFan::MEL_AC_PARAM_FAN_3: {
+        this->fan_mode = climate::CLIMATE_FAN_HIGH;
+      } break;
 
-    case MelAcParamFan::MEL_AC_PARAM_FAN_4: {
-      this->fan_mode = climate::CLIMATE_FAN_FOCUS;
-    } break;
+      case MelAcParamFan::MEL_AC_PARAM_FAN_4: {
+        this->fan_mode = climate::CLIMATE_FAN_FOCUS;
+      } break;
 
-    case MelAcParamFan::MEL_AC_PARAM_FAN_AUTO:
-    default: {
-      this->fan_mode = climate::CLIMATE_FAN_AUTO;
-    } break;
+      case MelAcParamFan::MEL_AC_PARAM_FAN_AUTO:
+      default: {
+        this->fan_mode = climate::CLIMATE_FAN_AUTO;
+      } break;
+    }
   }
 
-  switch (params.get_vane_vert()) {
-    case MelAcParamVaneVert::MEL_AC_PARAM_VANE_VERT_SWING: {
-      this->swing_mode = climate::CLIMATE_SWING_VERTICAL;
-    } break;
+  if (updated & MEL_AC_FIELD_VANE_VERT) {
+    switch (params.get_vane_vert()) {
+      case MelAcParamVaneVert::MEL_AC_PARAM_VANE_VERT_SWING: {
+        this->swing_mode = climate::CLIMATE_SWING_VERTICAL;
+      } break;
 
-    default: {
-      this->swing_mode = climate::CLIMATE_SWING_OFF;
-    } break;
+      default: {
+        this->swing_mode = climate::CLIMATE_SWING_OFF;
+      } break;
+    }
   }
 
+  if (this->ac_state_published_ && !(updated & MEL_AC_FIELD_REFRESH) && (this->mode == last_mode) &&
+      (this->action == last_action) && (this->current_temperature == last_current_temperature) &&
+      (this->target_temperature == last_target_temperature) && (this->fan_mode == last_fan_mode) &&
+      (this->swing_mode == last_swing_mode)) {
+    ESP_LOGVV(TAG, "PUBLISH> Fields 0x%04X changed, climate state unchanged", updated);
+    return;
+  }
+
+  this->ac_state_published_ = true;
   this->publish_state();
 }
 
+void MelAirConditioner::set_connected(bool value) {
+  if (value == this->ac_connected_) {
+    return;
+  }
+  this->ac_connected_ = value;
+  if (!value) {
+    this->conn_.trace_event(MEL_TRACE_DISCONNECT, this->ac_timeout_count_);
+  }
+  this->ac_timeout_count_ = 0;
+
+  // The unit may have lost the external room temperature, report it again
+  this->ac_room_temperature_filter_.reset();
+  this->ac_room_temperature_in_flight_ = false;
+
+  if (value) {
+    this->ac_connect_time_ = millis() - this->ac_disconnect_timestamp_;
+    ESP_LOGD(TAG, "Connected after %" PRIu32 " attempts in %" PRIu32 " ms", this->ac_connect_attempts_,
+             this->ac_connect_time_);
+    this->conn_.trace_event(MEL_TRACE_CONNECT, std::min(this->ac_connect_attempts_, (uint32_t) UINT8_MAX), 0,
+                            this->ac_connect_time_);
+#ifdef USE_SENSOR
+    if (this->connect_time_sensor_ != nullptr) {
+      this->connect_time_sensor_->publish_state(this->ac_connect_time_);
+    }
+#endif
+  } else {
+    this->ac_connect_attempts_ = 0;
+    this->ac_connect_delay_ = 0;
+  }
+
+#ifdef USE_BINARY_SENSOR
+  if (this->connected_binary_sensor_ != nullptr) {
+    this->connected_binary_sensor_->publish_state(value);
+  }
+#endif
+}
+
+/**
+ * Send CONNECT until the unit responds. The first attempts cover every baud
+ * rate, then the attempts back off exponentially with some jitter so several
+ * units on one device do not retry in lockstep.
+ */
 void MelAirConditioner::do_connect(void) {
-  static uint32_t attempt = 0;
-  if (this->get_connected()) {
+  const uint32_t now = millis();
+  if (!this->is_connect_due(now)) {
     return;
   }
+
+  if (this->ac_connect_attempts_ == 0) {
+    this->ac_disconnect_timestamp_ = now;
+  }
+
+  // Move on to the next baud rate when the unit does not answer at this one
+  if (this->auto_baud_ && !this->auto_baud_locked_ && (this->auto_baud_attempts_++ >= MEL_AUTO_BAUD_ATTEMPTS)) {
+    this->auto_baud_apply((this->auto_baud_index_ + 1) % std::extent<decltype(MEL_SUPPORTED_BAUD_RATES)>::value);
+  }
+
   this->request_connect();
-  attempt++;
-  if ((attempt > 0) && (attempt % 25 == 0)) {
-    ESP_LOGW(TAG, "Attempted CONNECT %" PRIu32 " times. Please verify connection or change the baud rate.", attempt);
+  this->ac_connect_timestamp_ = now;
+  const uint32_t attempt = ++this->ac_connect_attempts_;
+  if (attempt % 25 == 0) {
+    if (this->auto_baud_) {
+      ESP_LOGW(TAG, "Attempted CONNECT %" PRIu32 " times over the supported baud rates. Please verify connection.",
+               attempt);
+    } else {
+      ESP_LOGW(TAG, "Attempted CONNECT %" PRIu32 " times. Please verify connection or change the baud rate.", attempt);
+    }
+  }
+
+  if (attempt < MEL_CONNECT_FAST_ATTEMPTS) {
+    this->ac_connect_delay_ = 0;
+    return;
+  }
+  const uint32_t shift = std::min<uint32_t>(attempt - MEL_CONNECT_FAST_ATTEMPTS, 16);
+  uint32_t delay = std::min(MEL_CONNECT_BACKOFF_MIN << shift, MEL_CONNECT_BACKOFF_MAX);
+  delay += random_uint32() % (delay * MEL_CONNECT_JITTER_PERCENT / 100 + 1);
+  this->ac_connect_delay_ = delay;
+  ESP_LOGV(TAG, "Next CONNECT in %" PRIu32 " ms", delay);
+}
+
+/**
+ * Whether update() has anything to do, used in event driven mode.
+ */
+bool MelAirConditioner::is_update_due(uint32_t now) {
+  if (now < this->startup_delay_) {
+    return false;
+  }
+
+  if (this->conn_.is_tick_due(now)) {
+    return true;
+  }
+
+  // Nothing can be sent until the response arrives or times out
+  if (this->conn_.is_busy()) {
+    return false;
+  }
+
+  if (this->conn_.is_response_pending() || this->is_connect_due(now)) {
+    return true;
+  }
+
+  // Controls and polls wait for the connection
+  return (this->get_connected() && (this->set_params().is_pending(now) || this->is_room_temperature_due(now) ||
+                                    !this->check_poll_idle() || (this->get_poll_due(now) != MEL_POLL_NONE))) ||
+         ((now - this->stats_timestamp_) >= this->stats_interval_);
+}
+
+void MelAirConditioner::do_publish_stats(void) {
+  const uint32_t now = millis();
+  if ((now - this->stats_timestamp_) < this->stats_interval_) {
+    return;
+  }
+  this->stats_timestamp_ = now;
+
+  // Mean RTT of all requests since the last update
+  uint32_t count = 0;
+  uint32_t total = 0;
+  const struct MelRttStats *rtt = this->conn_.get_rtt_stats();
+  for (int i = 0; i < MEL_RTT_SLOTS; i++) {
+    count += rtt[i].count;
+    total += rtt[i].total;
+  }
+  const uint32_t window_count = count - this->stats_rtt_count_;
+  const uint32_t window_total = total - this->stats_rtt_total_;
+  this->stats_rtt_count_ = count;
+  this->stats_rtt_total_ = total;
+
+#ifdef USE_SENSOR
+  auto &stats = this->conn_.get_stats();
+  if (this->timeouts_sensor_ != nullptr) {
+    this->timeouts_sensor_->publish_state(stats.timeouts);
+  }
+  if (this->checksum_errors_sensor_ != nullptr) {
+    this->checksum_errors_sensor_->publish_state(stats.checksum_errors);
+  }
+  if (this->version_errors_sensor_ != nullptr) {
+    this->version_errors_sensor_->publish_state(stats.version_errors);
   }
+  if (this->mismatches_sensor_ != nullptr) {
+    this->mismatches_sensor_->publish_state(stats.mismatches);
+  }
+  if ((this->response_time_sensor_ != nullptr) && (window_count > 0)) {
+    this->response_time_sensor_->publish_state((float) window_total / window_count);
+  }
+#endif
 }
 
 bool MelAirConditioner::do_control(void) {
   auto &params = this->set_params();
 
-  if (!params.is_pending()) {
+  if (!params.is_pending(millis())) {
     return false;
   }
-  params.set_pending(false);
 
-  uint16_t control = 0;
+  // Only send the fields that changed and do not already match the unit
+  const uint16_t matching = this->get_matching_fields(params.get_dirty());
+  if (matching) {
+    ESP_LOGV(TAG, "CONTROL> Suppressed fields 0x%04X, already set", matching);
+    params.clear_dirty(matching);
+  }
+
+  const uint16_t control = params.get_dirty();
+  if (control == 0) {
+    return false;  // Nothing was set, return early
+  }
+
   uint8_t payload[16] = {MEL_COMMAND_TYPE_SET_PARAMS};
 
-  if (params.get_power().has_value()) {
+  if (control & MEL_COMMAND_SET_POWER) {
     auto power = params.get_power().value();
     payload[MEL_SET_PARAMS_OFFSET_POWER] = (uint8_t) power;
-    control |= MEL_COMMAND_SET_POWER;
     ESP_LOGD(TAG, "CONTROL> power: 0x%02X [%s]", power, params.get_power_name().c_str());
   }
 
-  if (params.get_mode().has_value()) {
+  if (control & MEL_COMMAND_SET_MODE) {
     auto mode = params.get_mode().value();
     payload[MEL_SET_PARAMS_OFFSET_MODE] = (uint8_t) mode;
-    control |= MEL_COMMAND_SET_MODE;
     ESP_LOGD(TAG, "CONTROL> mode: 0x%02X [%s]", mode, params.get_mode_name().c_str());
   }
 
-  if (params.get_temperature().has_value()) {
+  if (control & MEL_COMMAND_SET_TEMPERATURE) {
     auto value = params.get_temperature().value();
 
     value = value < MEL_AC_TEMP_MIN ? MEL_AC_TEMP_MIN : value;
@@ -329,51 +649,298 @@ bool MelAirConditioner::do_control(void) {
       payload[MEL_SET_PARAMS_OFFSET_TEMPERATURE_1] = (uint8_t) (31 - value);
     }
 
-    control |= MEL_COMMAND_SET_TEMPERATURE;
     ESP_LOGD(TAG, "CONTROL> temperature: %.1f", value);
   }
 
-  if (params.get_fan().has_value()) {
+  if (control & MEL_COMMAND_SET_FAN) {
     auto fan = params.get_fan().value();
     payload[MEL_SET_PARAMS_OFFSET_FAN] = (uint8_t) fan;
-    control |= MEL_COMMAND_SET_FAN;
     ESP_LOGD(TAG, "CONTROL> fan: 0x%02X [%s]", fan, params.get_fan_name().c_str());
   }
 
-  if (params.get_vane_vert().has_value()) {
+  if (control & MEL_COMMAND_SET_VANE_VERT) {
     auto vane = params.get_vane_vert().value();
     payload[MEL_SET_PARAMS_OFFSET_VANE_VERT] = (uint8_t) vane;
-    control |= MEL_COMMAND_SET_VANE_VERT;
     ESP_LOGD(TAG, "CONTROL> vane_vert: 0x%02X [%s]", vane, params.get_vane_vert_name().c_str());
   }
 
-  if (params.get_vane_horz().has_value()) {
+  if (control & MEL_COMMAND_SET_VANE_HORZ) {
     auto vane_horz_flag = this->params().get_vane_horz_flag();
     auto vane_horz = params.get_vane_horz().value() | (vane_horz_flag ? 0x80 : 0x00);
     payload[MEL_SET_PARAMS_OFFSET_VANE_HORZ] = (uint8_t) (vane_horz & 0xFF);
-    control |= MEL_COMMAND_SET_VANE_HORZ;
     ESP_LOGD(TAG, "CONTROL> vane_horz_flag: %s", TRUEFALSE(vane_horz_flag));
     ESP_LOGD(TAG, "CONTROL> vane_horz: 0x%02X [%s]", vane_horz, params.get_vane_horz_name().c_str());
   }
 
-  if (control == 0) {
-    return false;  // Nothing was set, return early
-  }
-
   payload[1] = (uint8_t) control & 0xFF;
   payload[2] = (uint8_t) (control >> 8) & 0xFF;
 
   ESP_LOGV(TAG, "REQ> SET_PARAMS");
   this->conn_.send_command(MEL_COMMAND_FLAGS_SET, payload, sizeof(payload));
+  params.start(control);
+  this->ac_params_fresh_ = false;
+
+  // Read back the parameters to confirm the unit applied them
+  this->ac_poll_timestamps_[MEL_POLL_INDEX_PARAMS] = millis();
+  this->set_poll_flag(MEL_POLL_GET_PARAMS);
+
+  return true;
+}
+
+/**
+ * Fields of 'fields' whose requested value already matches the unit state.
+ * Nothing matches until the parameters were read back after the last SET.
+ */
+uint16_t MelAirConditioner::get_matching_fields(uint16_t fields) {
+  if (!this->ac_params_fresh_) {
+    return 0;
+  }
+
+  auto &params = this->params();
+  auto &set = this->set_params();
+  uint16_t matching = 0;
+
+  if ((fields & MEL_COMMAND_SET_POWER) && (set.get_power().value() == params.get_power())) {
+    matching |= MEL_COMMAND_SET_POWER;
+  }
+
+  if ((fields & MEL_COMMAND_SET_MODE) && (set.get_mode().value() == params.get_mode())) {
+    matching |= MEL_COMMAND_SET_MODE;
+  }
+
+  if (fields & MEL_COMMAND_SET_TEMPERATURE) {
+    auto value = set.get_temperature().value();
+    value = value < MEL_AC_TEMP_MIN ? MEL_AC_TEMP_MIN : value;
+    value = value > MEL_AC_TEMP_MAX ? MEL_AC_TEMP_MAX : value;
+    // TEMP_MODE_1 only has whole degrees
+    const float tolerance = (params.get_temperature_mode() == MelAcTemperatureMode::MEL_AC_TEMP_MODE_2) ? 0.25f : 1.0f;
+    if (fabs(value - params.get_temperature_target()) < tolerance) {
+      matching |= MEL_COMMAND_SET_TEMPERATURE;
+    }
+  }
+
+  if ((fields & MEL_COMMAND_SET_FAN) && (set.get_fan().value() == params.get_fan())) {
+    matching |= MEL_COMMAND_SET_FAN;
+  }
 
-  // Force poll restart to pull the latest unit states
-  this->restart_poll(true);
+  if ((fields & MEL_COMMAND_SET_VANE_VERT) && (set.get_vane_vert().value() == params.get_vane_vert())) {
+    matching |= MEL_COMMAND_SET_VANE_VERT;
+  }
+
+  if ((fields & MEL_COMMAND_SET_VANE_HORZ) && (set.get_vane_horz().value() == params.get_vane_horz())) {
+    matching |= MEL_COMMAND_SET_VANE_HORZ;
+  }
+
+  return matching;
+}
+
+void MelAirConditioner::control_failed(const char *reason) {
+  auto &params = this->set_params();
+  const uint16_t fields = params.get_in_flight();
+  if (params.fail(millis())) {
+    ESP_LOGW(TAG, "CONTROL> %s, retry %u in %u ms", reason, params.get_retry_count(), params.get_retry_delay());
+    this->conn_.trace_event(MEL_TRACE_CONTROL_RETRY, params.get_retry_count(), fields, params.get_retry_delay());
+  } else {
+    ESP_LOGE(TAG, "CONTROL> %s, dropped fields 0x%04X after %u attempts", reason, params.get_dropped(),
+             MEL_SET_MAX_RETRY + 1);
+    this->conn_.trace_event(MEL_TRACE_CONTROL_DROP, MEL_SET_MAX_RETRY + 1, params.get_dropped());
+    if (params.get_dirty() != 0) {
+      ESP_LOGD(TAG, "CONTROL> Fields 0x%04X changed since, sending them", params.get_dirty());
+    }
+    this->control_dropped();
+  }
+}
 
+/**
+ * Give up on fields of a control. Their optimistic values may still be shown,
+ * flag every field so the next response publishes the state the unit reports.
+ */
+void MelAirConditioner::control_dropped(void) {
+  if (this->set_params().is_idle()) {
+    this->ac_control_confirming_ = false;
+  }
+  this->params().set_updated(MEL_AC_FIELD_ALL);
+}
+
+/**
+ * Compare the fields of the acknowledged SET requests with the parameters read
+ * back from the unit, and re-issue the ones it did not apply.
+ */
+void MelAirConditioner::do_confirm(void) {
+  auto &set = this->set_params();
+
+  // Fields requested again since are confirmed by their next SET
+  set.confirm(set.get_unconfirmed() & set.get_dirty());
+
+  const uint16_t fields = set.get_unconfirmed();
+  if (fields != 0) {
+    const uint16_t matching = this->get_matching_fields(fields);
+    const uint16_t mismatch = fields & ~matching;
+    set.confirm(matching);
+
+    if (mismatch != 0) {
+      if (set.reissue(mismatch)) {
+        ESP_LOGW(TAG, "CONTROL> Fields 0x%04X not applied, re-issue %u/%u", mismatch, set.get_confirm_count(),
+                 MEL_CONFIRM_MAX_RETRY);
+        this->conn_.trace_event(MEL_TRACE_CONTROL_REISSUE, set.get_confirm_count(), mismatch);
+      } else {
+        ESP_LOGE(TAG, "CONTROL> Fields 0x%04X not applied after %u attempts", mismatch, MEL_CONFIRM_MAX_RETRY + 1);
+        this->conn_.trace_event(MEL_TRACE_CONTROL_DROP, MEL_CONFIRM_MAX_RETRY + 1, mismatch);
+        this->control_dropped();
+      }
+    }
+  }
+
+  if (!this->ac_control_confirming_ || !set.is_idle()) {
+    return;
+  }
+  this->ac_control_confirming_ = false;
+
+  this->ac_control_latency_ = millis() - this->ac_control_timestamp_;
+  this->ac_control_latency_max_ = std::max(this->ac_control_latency_max_, this->ac_control_latency_);
+  ESP_LOGD(TAG, "CONTROL> Confirmed in %" PRIu32 " ms", this->ac_control_latency_);
+
+#ifdef USE_SENSOR
+  if (this->control_latency_sensor_ != nullptr) {
+    this->control_latency_sensor_->publish_state(this->ac_control_latency_);
+  }
+#endif
+
+  // Show the confirmed state without waiting for the end of the poll cycle
+  this->do_publish();
+}
+
+bool MelAirConditioner::is_room_temperature_due(uint32_t now) {
+#ifdef USE_SENSOR
+  if (this->room_temperature_sensor_ == nullptr) {
+    return false;
+  }
+
+  // Back off after a failed SET_TEMP so the polls are not starved
+  if ((now - this->ac_room_temperature_retry_timestamp_) < this->ac_room_temperature_retry_delay_) {
+    return false;
+  }
+
+  // Without recent readings the unit goes back to its own sensor
+  if (std::isnan(this->ac_room_temperature_) ||
+      ((now - this->ac_room_temperature_timestamp_) >= this->ac_room_temperature_timeout_)) {
+    return this->ac_room_temperature_active_;
+  }
+  return this->ac_room_temperature_filter_.check(this->ac_room_temperature_, now);
+#else
+  return false;
+#endif
+}
+
+/**
+ * Send the external room temperature once it moved past the deadband and the
+ * minimum interval elapsed, or revert to the unit sensor when it is stale.
+ */
+bool MelAirConditioner::do_room_temperature(void) {
+  const uint32_t now = millis();
+  if (!this->is_room_temperature_due(now)) {
+    return false;
+  }
+
+  if (std::isnan(this->ac_room_temperature_) ||
+      ((now - this->ac_room_temperature_timestamp_) >= this->ac_room_temperature_timeout_)) {
+    ESP_LOGW(TAG, "CONTROL> No room temperature reading, reverting to the unit sensor");
+    this->request_set_room_temperature(NAN);
+    return true;
+  }
+
+  this->ac_room_temperature_filter_.apply(this->ac_room_temperature_, now);
+  this->request_set_room_temperature(this->ac_room_temperature_);
   return true;
 }
 
+/**
+ * A failed SET_TEMP is sent again after the same backoff as a failed SET. Once
+ * the retries are exhausted a reading waits for the filter to take the next
+ * one, and a revert is abandoned.
+ */
+void MelAirConditioner::room_temperature_done(bool success) {
+  this->ac_room_temperature_in_flight_ = false;
+  if (success) {
+    this->ac_room_temperature_active_ = !std::isnan(this->ac_room_temperature_sent_);
+    this->ac_room_temperature_retry_count_ = 0;
+    this->ac_room_temperature_retry_delay_ = 0;
+    return;
+  }
+
+  if (++this->ac_room_temperature_retry_count_ > MEL_SET_MAX_RETRY) {
+    ESP_LOGE(TAG, "CONTROL> SET_TEMP failed, dropped after %u attempts", MEL_SET_MAX_RETRY + 1);
+    if (std::isnan(this->ac_room_temperature_sent_)) {
+      this->ac_room_temperature_active_ = false;
+    }
+    this->ac_room_temperature_retry_count_ = 0;
+    this->ac_room_temperature_retry_delay_ = 0;
+    return;
+  }
+
+  this->ac_room_temperature_retry_timestamp_ = millis();
+  this->ac_room_temperature_retry_delay_ =
+      std::min(MEL_SET_RETRY_DELAY_MIN << (this->ac_room_temperature_retry_count_ - 1), MEL_SET_RETRY_DELAY_MAX);
+  this->ac_room_temperature_filter_.reset();  // Send the current reading again
+  ESP_LOGW(TAG, "CONTROL> SET_TEMP failed, retry %u in %" PRIu32 " ms", this->ac_room_temperature_retry_count_,
+           this->ac_room_temperature_retry_delay_);
+}
+
+/**
+ * Refresh rate of a poll category. While the fast follow window is open no
+ * category is polled slower than the max refresh rate.
+ */
+uint32_t MelAirConditioner::get_poll_refresh_rate(uint8_t category, uint32_t now) {
+  if (this->ac_fast_follow_ && ((now - this->ac_fast_follow_timestamp_) >= this->ac_fast_follow_window_)) {
+    ESP_LOGD(TAG, "POLL> Fast follow ended");
+    this->ac_fast_follow_ = false;
+  }
+
+  const uint32_t rate = this->ac_poll_refresh_rates_[category];
+  if (rate == 0) {
+    return this->ac_poll_refresh_rate_;
+  }
+  return this->ac_fast_follow_ ? std::min(rate, this->ac_poll_refresh_rate_) : rate;
+}
+
+/**
+ * Return the MEL_POLL_* flags of the categories whose refresh rate has elapsed.
+ */
+uint32_t MelAirConditioner::get_poll_due(uint32_t now) {
+  uint32_t due = MEL_POLL_NONE;
+  for (uint8_t i = 0; i < MEL_POLL_CATEGORY_COUNT; i++) {
+    if ((now - this->ac_poll_timestamps_[i]) > this->get_poll_refresh_rate(i, now)) {
+      due |= (1 << i);
+    }
+  }
+  return due;
+}
+
+void MelAirConditioner::restart_poll(bool force) {
+  const uint32_t now = millis();
+  const uint32_t due = force ? MEL_POLL_ALL : this->get_poll_due(now);
+  for (uint8_t i = 0; i < MEL_POLL_CATEGORY_COUNT; i++) {
+    if ((due & (1 << i)) != 0) {
+      this->ac_poll_timestamps_[i] = now;
+    }
+  }
+  this->set_poll_flag(due);
+}
+
+void MelAirConditioner::start_fast_follow(const char *reason) {
+  if (this->ac_fast_follow_window_ == 0) {
+    return;
+  }
+  if (!this->ac_fast_follow_) {
+    ESP_LOGD(TAG, "POLL> Fast follow started, %s", reason);
+  }
+  this->ac_fast_follow_ = true;
+  this->ac_fast_follow_timestamp_ = millis();
+}
+
 void MelAirConditioner::do_poll(void) {
   if (!this->get_connected()) {
+    mel_scheduler.release(this->unit_index_);
     this->set_poll_flag(MEL_POLL_ALL);
     return;
   }
@@ -382,6 +949,15 @@ void MelAirConditioner::do_poll(void) {
     return;
   }
 
+  if (this->do_room_temperature()) {
+    return;
+  }
+
+  // Poll requests of all units on this device take turns within the shared limits
+  if (!this->check_poll_idle() && !mel_scheduler.acquire(this->unit_index_, millis())) {
+    return;
+  }
+
   if (this->check_poll_flag(MEL_POLL_GET_PARAMS)) {
     this->request_params();
     return;
@@ -398,17 +974,40 @@ void MelAirConditioner::do_poll(void) {
   }
 
   if (this->check_poll_idle()) {
+    this->do_cycle_done();
     this->restart_poll();
+    if (!this->check_poll_idle()) {
+      this->ac_cycle_timestamp_ = millis();
+      this->ac_cycle_running_ = true;
+    }
     this->do_publish();
   }
 }
 
+void MelAirConditioner::do_cycle_done(void) {
+  if (!this->ac_cycle_running_) {
+    return;
+  }
+  this->ac_cycle_running_ = false;
+  this->ac_cycle_time_ = millis() - this->ac_cycle_timestamp_;
+  this->ac_cycle_time_max_ = std::max(this->ac_cycle_time_max_, this->ac_cycle_time_);
+  ESP_LOGV(TAG, "POLL> Cycle took %" PRIu32 " ms", this->ac_cycle_time_);
+
+#ifdef USE_SENSOR
+  if (this->cycle_time_sensor_ != nullptr) {
+    this->cycle_time_sensor_->publish_state(this->ac_cycle_time_);
+  }
+#endif
+}
+
 void MelAirConditioner::control(const climate::ClimateCall &call) {
   auto &params = this->set_params();
 
   if (call.get_mode().has_value()) {
     auto mode = call.get_mode().value();
-    this->mode = mode;
+    if (this->optimistic_) {
+      this->mode = mode;
+    }
     switch (mode) {
       case climate::CLIMATE_MODE_COOL: {
         params.set_power(MelAcParamPower::MEL_AC_PARAM_POWER_ON);
@@ -449,13 +1048,17 @@ void MelAirConditioner::control(const climate::ClimateCall &call) {
 
   if (call.get_target_temperature().has_value()) {
     auto temperature = call.get_target_temperature().value();
-    this->target_temperature = temperature;
+    if (this->optimistic_) {
+      this->target_temperature = temperature;
+    }
     params.set_temperature(temperature);
   }
 
   if (call.get_fan_mode().has_value()) {
     auto fan_mode = call.get_fan_mode().value();
-    this->fan_mode = fan_mode;
+    if (this->optimistic_) {
+      this->fan_mode = fan_mode;
+    }
     switch (fan_mode) {
       case climate::CLIMATE_FAN_QUIET: {
         params.set_fan(MelAcParamFan::MEL_AC_PARAM_FAN_QUIET);
@@ -489,7 +1092,9 @@ void MelAirConditioner::control(const climate::ClimateCall &call) {
 
   if (call.get_swing_mode().has_value()) {
     auto swing_mode = call.get_swing_mode().value();
-    this->swing_mode = swing_mode;
+    if (this->optimistic_) {
+      this->swing_mode = swing_mode;
+    }
     switch (swing_mode) {
       case climate::CLIMATE_SWING_OFF: {
         params.set_vane_vert(MelAcParamVaneVert::MEL_AC_PARAM_VANE_VERT_AUTO);
@@ -517,8 +1122,15 @@ void MelAirConditioner::control(const climate::ClimateCall &call) {
     }
   }
 
-  params.set_pending(true);
-  this->publish_state();
+  if (!this->ac_control_confirming_) {
+    this->ac_control_timestamp_ = millis();
+    this->ac_control_confirming_ = true;
+  }
+
+  this->start_fast_follow("control");
+  if (this->optimistic_) {
+    this->publish_state();
+  }
 }
 
 /*******************************************************************************
@@ -549,10 +1161,170 @@ void MelAirConditioner::dump_config() {
   ESP_LOGCONFIG(TAG, "MelAirConditioner:");
   this->dump_traits_(TAG);
 
+  uint32_t rates[MEL_POLL_CATEGORY_COUNT];
+  for (uint8_t i = 0; i < MEL_POLL_CATEGORY_COUNT; i++) {
+    rates[i] = (this->ac_poll_refresh_rates_[i] != 0) ? this->ac_poll_refresh_rates_[i] : this->ac_poll_refresh_rate_;
+  }
+  ESP_LOGCONFIG(TAG, "  Refresh Rates: params=%" PRIu32 " ms, temperature=%" PRIu32 " ms, status=%" PRIu32 " ms",
+                rates[MEL_POLL_INDEX_PARAMS], rates[MEL_POLL_INDEX_TEMP], rates[MEL_POLL_INDEX_STATUS]);
+  ESP_LOGCONFIG(TAG, "  Fast Follow Window: %" PRIu32 " ms", this->ac_fast_follow_window_);
+  ESP_LOGCONFIG(TAG, "  Stats Interval: %" PRIu32 " ms", this->stats_interval_);
+  ESP_LOGCONFIG(TAG, "  Event Driven: %s", YESNO(this->event_driven_));
+  ESP_LOGCONFIG(TAG, "  Min Frame Gap: %" PRIu32 " ms", this->conn_.get_min_frame_gap());
+  ESP_LOGCONFIG(TAG, "  Temperature Filter: deadband %.1f, min interval %" PRIu32 " ms, max staleness %" PRIu32 " ms",
+                this->ac_temperature_filter_.get_deadband(), this->ac_temperature_filter_.get_min_interval(),
+                this->ac_temperature_filter_.get_max_interval());
+#ifdef USE_SENSOR
+  if (this->room_temperature_sensor_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  Room Temperature Sensor: deadband %.1f, min interval %" PRIu32 " ms, timeout %" PRIu32 " ms",
+                  this->ac_room_temperature_filter_.get_deadband(),
+                  this->ac_room_temperature_filter_.get_min_interval(), this->ac_room_temperature_timeout_);
+    ESP_LOGCONFIG(TAG, "    Active: %s", YESNO(this->ac_room_temperature_active_));
+  }
+#endif
+  ESP_LOGCONFIG(TAG, "  Optimistic: %s", YESNO(this->optimistic_));
+  if (this->unit_index_ < MEL_SCHEDULER_SLOTS) {
+    ESP_LOGCONFIG(TAG, "  Unit: %u of %u", this->unit_index_ + 1, mel_scheduler.get_unit_count());
+  }
+  ESP_LOGCONFIG(TAG, "  Scheduler: max in flight %u, poll budget %u, deferred %" PRIu32,
+                mel_scheduler.get_max_in_flight(), mel_scheduler.get_poll_budget(), mel_scheduler.get_deferred());
+  ESP_LOGCONFIG(TAG, "  Cycle Time: last %" PRIu32 " ms, max %" PRIu32 " ms", this->ac_cycle_time_,
+                this->ac_cycle_time_max_);
+  ESP_LOGCONFIG(TAG, "  Connected: %s", YESNO(this->ac_connected_));
+  ESP_LOGCONFIG(TAG, "  Connect Time: %" PRIu32 " ms", this->ac_connect_time_);
+  ESP_LOGCONFIG(TAG, "  Auto Baud: %s", YESNO(this->auto_baud_));
+  if (this->auto_baud_) {
+    ESP_LOGCONFIG(TAG, "    Stored Baud Rate: %" PRIu32, this->auto_baud_saved_);
+  }
+  ESP_LOGCONFIG(TAG, "  Control Latency: last %" PRIu32 " ms, max %" PRIu32 " ms", this->ac_control_latency_,
+                this->ac_control_latency_max_);
+  this->conn_.dump_journal(TAG);
+
   // Validate UART settings
   auto baud_rate = this->parent_->get_baud_rate();
   validate_baud_rate(baud_rate);
   this->check_uart_settings(baud_rate, 1, uart::UART_CONFIG_PARITY_EVEN, 8);
+
+  this->profiler_.dump(TAG, MEL_AC_PROFILE_PHASE_NAMES);
+
+  this->conn_.dump_recovered_trace(TAG);
+  this->dump_trace();
+}
+
+/**
+ * Switch the UART to MEL_SUPPORTED_BAUD_RATES[index].
+ */
+void MelAirConditioner::auto_baud_apply(uint8_t index) {
+  this->auto_baud_index_ = index;
+  this->auto_baud_attempts_ = 1;
+  const uint32_t baud_rate = MEL_SUPPORTED_BAUD_RATES[index];
+  this->conn_.set_baud_rate(baud_rate);
+  if (this->parent_->get_baud_rate() == baud_rate) {
+    return;
+  }
+  ESP_LOGD(TAG, "Auto baud: trying %" PRIu32, baud_rate);
+  this->parent_->set_baud_rate(baud_rate);
+  this->parent_->load_settings(false);
+}
+
+/**
+ * Keep the baud rate that got a CONNECT response and store it for the next boot.
+ */
+void MelAirConditioner::auto_baud_lock(void) {
+  if (!this->auto_baud_) {
+    return;
+  }
+  this->auto_baud_locked_ = true;
+  const uint32_t baud_rate = this->parent_->get_baud_rate();
+  if (baud_rate == this->auto_baud_saved_) {
+    return;
+  }
+  ESP_LOGI(TAG, "Auto baud: locked to %" PRIu32, baud_rate);
+  if (this->auto_baud_pref_.save(&baud_rate)) {
+    this->auto_baud_saved_ = baud_rate;
+  }
+}
+
+/**
+ * Log the protocol trace, can be called from a button or service lambda.
+ */
+void MelAirConditioner::dump_trace(void) { this->conn_.dump_trace(TAG); }
+
+void MelAirConditioner::setup() {
+  this->conn_.trace_snapshot_load();
+
+#ifdef USE_SENSOR
+  if (this->room_temperature_sensor_ != nullptr) {
+    this->room_temperature_sensor_->add_on_state_callback([this](float state) {
+      if (!std::isnan(state)) {
+        this->ac_room_temperature_ = state;
+        this->ac_room_temperature_timestamp_ = millis();
+      }
+    });
+  }
+#endif
+
+  // Start the units in different phases of the poll cycle, so their requests interleave
+  this->unit_index_ = mel_scheduler.add(this);
+  if (this->unit_index_ < MEL_SCHEDULER_SLOTS) {
+    // Every category is first due 'phase' ms from now, the next cycles keep the offset
+    const uint32_t now = millis();
+    const uint32_t phase =
+        (this->unit_index_ % MEL_SCHEDULER_PHASES) * this->ac_poll_refresh_rate_ / MEL_SCHEDULER_PHASES;
+    for (uint8_t i = 0; i < MEL_POLL_CATEGORY_COUNT; i++) {
+      this->ac_poll_timestamps_[i] = now + phase - this->get_poll_refresh_rate(i, now);
+    }
+  } else {
+    ESP_LOGW(TAG, "More than %u units, not part of the shared scheduling", MEL_SCHEDULER_SLOTS);
+  }
+
+#ifdef USE_BINARY_SENSOR
+  if (this->connected_binary_sensor_ != nullptr) {
+    this->connected_binary_sensor_->publish_initial_state(false);
+  }
+#endif
+
+  this->conn_.set_baud_rate(this->parent_->get_baud_rate());
+  if (!this->auto_baud_) {
+    return;
+  }
+
+  // Start from the stored baud rate, or the configured one on the first boot
+  this->auto_baud_pref_ =
+      global_preferences->make_preference<uint32_t>(this->get_object_id_hash() ^ MEL_AUTO_BAUD_PREF_KEY);
+  uint32_t baud_rate = this->parent_->get_baud_rate();
+  if (this->auto_baud_pref_.load(&this->auto_baud_saved_)) {
+    baud_rate = this->auto_baud_saved_;
+  }
+
+  int count{std::extent<decltype(MEL_SUPPORTED_BAUD_RATES)>::value};
+  for (int i = 0; i < count; i++) {
+    if (MEL_SUPPORTED_BAUD_RATES[i] == baud_rate) {
+      this->auto_baud_index_ = i;
+    }
+  }
+  this->auto_baud_apply(this->auto_baud_index_);
+  this->auto_baud_attempts_ = 0;
+}
+
+void MelAirConditioner::loop() {
+  // In event driven mode update() is not scheduled, it runs only from here when work is due
+  if (!this->event_driven_) {
+    return;
+  }
+
+  const uint32_t now = millis();
+  if (this->is_update_due(now)) {
+    this->update();
+  }
+
+  // The main loop may sleep up to 16ms between iterations. Keep it running while the response is expected, so the
+  // next request is chained as soon as the response completes, and during the inter-frame gap.
+  if (this->conn_.is_response_due(now) || !this->conn_.is_frame_gap_elapsed(now)) {
+    this->high_freq_.start();
+  } else {
+    this->high_freq_.stop();
+  }
 }
 
 void MelAirConditioner::update() {
@@ -562,14 +1334,39 @@ void MelAirConditioner::update() {
     return;
   }
 
+  this->profiler_.begin();
+
   this->conn_.tick();
+  this->profiler_.mark(MEL_AC_PROFILE_PHASE_TICK);
+  this->do_publish_stats();
+  this->profiler_.mark(MEL_AC_PROFILE_PHASE_STATS);
   if (this->conn_.is_busy()) {
+    this->profiler_.end();
     return;
   }
 
   this->process_response();
+  this->profiler_.mark(MEL_AC_PROFILE_PHASE_PROCESS);
+
+  // Some units need a pause between their response and the next request
+  if (!this->conn_.is_frame_gap_elapsed(millis())) {
+    this->profiler_.end();
+    return;
+  }
+
   this->do_connect();
+  this->profiler_.mark(MEL_AC_PROFILE_PHASE_CONNECT);
   this->do_poll();
+  this->profiler_.mark(MEL_AC_PROFILE_PHASE_POLL);
+
+  this->profiler_.end();
+}
+
+void MelAirConditioner::set_event_driven(bool value) {
+  this->event_driven_ = value;
+  if (value) {
+    this->set_update_interval(SCHEDULER_DONT_RUN);
+  }
 }
 
 void MelAirConditioner::set_supported_modes(climate::ClimateModeMask modes) {
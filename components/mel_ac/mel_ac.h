@@ -1,18 +1,43 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 
 #include "esphome/core/component.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/climate/climate.h"
 #include "esphome/components/uart/uart.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_BINARY_SENSOR
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#endif
 
 #include "mel_conn.h"
+#include "mel_profiler.h"
 
 namespace esphome {
 namespace mel {
 namespace ac {
 
 static const uint32_t MEL_SUPPORTED_BAUD_RATES[] = {2400, 4800, 9600};
+static const uint8_t MEL_AUTO_BAUD_ATTEMPTS = 2;            // CONNECT attempts at each baud rate before the next one
+static const uint32_t MEL_AUTO_BAUD_PREF_KEY = 0x4D454C42;  // Mixed into the object id hash of the stored baud rate
+
+static const uint8_t MEL_CONNECT_FAST_ATTEMPTS = 6;     // CONNECT attempts without backoff, covers every baud rate
+static const uint32_t MEL_CONNECT_BACKOFF_MIN = 2000;   // Time in ms between CONNECT attempts after the fast ones
+static const uint32_t MEL_CONNECT_BACKOFF_MAX = 60000;  // Longest time in ms between CONNECT attempts
+static const uint8_t MEL_CONNECT_JITTER_PERCENT = 25;   // Random delay added to the backoff
+static const uint8_t MEL_RECONNECT_TIMEOUTS = 5;        // Consecutive response timeouts before reconnecting
+
+static const float MEL_ROOM_TEMPERATURE_MIN = 10.0f;  // Range of the room temperature SET_TEMP can report
+static const float MEL_ROOM_TEMPERATURE_MAX = 40.0f;
+
+static const uint8_t MEL_SCHEDULER_SLOTS = 8;      // Units that take part in the shared scheduling
+static const uint8_t MEL_SCHEDULER_PHASES = 4;     // Poll cycles of the units are spread over this many phases
+static const uint32_t MEL_SCHEDULER_CYCLE = 1000;  // Time in ms the poll budget applies to
 
 // Temperature Limits
 static const uint8_t MEL_AC_TEMP_MIN = 16;  // Minimum Temperature in Celsius
@@ -20,13 +45,45 @@ static const uint8_t MEL_AC_TEMP_MAX = 31;  // Maximum Temperature in Celsius
 static const uint8_t MEL_AC_TEMP_DEF = 25;  // Default Temperature in Celsius
 static const float MEL_AC_TEMP_STEP = 0.5;  // Temperature step size in Celsius
 
+static const uint32_t MEL_DEFAULT_STATS_INTERVAL = 60000;  // Time in ms between link statistics updates
+
+// Index of each poll category in the per-category arrays, and the bit of its MEL_POLL_* flag
+static const uint8_t MEL_POLL_INDEX_PARAMS = 0;
+static const uint8_t MEL_POLL_INDEX_TEMP = 1;
+static const uint8_t MEL_POLL_INDEX_STATUS = 2;
+static const uint8_t MEL_POLL_CATEGORY_COUNT = 3;
+
 static const uint32_t MEL_POLL_NONE = 0;
-static const uint32_t MEL_POLL_GET_PARAMS = (1 << 0);
-static const uint32_t MEL_POLL_GET_TEMP = (1 << 1);
-static const uint32_t MEL_POLL_GET_STATUS = (1 << 2);
+static const uint32_t MEL_POLL_GET_PARAMS = (1 << MEL_POLL_INDEX_PARAMS);
+static const uint32_t MEL_POLL_GET_TEMP = (1 << MEL_POLL_INDEX_TEMP);
+static const uint32_t MEL_POLL_GET_STATUS = (1 << MEL_POLL_INDEX_STATUS);
 
 static const uint32_t MEL_POLL_ALL = MEL_POLL_GET_PARAMS | MEL_POLL_GET_TEMP | MEL_POLL_GET_STATUS;
 
+static const uint8_t MEL_SET_MAX_RETRY = 5;             // Failed SET requests before the fields are dropped
+static const uint32_t MEL_SET_RETRY_DELAY_MIN = 1000;   // Backoff in ms after the first failed SET request
+static const uint32_t MEL_SET_RETRY_DELAY_MAX = 30000;  // Longest backoff in ms between SET requests
+
+static const uint8_t MEL_CONFIRM_MAX_RETRY = 3;  // SET requests re-issued when the unit did not apply the fields
+
+static const uint32_t MEL_DEFAULT_FAST_FOLLOW_WINDOW = 30000;  // Time in ms all categories refresh at the max rate
+
+// Fields of MelAcParams, flagged when a response changes them
+static const uint16_t MEL_AC_FIELD_POWER = (1 << 0);
+static const uint16_t MEL_AC_FIELD_MODE = (1 << 1);
+static const uint16_t MEL_AC_FIELD_FAN = (1 << 2);
+static const uint16_t MEL_AC_FIELD_VANE_VERT = (1 << 3);
+static const uint16_t MEL_AC_FIELD_VANE_HORZ = (1 << 4);
+static const uint16_t MEL_AC_FIELD_TEMPERATURE_TARGET = (1 << 5);
+static const uint16_t MEL_AC_FIELD_TEMPERATURE_CURRENT = (1 << 6);
+static const uint16_t MEL_AC_FIELD_COMPRESSOR = (1 << 7);
+static const uint16_t MEL_AC_FIELD_ALL = 0x00FF;
+static const uint16_t MEL_AC_FIELD_REFRESH = (1 << 8);  // Publish even when the climate state did not change
+
+// Fields the climate mode and action are derived from
+static const uint16_t MEL_AC_FIELD_ACTION = MEL_AC_FIELD_POWER | MEL_AC_FIELD_MODE | MEL_AC_FIELD_COMPRESSOR |
+                                            MEL_AC_FIELD_TEMPERATURE_TARGET | MEL_AC_FIELD_TEMPERATURE_CURRENT;
+
 static const int MEL_GET_PARAMS_OFFSET_POWER = 3;
 static const int MEL_GET_PARAMS_OFFSET_MODE = 4;
 static const int MEL_GET_PARAMS_OFFSET_TEMPERATURE_1 = 5;
@@ -108,14 +165,81 @@ static const ParamMap<enum MelAcParamVaneHorz> MEL_AC_PARAM_VANE_HORZ_STR_MAP =
     {MEL_AC_PARAM_VANE_HORZ_RIGHT, "RIGHT"}, {MEL_AC_PARAM_VANE_HORZ_RIGHT_MAX, "RIGHT_MAX"},
     {MEL_AC_PARAM_VANE_HORZ_SPLIT, "SPLIT"}, {MEL_AC_PARAM_VANE_HORZ_SWING, "SWING"}};
 
+// Phases of update() timed by the loop profiler, TOTAL is the whole call
+enum MelAcProfilePhase {
+  MEL_AC_PROFILE_PHASE_TICK = 0,
+  MEL_AC_PROFILE_PHASE_STATS,
+  MEL_AC_PROFILE_PHASE_PROCESS,
+  MEL_AC_PROFILE_PHASE_CONNECT,
+  MEL_AC_PROFILE_PHASE_POLL,
+  MEL_AC_PROFILE_PHASE_TOTAL,
+  MEL_AC_PROFILE_PHASE_COUNT,
+};
+static const char *const MEL_AC_PROFILE_PHASE_NAMES[MEL_AC_PROFILE_PHASE_COUNT] = {
+    "TICK", "STATS", "PROCESS", "CONNECT", "POLL", "TOTAL",
+};
+
+// Loop profiler, compiled in with 'profile_loop: true'
+#ifdef USE_MEL_AC_PROFILER
+static const bool MEL_AC_PROFILER_ENABLED = true;
+#else
+static const bool MEL_AC_PROFILER_ENABLED = false;
+#endif
+
 enum MelAcTemperatureMode {
   MEL_AC_TEMP_MODE_1,  // Temperature in Celsius, (VALUE + 10)
   MEL_AC_TEMP_MODE_2,  // Temperature in Celsius, (VALUE & 0x7F) / 2
 };
 
+// Holds back small or frequent changes of an analog value, until it is stale
+class MelAnalogFilter {
+ protected:
+  float deadband_ = 0.0f;      // Smallest change that is taken
+  uint32_t min_interval_ = 0;  // Time in ms a taken value is kept at least
+  uint32_t max_interval_ = 0;  // Time in ms after which any value is taken, 0 to disable
+  float value_ = NAN;
+  uint32_t timestamp_ = 0;
+
+ public:
+  bool is_stale(uint32_t now) const {
+    return (this->max_interval_ != 0) && ((now - this->timestamp_) >= this->max_interval_);
+  }
+
+  // Returns true when 'value' would be taken
+  bool check(float value, uint32_t now) const {
+    if (std::isnan(this->value_) || this->is_stale(now)) {
+      return true;
+    }
+    return ((now - this->timestamp_) >= this->min_interval_) && (fabs(value - this->value_) >= this->deadband_);
+  }
+
+  // Returns true when 'value' is taken
+  bool apply(float value, uint32_t now) {
+    if (!this->check(value, now)) {
+      return false;
+    }
+    this->value_ = value;
+    this->timestamp_ = now;
+    return true;
+  }
+
+  // Take the next value whatever it is
+  void reset(void) { this->value_ = NAN; }
+
+  float get_value(void) const { return this->value_; }
+  float get_deadband(void) const { return this->deadband_; }
+  uint32_t get_min_interval(void) const { return this->min_interval_; }
+  uint32_t get_max_interval(void) const { return this->max_interval_; }
+  void set_deadband(float value) { this->deadband_ = value; }
+  void set_min_interval(uint32_t value) { this->min_interval_ = value; }
+  void set_max_interval(uint32_t value) { this->max_interval_ = value; }
+
+  MelAnalogFilter(){};
+};
+
 class MelAcParams {
  protected:
-  bool updated_ = true;
+  uint16_t updated_ = MEL_AC_FIELD_ALL;  // MEL_AC_FIELD_* changed since the last publish
 
   MelAcParamPower power_ = MEL_AC_PARAM_POWER_OFF;
   MelAcParamISee isee_ = MEL_AC_PARAM_ISEE_OFF;  // iSee sensor status (read-only)
@@ -131,10 +255,10 @@ class MelAcParams {
   uint8_t compressor_frequency_ = 0;
 
  protected:
-  template<typename T> bool update(T &value_store, T &new_value, bool synced = true) {
-    // If value has changed, set 'updated' flag if 'synced' is 'true' and update the value store
+  template<typename T> bool update(T &value_store, T &new_value, uint16_t field = 0) {
+    // If value has changed, flag 'field' as updated and update the value store, 0 for values that are not published
     if (value_store != new_value) {
-      this->updated_ |= synced;
+      this->updated_ |= field;
       value_store = new_value;
     }
     return true;
@@ -143,13 +267,15 @@ class MelAcParams {
   template<typename T> bool is_valid(const ParamMap<T> m, const uint8_t v) { return m.find((T) v) != m.end(); }
 
  public:
-  bool is_updated(void) { return this->updated_; }
-  void clear_updated(void) { this->updated_ = false; }
+  bool is_updated(void) { return this->updated_ != 0; }
+  uint16_t get_updated(void) { return this->updated_; }
+  void set_updated(uint16_t fields) { this->updated_ |= fields; }
+  void clear_updated(void) { this->updated_ = 0; }
 
   // POWER
   MelAcParamPower get_power(void) { return this->power_; }
   std::string get_power_name(void) { return MEL_AC_PARAM_POWER_STR_MAP.find(this->power_)->second; }
-  bool set_power(MelAcParamPower value) { return this->update(this->power_, value); }
+  bool set_power(MelAcParamPower value) { return this->update(this->power_, value, MEL_AC_FIELD_POWER); }
   bool set_power(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_POWER_STR_MAP, value))
       return this->set_power((MelAcParamPower) value);
@@ -159,7 +285,7 @@ class MelAcParams {
   // ISEE
   MelAcParamISee get_isee(void) { return this->isee_; }
   std::string get_isee_name(void) { return MEL_AC_PARAM_ISEE_STR_MAP.find(this->isee_)->second; }
-  bool set_isee(MelAcParamISee value) { return this->update(this->isee_, value, false); }
+  bool set_isee(MelAcParamISee value) { return this->update(this->isee_, value); }
   bool set_isee(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_ISEE_STR_MAP, value))
       return this->set_isee((MelAcParamISee) value);
@@ -169,7 +295,7 @@ class MelAcParams {
   // MODE
   MelAcParamMode get_mode(void) { return this->mode_; }
   std::string get_mode_name(void) { return MEL_AC_PARAM_MODE_STR_MAP.find(this->mode_)->second; }
-  bool set_mode(MelAcParamMode value) { return this->update(this->mode_, value); }
+  bool set_mode(MelAcParamMode value) { return this->update(this->mode_, value, MEL_AC_FIELD_MODE); }
   bool set_mode(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_MODE_STR_MAP, value))
       return this->set_mode((MelAcParamMode) value);
@@ -179,7 +305,7 @@ class MelAcParams {
   // FAN
   MelAcParamFan get_fan(void) { return this->fan_; }
   std::string get_fan_name(void) { return MEL_AC_PARAM_FAN_STR_MAP.find(this->fan_)->second; }
-  bool set_fan(MelAcParamFan value) { return this->update(this->fan_, value); }
+  bool set_fan(MelAcParamFan value) { return this->update(this->fan_, value, MEL_AC_FIELD_FAN); }
   bool set_fan(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_FAN_STR_MAP, value))
       return this->set_fan((MelAcParamFan) value);
@@ -189,7 +315,7 @@ class MelAcParams {
   // VANE VERT
   MelAcParamVaneVert get_vane_vert(void) { return this->vane_vert_; }
   std::string get_vane_vert_name(void) { return MEL_AC_PARAM_VANE_VERT_STR_MAP.find(this->vane_vert_)->second; }
-  bool set_vane_vert(MelAcParamVaneVert value) { return this->update(this->vane_vert_, value); }
+  bool set_vane_vert(MelAcParamVaneVert value) { return this->update(this->vane_vert_, value, MEL_AC_FIELD_VANE_VERT); }
   bool set_vane_vert(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_VANE_VERT_STR_MAP, value))
       return this->set_vane_vert((MelAcParamVaneVert) value);
@@ -199,7 +325,7 @@ class MelAcParams {
   // VANE HORZ
   MelAcParamVaneHorz get_vane_horz(void) { return this->vane_horz_; }
   std::string get_vane_horz_name(void) { return MEL_AC_PARAM_VANE_HORZ_STR_MAP.find(this->vane_horz_)->second; }
-  bool set_vane_horz(MelAcParamVaneHorz value) { return this->update(this->vane_horz_, value); }
+  bool set_vane_horz(MelAcParamVaneHorz value) { return this->update(this->vane_horz_, value, MEL_AC_FIELD_VANE_HORZ); }
   bool set_vane_horz(uint8_t value) {
     if (this->is_valid(MEL_AC_PARAM_VANE_HORZ_STR_MAP, value))
       return this->set_vane_horz((MelAcParamVaneHorz) value);
@@ -212,30 +338,43 @@ class MelAcParams {
 
   // TEMPERATURE MODE
   MelAcTemperatureMode get_temperature_mode(void) { return this->temperature_mode_; }
-  void set_temperature_mode(MelAcTemperatureMode value) { this->update(this->temperature_mode_, value, false); }
+  void set_temperature_mode(MelAcTemperatureMode value) { this->update(this->temperature_mode_, value); }
 
   // TEMPERATURE TARGET
   float get_temperature_target(void) { return this->temperature_target_; }
-  void set_temperature_target(float value) { this->update(this->temperature_target_, value); }
+  void set_temperature_target(float value) {
+    this->update(this->temperature_target_, value, MEL_AC_FIELD_TEMPERATURE_TARGET);
+  }
 
   // TEMPERATURE CURRENT
   float get_temperature_current(void) { return this->temperature_current_; }
-  void set_temperature_current(float value) { this->update(this->temperature_current_, value); }
+  void set_temperature_current(float value) {
+    this->update(this->temperature_current_, value, MEL_AC_FIELD_TEMPERATURE_CURRENT);
+  }
 
   // COMPRESSOR OPERATING
   bool get_compressor_operating(void) { return this->compressor_operating_; }
-  void set_compressor_operating(bool value) { this->update(this->compressor_operating_, value); }
+  void set_compressor_operating(bool value) {
+    this->update(this->compressor_operating_, value, MEL_AC_FIELD_COMPRESSOR);
+  }
 
   // COMPRESSOR FREQUENCY
   uint8_t get_compressor_frequency(void) { return this->compressor_frequency_; }
-  void set_compressor_frequency(uint8_t value) { this->update(this->compressor_frequency_, value, false); }
+  void set_compressor_frequency(uint8_t value) { this->update(this->compressor_frequency_, value); }
 
   MelAcParams(){};
 };
 
 class MelAcSetParams {
  protected:
-  bool pending_;
+  uint16_t dirty_ = 0;            // Fields to send, as MEL_COMMAND_SET_* bits
+  uint16_t in_flight_ = 0;        // Fields sent and waiting for the SET acknowledgement
+  uint16_t unconfirmed_ = 0;      // Fields acknowledged and waiting to be read back from the unit
+  uint16_t dropped_ = 0;          // Fields given up by the last failed SET request that exhausted the retries
+  uint8_t confirm_count_ = 0;     // SET requests re-issued because the read back did not match
+  uint8_t retry_count_ = 0;       // Consecutive failed SET requests
+  uint32_t retry_timestamp_ = 0;  // Time in ms of the last failure
+  uint32_t retry_delay_ = 0;      // Time in ms to wait after the last failure
 
   optional<MelAcParamPower> power_;
   optional<MelAcParamMode> mode_;
@@ -249,6 +388,7 @@ class MelAcSetParams {
   std::string get_power_name(void) { return MEL_AC_PARAM_POWER_STR_MAP.find(*this->power_)->second; }
   MelAcSetParams &set_power(MelAcParamPower value) {
     this->power_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_POWER;
     return *this;
   }
 
@@ -256,12 +396,14 @@ class MelAcSetParams {
   std::string get_mode_name(void) { return MEL_AC_PARAM_MODE_STR_MAP.find(*this->mode_)->second; }
   MelAcSetParams &set_mode(MelAcParamMode value) {
     this->mode_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_MODE;
     return *this;
   }
 
   const optional<float> &get_temperature() const { return this->temperature_; }
   MelAcSetParams &set_temperature(float value) {
     this->temperature_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_TEMPERATURE;
     return *this;
   }
 
@@ -269,6 +411,7 @@ class MelAcSetParams {
   std::string get_fan_name(void) { return MEL_AC_PARAM_FAN_STR_MAP.find(*this->fan_)->second; }
   MelAcSetParams &set_fan(MelAcParamFan value) {
     this->fan_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_FAN;
     return *this;
   }
 
@@ -276,6 +419,7 @@ class MelAcSetParams {
   std::string get_vane_vert_name(void) { return MEL_AC_PARAM_VANE_VERT_STR_MAP.find(*this->vane_vert_)->second; }
   MelAcSetParams &set_vane_vert(MelAcParamVaneVert value) {
     this->vane_vert_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_VANE_VERT;
     return *this;
   }
 
@@ -283,82 +427,321 @@ class MelAcSetParams {
   std::string get_vane_horz_name(void) { return MEL_AC_PARAM_VANE_HORZ_STR_MAP.find(*this->vane_horz_)->second; }
   MelAcSetParams &set_vane_horz(MelAcParamVaneHorz value) {
     this->vane_horz_ = value;
+    this->dirty_ |= conn::MEL_COMMAND_SET_VANE_HORZ;
     return *this;
   }
 
-  void reset(void) {
-    this->power_.reset();
-    this->mode_.reset();
-    this->temperature_.reset();
-    this->fan_.reset();
-    this->vane_vert_.reset();
-    this->vane_horz_.reset();
+  // Clear the values of 'fields' that are not waiting to be sent, acknowledged or confirmed
+  void reset(uint16_t fields = 0xFFFF) {
+    fields &= ~(this->dirty_ | this->in_flight_ | this->unconfirmed_);
+    if (fields & conn::MEL_COMMAND_SET_POWER)
+      this->power_.reset();
+    if (fields & conn::MEL_COMMAND_SET_MODE)
+      this->mode_.reset();
+    if (fields & conn::MEL_COMMAND_SET_TEMPERATURE)
+      this->temperature_.reset();
+    if (fields & conn::MEL_COMMAND_SET_FAN)
+      this->fan_.reset();
+    if (fields & conn::MEL_COMMAND_SET_VANE_VERT)
+      this->vane_vert_.reset();
+    if (fields & conn::MEL_COMMAND_SET_VANE_HORZ)
+      this->vane_horz_.reset();
   }
 
-  bool is_pending(void) { return this->pending_; }
-  void set_pending(bool value) { this->pending_ = value; }
+  uint16_t get_dirty(void) const { return this->dirty_; }
+  void clear_dirty(uint16_t fields) {
+    this->dirty_ &= ~fields;
+    this->reset(fields);
+  }
+
+  // Fields are sent once the backoff of the last failure has elapsed
+  bool is_pending(uint32_t now) const {
+    return (this->dirty_ != 0) && ((now - this->retry_timestamp_) >= this->retry_delay_);
+  }
+  bool is_in_flight(void) const { return this->in_flight_ != 0; }
+  uint16_t get_in_flight(void) const { return this->in_flight_; }
+  bool is_idle(void) const { return (this->dirty_ | this->in_flight_ | this->unconfirmed_) == 0; }
+  uint16_t get_unconfirmed(void) const { return this->unconfirmed_; }
+  uint8_t get_confirm_count(void) const { return this->confirm_count_; }
+  uint8_t get_retry_count(void) const { return this->retry_count_; }
+  uint32_t get_retry_delay(void) const { return this->retry_delay_; }
+  uint16_t get_dropped(void) const { return this->dropped_; }
+
+  void start(uint16_t fields) {
+    this->in_flight_ = fields;
+    this->dirty_ &= ~fields;
+  }
+
+  void acknowledge(void) {
+    this->unconfirmed_ |= this->in_flight_;
+    this->in_flight_ = 0;
+    this->retry_count_ = 0;
+    this->retry_delay_ = 0;
+  }
+
+  void confirm(uint16_t fields) {
+    this->unconfirmed_ &= ~fields;
+    this->reset(fields);
+    if (this->is_idle()) {
+      this->confirm_count_ = 0;
+    }
+  }
+
+  // Send the fields the unit did not apply again, returns false once the retry budget is spent
+  bool reissue(uint16_t fields) {
+    this->unconfirmed_ &= ~fields;
+    if (++this->confirm_count_ > MEL_CONFIRM_MAX_RETRY) {
+      this->confirm_count_ = 0;
+      this->reset(fields);
+      return false;
+    }
+    this->dirty_ |= fields;
+    return true;
+  }
+
+  // Re-arm the fields in flight with exponential backoff, returns false once the retries are exhausted. The failed
+  // fields are then dropped, fields changed again while in flight keep their new value and are sent right away.
+  bool fail(uint32_t now) {
+    const uint16_t failed = this->in_flight_ & ~this->dirty_;
+    this->dirty_ |= this->in_flight_;
+    this->in_flight_ = 0;
+    if (++this->retry_count_ > MEL_SET_MAX_RETRY) {
+      this->dropped_ = failed;
+      this->dirty_ &= ~failed;
+      this->reset(failed);
+      if (this->is_idle()) {
+        this->confirm_count_ = 0;
+      }
+      this->retry_count_ = 0;
+      this->retry_delay_ = 0;
+      return false;
+    }
+    this->retry_timestamp_ = now;
+    this->retry_delay_ = std::min(MEL_SET_RETRY_DELAY_MIN << (this->retry_count_ - 1), MEL_SET_RETRY_DELAY_MAX);
+    return true;
+  }
 
   MelAcSetParams(){};
 };
 
+class MelAirConditioner;
+
+/**
+ * Shares the UARTs of one device between its units. Poll requests are granted
+ * in turn to the units waiting for one, within a limit on the requests
+ * outstanding and a budget of poll requests per scheduler cycle. Controls and
+ * CONNECT do not go through the scheduler.
+ */
+class MelScheduler {
+ protected:
+  MelAirConditioner *units_[MEL_SCHEDULER_SLOTS];
+  uint8_t unit_count_ = 0;
+  uint8_t waiting_ = 0;  // Bit per unit refused a poll request since its last grant
+  uint8_t next_ = 0;     // Unit with the first turn for the next poll request
+
+  uint8_t max_in_flight_ = 0;     // Requests that may be outstanding over all units, 0 for no limit
+  uint8_t poll_budget_ = 0;       // Poll requests that may start in one cycle, 0 for no limit
+  uint8_t cycle_granted_ = 0;     // Poll requests started in the running cycle
+  uint32_t cycle_timestamp_ = 0;  // Start of the running cycle
+  uint32_t deferred_ = 0;         // Poll requests refused since boot
+
+ public:
+  uint8_t add(MelAirConditioner *unit);
+  bool acquire(uint8_t index, uint32_t now);
+  void release(uint8_t index);
+
+  uint8_t get_in_flight(void) const;
+  uint8_t get_unit_count(void) const { return this->unit_count_; }
+  uint8_t get_max_in_flight(void) const { return this->max_in_flight_; }
+  uint8_t get_poll_budget(void) const { return this->poll_budget_; }
+  uint32_t get_deferred(void) const { return this->deferred_; }
+
+  void set_max_in_flight(uint8_t value) { this->max_in_flight_ = value; }
+  void set_poll_budget(uint8_t value) { this->poll_budget_ = value; }
+};
+
+extern MelScheduler mel_scheduler;  // Shared by all units on this device
+
 class MelAirConditioner : public PollingComponent, public uart::UARTDevice, public climate::Climate {
  protected:
   uint32_t startup_delay_ = 0;
+  bool event_driven_ = false;  // Run update() from loop() only when work is due
+  bool optimistic_ = true;     // Show a control in the climate state before the unit confirms it
+
+  bool auto_baud_ = false;          // Cycle the supported baud rates until the unit responds
+  bool auto_baud_locked_ = false;   // A response was received at the current baud rate
+  uint8_t auto_baud_index_ = 0;     // Index of the current baud rate in MEL_SUPPORTED_BAUD_RATES
+  uint8_t auto_baud_attempts_ = 0;  // CONNECT attempts at the current baud rate
+  uint32_t auto_baud_saved_ = 0;    // Baud rate stored in the preferences
+  ESPPreferenceObject auto_baud_pref_;
 
   climate::ClimateTraits traits_;
 
   conn::MelConnectionManager conn_;
+  HighFrequencyLoopRequester high_freq_;  // Event driven only, held while a response is due or the frame gap runs
+
+  uint8_t unit_index_ = MEL_SCHEDULER_SLOTS;  // Position in the scheduler, sets the poll phase
 
   bool ac_connected_ = false;
+  bool ac_state_published_ = false;       // The climate state was published at least once
+  uint32_t ac_connect_attempts_ = 0;      // CONNECT attempts since the link was lost
+  uint32_t ac_connect_timestamp_ = 0;     // Time in ms of the last CONNECT attempt
+  uint32_t ac_connect_delay_ = 0;         // Time in ms from the last CONNECT attempt to the next one
+  uint32_t ac_disconnect_timestamp_ = 0;  // Time in ms of the first CONNECT attempt since the link was lost
+  uint32_t ac_connect_time_ = 0;          // Time in ms the last connection took
+  uint8_t ac_timeout_count_ = 0;          // Consecutive response timeouts
 
   uint32_t ac_poll_flag_ = MEL_POLL_ALL;
-  uint32_t ac_poll_timestamp_ = 0;
-  uint32_t ac_poll_refresh_rate_ = 2000;
+  uint32_t ac_poll_refresh_rate_ = 2000;                          // Fastest refresh rate, used in fast follow
+  uint32_t ac_poll_refresh_rates_[MEL_POLL_CATEGORY_COUNT] = {};  // Refresh rate per category, 0 for the max rate
+  uint32_t ac_poll_timestamps_[MEL_POLL_CATEGORY_COUNT] = {};     // Last time each category was polled
+  uint32_t ac_fast_follow_window_ = MEL_DEFAULT_FAST_FOLLOW_WINDOW;
+  uint32_t ac_fast_follow_timestamp_ = 0;  // Start of the last fast follow window
+  bool ac_fast_follow_ = false;            // True while the fast follow window is open
+
+  uint32_t ac_cycle_timestamp_ = 0;  // Start of the running poll cycle
+  uint32_t ac_cycle_time_ = 0;       // Time in ms the last poll cycle took
+  uint32_t ac_cycle_time_max_ = 0;
+  bool ac_cycle_running_ = false;  // True from the start of a poll cycle until every category was read
+
+  uint8_t ac_params_raw_[conn::MEL_COMMAND_BUFFER_SIZE];  // Last GET_PARAMS payload, to detect remote changes
+  uint8_t ac_params_raw_length_ = 0;
+  bool ac_params_fresh_ = false;  // GET_PARAMS was read after the last SET, required to suppress matching fields
 
   MelAcParams ac_params_;
   MelAcSetParams ac_set_params_;
+  MelAnalogFilter ac_temperature_filter_;  // Applied to the room temperature before it is published
+
+  // Room temperature reported to the unit with SET_TEMP, from an external sensor
+  MelAnalogFilter ac_room_temperature_filter_;        // Rate limits the SET_TEMP requests
+  float ac_room_temperature_ = NAN;                   // Last reading of the external sensor
+  uint32_t ac_room_temperature_timestamp_ = 0;        // Time in ms of the last reading
+  uint32_t ac_room_temperature_timeout_ = 600000;     // Time in ms without a reading before the unit sensor is used
+  float ac_room_temperature_sent_ = NAN;              // Value of the outstanding SET_TEMP, NAN to revert
+  bool ac_room_temperature_in_flight_ = false;        // A SET_TEMP is waiting for its acknowledgement
+  bool ac_room_temperature_active_ = false;           // The unit uses the external sensor
+  uint8_t ac_room_temperature_retry_count_ = 0;       // Consecutive failed SET_TEMP requests
+  uint32_t ac_room_temperature_retry_timestamp_ = 0;  // Time in ms of the last failure
+  uint32_t ac_room_temperature_retry_delay_ = 0;      // Time in ms to wait after the last failure
+
+  uint32_t ac_control_timestamp_ = 0;   // Time in ms of the control being confirmed
+  bool ac_control_confirming_ = false;  // True until the unit reports every field of the control
+  uint32_t ac_control_latency_ = 0;     // Time in ms from the last control to its confirmation
+  uint32_t ac_control_latency_max_ = 0;
+
+  uint32_t stats_interval_ = MEL_DEFAULT_STATS_INTERVAL;
+  uint32_t stats_timestamp_ = 0;
+  uint32_t stats_rtt_count_ = 0;  // Number of responses at the last statistics update
+  uint32_t stats_rtt_total_ = 0;  // Sum of the RTT at the last statistics update
+
+#ifdef USE_SENSOR
+  sensor::Sensor *timeouts_sensor_ = nullptr;
+  sensor::Sensor *checksum_errors_sensor_ = nullptr;
+  sensor::Sensor *version_errors_sensor_ = nullptr;
+  sensor::Sensor *mismatches_sensor_ = nullptr;
+  sensor::Sensor *response_time_sensor_ = nullptr;
+  sensor::Sensor *control_latency_sensor_ = nullptr;
+  sensor::Sensor *connect_time_sensor_ = nullptr;
+  sensor::Sensor *cycle_time_sensor_ = nullptr;
+  sensor::Sensor *room_temperature_sensor_ = nullptr;  // External room temperature source
+#endif
+#ifdef USE_BINARY_SENSOR
+  binary_sensor::BinarySensor *connected_binary_sensor_ = nullptr;
+#endif
+
+  // Time spent in each phase of update()
+  LoopProfiler<MEL_AC_PROFILE_PHASE_COUNT, MEL_AC_PROFILER_ENABLED> profiler_;
 
   MelAcParams &params() { return this->ac_params_; }
   MelAcSetParams &set_params() { return this->ac_set_params_; }
 
-  void set_connected(bool value) { this->ac_connected_ = value; }
+  void set_connected(bool value);
+  bool is_connect_due(uint32_t now) const {
+    return !this->ac_connected_ && ((now - this->ac_connect_timestamp_) >= this->ac_connect_delay_);
+  }
   bool get_connected(void) { return this->ac_connected_; }
 
-  void restart_poll(bool force = false) {
-    const uint32_t now = millis();
-    if (force || (now - this->ac_poll_timestamp_) > this->ac_poll_refresh_rate_) {
-      this->set_poll_flag(MEL_POLL_ALL);
-      this->ac_poll_timestamp_ = now;
-    }
-  }
+  uint32_t get_poll_refresh_rate(uint8_t category, uint32_t now);
+  uint32_t get_poll_due(uint32_t now);
+  void restart_poll(bool force = false);
+  void start_fast_follow(const char *reason);
 
   void set_poll_flag(uint32_t flag) { this->ac_poll_flag_ |= flag; }
   void clear_poll_flag(uint32_t flag) { this->ac_poll_flag_ &= ~flag; }
   bool check_poll_flag(uint32_t flag) { return (this->ac_poll_flag_ & flag) != 0; }
   bool check_poll_idle(void) { return (this->ac_poll_flag_ == MEL_POLL_NONE); }
 
+  bool is_update_due(uint32_t now);
+
   void request_connect(void);
   void request_params(void);
   void request_room_temperature(void);
   void request_status(void);
+  void request_set_room_temperature(float value);
 
   void process_response(void);
 
   void do_publish(void);
   bool do_control(void);
+  bool is_room_temperature_due(uint32_t now);
+  bool do_room_temperature(void);
+  void room_temperature_done(bool success);
+  uint16_t get_matching_fields(uint16_t fields);
+  void control_failed(const char *reason);
+  void control_dropped(void);
+  void do_confirm(void);
 
   void do_connect(void);
+  void do_cycle_done(void);
+  void auto_baud_apply(uint8_t index);
+  void auto_baud_lock(void);
   void do_poll(void);
+  void do_publish_stats(void);
 
   void control(const climate::ClimateCall &call) override;
   climate::ClimateTraits traits() override { return this->traits_; }
 
  public:
+  void setup() override;
   void dump_config() override;
+  void loop() override;
   void update() override;
 
+  void dump_trace(void);
+  bool is_request_in_flight(void) const { return this->conn_.is_busy(); }
+
   void set_poll_refresh_rate(uint32_t value) { this->ac_poll_refresh_rate_ = value; }
+  void set_params_refresh_rate(uint32_t value) { this->ac_poll_refresh_rates_[MEL_POLL_INDEX_PARAMS] = value; }
+  void set_temperature_refresh_rate(uint32_t value) { this->ac_poll_refresh_rates_[MEL_POLL_INDEX_TEMP] = value; }
+  void set_status_refresh_rate(uint32_t value) { this->ac_poll_refresh_rates_[MEL_POLL_INDEX_STATUS] = value; }
+  void set_fast_follow_window(uint32_t value) { this->ac_fast_follow_window_ = value; }
   void set_startup_delay(uint32_t value) { this->startup_delay_ = value; }
+  void set_stats_interval(uint32_t value) { this->stats_interval_ = value; }
+  void set_event_driven(bool value);
+  void set_min_frame_gap(uint32_t value) { this->conn_.set_min_frame_gap(value); }
+  void set_optimistic(bool value) { this->optimistic_ = value; }
+  void set_auto_baud(bool value) { this->auto_baud_ = value; }
+  void set_temperature_deadband(float value) { this->ac_temperature_filter_.set_deadband(value); }
+  void set_temperature_min_interval(uint32_t value) { this->ac_temperature_filter_.set_min_interval(value); }
+  void set_temperature_max_staleness(uint32_t value) { this->ac_temperature_filter_.set_max_interval(value); }
+  void set_room_temperature_deadband(float value) { this->ac_room_temperature_filter_.set_deadband(value); }
+  void set_room_temperature_min_interval(uint32_t value) { this->ac_room_temperature_filter_.set_min_interval(value); }
+  void set_room_temperature_timeout(uint32_t value) { this->ac_room_temperature_timeout_ = value; }
+
+#ifdef USE_SENSOR
+  void set_timeouts_sensor(sensor::Sensor *sensor) { this->timeouts_sensor_ = sensor; }
+  void set_checksum_errors_sensor(sensor::Sensor *sensor) { this->checksum_errors_sensor_ = sensor; }
+  void set_version_errors_sensor(sensor::Sensor *sensor) { this->version_errors_sensor_ = sensor; }
+  void set_mismatches_sensor(sensor::Sensor *sensor) { this->mismatches_sensor_ = sensor; }
+  void set_response_time_sensor(sensor::Sensor *sensor) { this->response_time_sensor_ = sensor; }
+  void set_control_latency_sensor(sensor::Sensor *sensor) { this->control_latency_sensor_ = sensor; }
+  void set_connect_time_sensor(sensor::Sensor *sensor) { this->connect_time_sensor_ = sensor; }
+  void set_cycle_time_sensor(sensor::Sensor *sensor) { this->cycle_time_sensor_ = sensor; }
+  void set_room_temperature_sensor(sensor::Sensor *sensor) { this->room_temperature_sensor_ = sensor; }
+#endif
+#ifdef USE_BINARY_SENSOR
+  void set_connected_binary_sensor(binary_sensor::BinarySensor *sensor) { this->connected_binary_sensor_ = sensor; }
+#endif
 
   void set_supported_modes(climate::ClimateModeMask modes);
   void set_supported_fan_modes(climate::ClimateFanModeMask fan_modes);
@@ -1,6 +1,13 @@
+#include <cinttypes>
+#include <cstddef>
 #include "esphome/core/log.h"
 
 #include "mel_conn.h"
+#include "mel_trace_store.h"
+
+#ifdef USE_ESP32
+#include <esp_attr.h>
+#endif
 
 namespace esphome {
 namespace mel {
@@ -33,7 +40,7 @@ static const char *const TAG = "mel.conn";
 std::string MelConnectionManager::hex2str(const uint8_t *buffer, size_t length) {
   constexpr char hexmap[] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
   std::string str(length * 3, ' ');
-  for (int i = 0; i < length; ++i) {
+  for (size_t i = 0; i < length; ++i) {
     str[3 * i] = hexmap[(buffer[i] & 0xF0) >> 4];
     str[3 * i + 1] = hexmap[buffer[i] & 0x0F];
   }
@@ -45,7 +52,7 @@ std::string MelConnectionManager::hex2str(const uint8_t *buffer, size_t length)
  */
 uint8_t MelConnectionManager::calculate_checksum(const uint8_t *buffer, size_t length) {
   uint8_t sum = 0;
-  for (int i = 0; i < length; i++) {
+  for (size_t i = 0; i < length; i++) {
     sum += buffer[i];
   }
   return (MEL_COMMAND_START - sum);
@@ -59,6 +66,12 @@ void MelConnectionManager::receiver_check_timeout(const uint32_t now) {
       ESP_LOGVV(TAG, "RX> Response timeout after %d ms", elapsed);
       this->state_waiting_response_ = false;
       this->state_response_timeout_ = true;
+      this->stats_.timeouts++;
+      this->trace_record(MEL_TRACE_TIMEOUT, nullptr);
+      auto *entry = this->journal_last();
+      if (entry != nullptr) {
+        entry->result = MEL_JOURNAL_RESULT_TIMEOUT;
+      }
     }
   }
 }
@@ -105,6 +118,7 @@ void MelConnectionManager::receiver_process_byte(uint8_t byte) {
   if ((cmd->version_major != MEL_COMMAND_VERSION_MAJOR) && (cmd->version_minor != MEL_COMMAND_VERSION_MINOR)) {
     ESP_LOGW(TAG, "RX> Invalid version: got=%d.%d, exp=%d.%d", cmd->version_major, cmd->version_minor,
              MEL_COMMAND_VERSION_MAJOR, MEL_COMMAND_VERSION_MINOR);
+    this->stats_.version_errors++;
     this->receiver_reset_states();
     return;
   }
@@ -121,6 +135,7 @@ void MelConnectionManager::receiver_process_byte(uint8_t byte) {
   uint8_t checksum = cmd->payload[cmd->length];
   if (checksum != checksum_exp) {
     ESP_LOGW(TAG, "RX> Invalid checksum: got=0x%02X, exp=0x%02X", checksum, checksum_exp);
+    this->stats_.checksum_errors++;
     this->receiver_reset_states();
     return;
   }
@@ -134,6 +149,14 @@ void MelConnectionManager::receiver_process_byte(uint8_t byte) {
 
   // A valid command was received, reset the receiver states
   this->receiver_reset_states();
+  this->rx_frame_timestamp_ = now;
+  this->trace_record(MEL_TRACE_RX, cmd);
+
+  // Drop responses that do not belong to the outstanding request, keep waiting for the right one
+  if (!this->journal_match_response(cmd, now)) {
+    return;
+  }
+
   this->state_waiting_response_ = false;
   this->state_response_pending_ = true;
 }
@@ -152,6 +175,7 @@ void MelConnectionManager::send_command(uint8_t flags, uint8_t *payload, uint8_t
   uint8_t checksum = this->calculate_checksum(this->tx_buffer_, command_length);
   this->tx_buffer_[command_length++] = checksum;
   this->uart_->write_array(this->tx_buffer_, command_length);
+  this->trace_record(MEL_TRACE_TX, cmd);
 
   ESP_LOGVV(TAG, "TX> Transmit:");
   ESP_LOGVV(TAG, "TX>   version: %d.%d", cmd->version_major, cmd->version_minor);
@@ -161,8 +185,287 @@ void MelConnectionManager::send_command(uint8_t flags, uint8_t *payload, uint8_t
   ESP_LOGVV(TAG, "TX>   checksum: %02X", checksum);
 
   this->tx_timestamp_ = millis();
+  this->response_time_ = ((command_length + MEL_RESPONSE_FRAME_SIZE) * this->byte_time_) / 1000;
   this->receiver_reset_states();
   this->state_waiting_response_ = true;
+  this->journal_record_request(cmd->flags, cmd->payload[0], this->tx_timestamp_);
+}
+
+/*******************************************************************************
+ * Trace
+ ******************************************************************************/
+
+#ifdef USE_ESP32
+static RTC_NOINIT_ATTR struct MelTraceStore mel_trace_stores[MEL_TRACE_STORE_SLOTS];
+static uint8_t mel_trace_store_count = 0;  // Number of slots assigned to instances
+#endif
+
+/**
+ * Assign a trace slot to this instance. A valid trace left in the slot by the
+ * previous boot is copied out before the slot is reset.
+ */
+void MelConnectionManager::trace_setup(void) {
+#ifdef USE_ESP32
+  this->trace_ = trace_store_assign(mel_trace_stores, mel_trace_store_count, MEL_TRACE_STORE_MAGIC,
+                                    this->recovered_trace_);
+#endif
+  if (this->trace_ == nullptr) {
+    this->trace_ = new MelTraceStore();  // Not persistent, no RTC memory or too many instances
+  }
+}
+
+/**
+ * The RTC memory does not survive a power loss or a brownout. When it held no
+ * trace, report the snapshot last saved to flash instead. Needs the preferences,
+ * call from setup().
+ */
+void MelConnectionManager::trace_snapshot_load(void) {
+#ifdef USE_ESP32
+  const ptrdiff_t slot = this->trace_ - mel_trace_stores;
+  if ((slot < 0) || (slot >= MEL_TRACE_STORE_SLOTS)) {
+    return;
+  }
+
+  this->trace_snapshot_pref_ = global_preferences->make_preference<MelTraceStore>(MEL_TRACE_SNAPSHOT_KEY + slot, true);
+  if (this->recovered_trace_ != nullptr) {
+    return;
+  }
+
+  std::unique_ptr<MelTraceStore> snapshot(new MelTraceStore());
+  if (this->trace_snapshot_pref_.load(snapshot.get()) && trace_store_valid(*snapshot, MEL_TRACE_STORE_MAGIC)) {
+    this->recovered_trace_ = std::move(snapshot);
+    this->trace_snapshot_loaded_ = true;
+  }
+#endif
+}
+
+/**
+ * Copy the trace to flash, at most every MEL_TRACE_SNAPSHOT_INTERVAL to limit
+ * the flash wear. The write happens at the next sync of the preferences.
+ */
+bool MelConnectionManager::trace_snapshot_save(void) {
+#ifdef USE_ESP32
+  const uint32_t now = millis();
+  if (this->trace_snapshot_saved_ && ((now - this->trace_snapshot_timestamp_) < MEL_TRACE_SNAPSHOT_INTERVAL)) {
+    return false;
+  }
+  if (this->trace_snapshot_pref_.save(this->trace_)) {
+    this->trace_snapshot_saved_ = true;
+    this->trace_snapshot_timestamp_ = now;
+    return true;
+  }
+#endif
+  return false;
+}
+
+void MelConnectionManager::trace_record(enum MelTraceType type, const struct MelCommand *cmd) {
+  auto &trace = *this->trace_;
+  auto &entry = trace.entries[trace.head];
+  entry.timestamp = millis();
+  entry.type = type;
+  entry.flags = 0;
+  entry.length = 0;
+  if (cmd != nullptr) {
+    entry.flags = cmd->flags;
+    entry.length = cmd->length;
+    memcpy(entry.payload, cmd->payload, std::min(cmd->length, MEL_TRACE_PAYLOAD_SIZE));
+  }
+  trace_store_commit(trace);
+}
+
+/**
+ * Record a connection or control event. The payload keeps the control fields
+ * and a time in ms, and the length is 0 as no frame is attached.
+ */
+void MelConnectionManager::trace_event(enum MelTraceType type, uint8_t count, uint16_t fields, uint32_t time) {
+  auto &trace = *this->trace_;
+  auto &entry = trace.entries[trace.head];
+  entry.timestamp = millis();
+  entry.type = type;
+  entry.flags = count;
+  entry.length = 0;
+  memcpy(&entry.payload[0], &fields, sizeof(fields));
+  memcpy(&entry.payload[sizeof(fields)], &time, sizeof(time));
+  trace_store_commit(trace);
+}
+
+/**
+ * Log the trace ring, oldest entry first. Safe to call from a lambda.
+ */
+void MelConnectionManager::dump_trace(const char *tag) {
+  ESP_LOGI(tag, "TRACE> %d entries, now=%" PRIu32 " ms", this->trace_->count, millis());
+  this->trace_print(tag, *this->trace_);
+}
+
+void MelConnectionManager::dump_recovered_trace(const char *tag) {
+#ifdef USE_ESP32
+  if (this->trace_snapshot_loaded_) {
+    ESP_LOGW(tag, "TRACE> Snapshot from flash of the last reconnect, reset reason: %s", get_reset_reason_name());
+    this->trace_print(tag, *this->recovered_trace_);
+  } else if (this->recovered_trace_ != nullptr) {
+    ESP_LOGW(tag, "TRACE> Recovered trace of the previous boot, reset reason: %s", get_reset_reason_name());
+    this->trace_print(tag, *this->recovered_trace_);
+  }
+#endif
+}
+
+void MelConnectionManager::trace_print(const char *tag, const struct MelTraceStore &trace) {
+  for (int i = 0; i < trace.count; i++) {
+    auto &entry = trace.entries[(trace.head + MEL_TRACE_SIZE - trace.count + i) % MEL_TRACE_SIZE];
+    if (entry.check != trace_entry_check(entry)) {
+      ESP_LOGI(tag, "TRACE> (corrupted entry)");
+      continue;
+    }
+
+    // Events keep the control fields and a time in the payload, see trace_event()
+    uint16_t fields;
+    uint32_t time;
+    memcpy(&fields, &entry.payload[0], sizeof(fields));
+    memcpy(&time, &entry.payload[sizeof(fields)], sizeof(time));
+
+    switch (entry.type) {
+      case MEL_TRACE_RX:
+      case MEL_TRACE_TX: {
+        // Format the kept payload without allocating
+        static const char hexmap[] = "0123456789ABCDEF";
+        char data_str[(3 * MEL_TRACE_PAYLOAD_SIZE) + 1];
+        const uint8_t length = std::min(entry.length, MEL_TRACE_PAYLOAD_SIZE);
+        for (int j = 0; j < length; j++) {
+          data_str[(3 * j) + 0] = hexmap[entry.payload[j] >> 4];
+          data_str[(3 * j) + 1] = hexmap[entry.payload[j] & 0x0F];
+          data_str[(3 * j) + 2] = ' ';
+        }
+        data_str[3 * length] = '\0';
+
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " %s FLAGS=%02X LEN=%-2d %s%s", entry.timestamp,
+                 (entry.type == MEL_TRACE_RX) ? "RX" : "TX", entry.flags, entry.length, data_str,
+                 (entry.length > MEL_TRACE_PAYLOAD_SIZE) ? "..." : "");
+      } break;
+
+      case MEL_TRACE_TIMEOUT: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " TIMEOUT", entry.timestamp);
+      } break;
+
+      case MEL_TRACE_CONNECT: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " CONNECT after %u attempts in %" PRIu32 " ms", entry.timestamp,
+                 entry.flags, time);
+      } break;
+
+      case MEL_TRACE_DISCONNECT: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " DISCONNECT after %u timeouts", entry.timestamp, entry.flags);
+      } break;
+
+      case MEL_TRACE_CONTROL_RETRY: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " CONTROL RETRY %u FIELDS=%04X in %" PRIu32 " ms", entry.timestamp,
+                 entry.flags, fields, time);
+      } break;
+
+      case MEL_TRACE_CONTROL_REISSUE: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " CONTROL REISSUE %u FIELDS=%04X", entry.timestamp, entry.flags, fields);
+      } break;
+
+      case MEL_TRACE_CONTROL_DROP: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " CONTROL DROP FIELDS=%04X after %u attempts", entry.timestamp, fields,
+                 entry.flags);
+      } break;
+
+      default: {
+        ESP_LOGI(tag, "TRACE> %10" PRIu32 " (unknown entry type %u)", entry.timestamp, entry.type);
+      } break;
+    }
+  }
+}
+
+/*******************************************************************************
+ * Request Journal
+ ******************************************************************************/
+
+struct MelJournalEntry *MelConnectionManager::journal_last(void) {
+  if (this->journal_count_ == 0) {
+    return nullptr;
+  }
+  return &this->journal_[(this->journal_head_ + MEL_JOURNAL_SIZE - 1) % MEL_JOURNAL_SIZE];
+}
+
+void MelConnectionManager::journal_record_request(uint8_t flags, uint8_t type, uint32_t now) {
+  auto &entry = this->journal_[this->journal_head_];
+  entry.flags = flags;
+  entry.type = type;
+  entry.timestamp = now;
+  entry.rtt = 0;
+  entry.result = MEL_JOURNAL_RESULT_PENDING;
+
+  this->journal_head_ = (this->journal_head_ + 1) % MEL_JOURNAL_SIZE;
+  if (this->journal_count_ < MEL_JOURNAL_SIZE) {
+    this->journal_count_++;
+  }
+  this->stats_.requests++;
+}
+
+/**
+ * Check that a response belongs to the outstanding request. The response flags
+ * are the request flags with the IN bit set, GET responses also echo the type.
+ */
+bool MelConnectionManager::journal_match_response(const struct MelCommand *cmd, uint32_t now) {
+  auto *entry = this->journal_last();
+  if ((entry == nullptr) || (entry->result != MEL_JOURNAL_RESULT_PENDING)) {
+    ESP_LOGW(TAG, "RX> Unexpected response: flags=%02X, type=%02X", cmd->flags, cmd->payload[0]);
+    this->stats_.mismatches++;
+    return false;
+  }
+
+  const bool is_get = ((entry->flags & MEL_COMMAND_FLAGS_CONNECT) == MEL_COMMAND_FLAGS_GET);
+  if ((cmd->flags != (entry->flags | MEL_COMMAND_FLAGS_IN)) || (is_get && (cmd->payload[0] != entry->type))) {
+    ESP_LOGW(TAG, "RX> Response does not match request: got=%02X/%02X, exp=%02X/%02X", cmd->flags, cmd->payload[0],
+             entry->flags | MEL_COMMAND_FLAGS_IN, entry->type);
+    this->stats_.mismatches++;
+    return false;
+  }
+
+  entry->rtt = now - entry->timestamp;
+  entry->result = MEL_JOURNAL_RESULT_OK;
+  this->stats_.responses++;
+
+  uint8_t index = 0;
+  while ((index < (MEL_RTT_SLOTS - 1)) && (MEL_RTT_TYPES[index] != entry->type)) {
+    index++;
+  }
+  auto &rtt = this->rtt_stats_[index];
+  rtt.type = (index < (MEL_RTT_SLOTS - 1)) ? entry->type : MEL_RTT_TYPE_OTHER;
+  rtt.count++;
+  rtt.total += entry->rtt;
+  rtt.last = entry->rtt;
+  if (entry->rtt > rtt.max) {
+    rtt.max = entry->rtt;
+  }
+
+  return true;
+}
+
+void MelConnectionManager::dump_journal(const char *tag) {
+  const uint32_t now = millis();
+  const struct MelLinkStats &stats = this->stats_;
+
+  ESP_LOGCONFIG(tag, "  Link:");
+  ESP_LOGCONFIG(tag, "    Requests: %" PRIu32 ", Responses: %" PRIu32, stats.requests, stats.responses);
+  ESP_LOGCONFIG(tag, "    Errors: timeout=%" PRIu32 ", checksum=%" PRIu32 ", version=%" PRIu32 ", mismatch=%" PRIu32,
+                stats.timeouts, stats.checksum_errors, stats.version_errors, stats.mismatches);
+  for (auto &it : this->rtt_stats_) {
+    if (it.count == 0) {
+      continue;
+    }
+    ESP_LOGCONFIG(tag, "    RTT %02X: count=%" PRIu32 ", last=%" PRIu32 " ms, mean=%" PRIu32 " ms, max=%" PRIu32 " ms",
+                  it.type, it.count, it.last, it.total / it.count, it.max);
+  }
+
+  ESP_LOGCONFIG(tag, "  Journal (%d):", this->journal_count_);
+  static const char *const results[] = {"PENDING", "OK", "TIMEOUT"};
+  for (int i = 0; i < this->journal_count_; i++) {
+    const uint8_t index = (this->journal_head_ + MEL_JOURNAL_SIZE - this->journal_count_ + i) % MEL_JOURNAL_SIZE;
+    auto &entry = this->journal_[index];
+    ESP_LOGCONFIG(tag, "  - flags=%02X, type=%02X, sent=%" PRIu32 " ms ago, rtt=%" PRIu32 " ms, %s", entry.flags,
+                  entry.type, now - entry.timestamp, entry.rtt, results[entry.result]);
+  }
 }
 
 void MelConnectionManager::tick(void) {
@@ -174,7 +477,9 @@ void MelConnectionManager::tick(void) {
   // Process received bytes
   while (this->uart_->available()) {
     uint8_t byte;
-    this->uart_->read_byte(&byte);
+    if (!this->uart_->read_byte(&byte)) {
+      break;
+    }
     this->receiver_process_byte(byte);
   }
 }
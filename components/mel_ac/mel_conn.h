@@ -1,7 +1,10 @@
 #pragma once
 
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
 
+#include <memory>
+
 namespace esphome {
 namespace mel {
 namespace conn {
@@ -26,7 +29,19 @@ static const uint16_t MEL_COMMAND_SET_VANE_HORZ = 0x0100;
 static const uint8_t MEL_COMMAND_BUFFER_SIZE = 32;  // Max 26 bytes of data
 static const uint8_t MEL_COMMAND_CHECKSUM_SIZE = 1;
 
-static const uint32_t MEL_COMMAND_RECV_TIMEOUT = 1000;  // Max time in ms to wait for a complete command
+static const uint32_t MEL_COMMAND_RECV_TIMEOUT = 1000;   // Max time in ms to wait for a complete command
+static const uint8_t MEL_COMMAND_BITS_PER_BYTE = 11;     // Start bit, 8 data bits, even parity and stop bit
+static const uint8_t MEL_RESPONSE_FRAME_SIZE = 22;       // Header, 16 bytes of data and the checksum
+static const uint32_t MEL_RESPONSE_WINDOW_MARGIN = 100;  // Time in ms a response is expected past its transfer time
+
+static const uint8_t MEL_JOURNAL_SIZE = 8;  // Number of requests kept in the journal
+
+static const uint8_t MEL_TRACE_SIZE = 32;                    // Number of entries kept in the trace ring
+static const uint8_t MEL_TRACE_PAYLOAD_SIZE = 8;             // Number of payload bytes kept per entry
+static const uint8_t MEL_TRACE_STORE_SLOTS = 4;              // Number of instances whose trace survives a reset
+static const uint32_t MEL_TRACE_STORE_MAGIC = 0x4D545201;    // 'MTR' and the layout version
+static const uint32_t MEL_TRACE_SNAPSHOT_KEY = 0x4D545301;   // 'MTS' and the layout version, plus the slot index
+static const uint32_t MEL_TRACE_SNAPSHOT_INTERVAL = 600000;  // Minimum time in ms between two snapshots in flash
 
 struct MelCommand {
   uint8_t start;
@@ -48,20 +63,112 @@ enum MelCommandType {
   MEL_COMMAND_TYPE_CONNECT = 0xCA   // Handshake packet
 };
 
+enum MelJournalResult {
+  MEL_JOURNAL_RESULT_PENDING,  // Waiting for the response
+  MEL_JOURNAL_RESULT_OK,       // Matching response received
+  MEL_JOURNAL_RESULT_TIMEOUT,  // No matching response received
+};
+
+struct MelJournalEntry {
+  uint8_t flags;                 // Request flags
+  uint8_t type;                  // Request type, first byte of the payload
+  uint32_t timestamp;            // Time the request was sent
+  uint32_t rtt;                  // Time in ms until the response was received
+  enum MelJournalResult result;  // Outcome of the request
+};
+
+enum MelTraceType : uint8_t {
+  MEL_TRACE_RX,               // Valid frame received
+  MEL_TRACE_TX,               // Frame sent
+  MEL_TRACE_TIMEOUT,          // No response received for the last request
+  MEL_TRACE_CONNECT,          // Unit connected, count is the CONNECT attempts and time how long they took
+  MEL_TRACE_DISCONNECT,       // Unit stopped responding, count is the response timeouts in a row
+  MEL_TRACE_CONTROL_RETRY,    // SET failed and the fields are sent again after time ms, count is the retry
+  MEL_TRACE_CONTROL_REISSUE,  // Fields not applied by the unit are sent again, count is the re-issue
+  MEL_TRACE_CONTROL_DROP,     // Fields given up on, count is the attempts made
+};
+
+struct MelTraceEntry {
+  uint32_t timestamp;                       // Time the entry was recorded
+  enum MelTraceType type;                   // Entry type
+  uint8_t flags;                            // Frame flags, or the count of an event
+  uint8_t length;                           // Full payload length, only MEL_TRACE_PAYLOAD_SIZE bytes are kept
+  uint8_t payload[MEL_TRACE_PAYLOAD_SIZE];  // Truncated payload
+  uint8_t check;                            // Checksum of the entry, detects entries torn by a reset
+};
+
+/**
+ * Trace ring that is kept in no-init RTC memory on ESP32, so the last entries
+ * before a software or watchdog reset can be reported on the next boot.
+ */
+struct MelTraceStore {
+  uint32_t magic;  // MEL_TRACE_STORE_MAGIC when the store was initialized
+  uint8_t head;    // Index of the next entry to write
+  uint8_t count;   // Number of valid entries
+  uint8_t check;   // Checksum of the header
+  struct MelTraceEntry entries[MEL_TRACE_SIZE];
+};
+
+struct MelLinkStats {
+  uint32_t requests = 0;         // Number of requests sent
+  uint32_t responses = 0;        // Number of responses matching their request
+  uint32_t timeouts = 0;         // Number of requests without a response
+  uint32_t checksum_errors = 0;  // Number of frames dropped with an invalid checksum
+  uint32_t version_errors = 0;   // Number of frames dropped with an unexpected version
+  uint32_t mismatches = 0;       // Number of responses dropped for not matching the request
+};
+
+// Request types whose response time is tracked, any other type is counted in the last slot as FF
+static const uint8_t MEL_RTT_TYPES[] = {MEL_COMMAND_TYPE_SET_PARAMS, MEL_COMMAND_TYPE_GET_PARAMS,
+                                        MEL_COMMAND_TYPE_GET_TEMP,   MEL_COMMAND_TYPE_GET_TIMERS,
+                                        MEL_COMMAND_TYPE_GET_STATUS, MEL_COMMAND_TYPE_SET_TEMP,
+                                        MEL_COMMAND_TYPE_CONNECT};
+static const uint8_t MEL_RTT_SLOTS = sizeof(MEL_RTT_TYPES) + 1;
+static const uint8_t MEL_RTT_TYPE_OTHER = 0xFF;
+
+struct MelRttStats {
+  uint8_t type = MEL_RTT_TYPE_OTHER;  // Request type of the responses
+  uint32_t count = 0;                 // Number of responses received
+  uint32_t total = 0;                 // Sum of the RTT in ms
+  uint32_t last = 0;                  // RTT in ms of the last response
+  uint32_t max = 0;                   // Longest RTT in ms
+};
+
 class MelConnectionManager {
  private:
   uart::UARTDevice *uart_;
   uint32_t tx_timestamp_ = 0;
+  uint32_t byte_time_ = 0;      // Time in us to transfer one byte at the current baud rate
+  uint32_t response_time_ = 0;  // Time in ms for the last request and a full response to cross the bus
   uint8_t tx_buffer_[MEL_COMMAND_BUFFER_SIZE];
 
   uint32_t rx_index_ = 0;
   uint32_t rx_timestamp_ = 0;
+  uint32_t rx_frame_timestamp_ = 0;  // Time in ms the last valid frame was completed
+  uint32_t min_frame_gap_ = 0;       // Minimum time in ms between a received frame and the next request
   uint8_t rx_buffer_[MEL_COMMAND_BUFFER_SIZE];
 
   bool state_waiting_response_ = false;
   bool state_response_timeout_ = false;
   bool state_response_pending_ = false;
 
+  // Ring of the most recent requests, the newest entry is the outstanding request
+  struct MelJournalEntry journal_[MEL_JOURNAL_SIZE];
+  uint8_t journal_head_ = 0;   // Index of the next entry to write
+  uint8_t journal_count_ = 0;  // Number of valid entries
+
+  struct MelTraceStore *trace_ = nullptr;                  // Ring of the most recent frames
+  std::unique_ptr<struct MelTraceStore> recovered_trace_;  // Trace of the previous boot, if any was recovered
+#ifdef USE_ESP32
+  ESPPreferenceObject trace_snapshot_pref_;  // Copy of the trace in flash, survives a power loss
+  uint32_t trace_snapshot_timestamp_ = 0;    // Time in ms of the last snapshot
+  bool trace_snapshot_saved_ = false;        // A snapshot was taken since boot
+  bool trace_snapshot_loaded_ = false;       // The recovered trace is the snapshot from flash
+#endif
+
+  struct MelLinkStats stats_;
+  struct MelRttStats rtt_stats_[MEL_RTT_SLOTS];  // RTT of each request type
+
   // Utilities
   std::string hex2str(const uint8_t *buffer, size_t length);
   uint8_t calculate_checksum(const uint8_t *buffer, size_t length);
@@ -70,10 +177,36 @@ class MelConnectionManager {
   void receiver_reset_states(void);
   void receiver_process_byte(uint8_t byte);
 
+  void trace_setup(void);
+  void trace_record(enum MelTraceType type, const struct MelCommand *cmd);
+  void trace_print(const char *tag, const struct MelTraceStore &trace);
+
+  struct MelJournalEntry *journal_last(void);
+  void journal_record_request(uint8_t flags, uint8_t type, uint32_t now);
+  bool journal_match_response(const struct MelCommand *cmd, uint32_t now);
+
  public:
   bool is_busy() const { return this->state_waiting_response_; }
   bool is_response_timeout() const { return this->state_response_timeout_; }
   bool is_response_pending() const { return this->state_response_pending_; }
+  bool is_frame_gap_elapsed(uint32_t now) const { return (now - this->rx_frame_timestamp_) >= this->min_frame_gap_; }
+  // True while bytes of the response arrive, and from the time the request and a full response could have crossed the
+  // bus until MEL_RESPONSE_WINDOW_MARGIN later. A unit that stays silent is left to the response timeout.
+  bool is_response_due(uint32_t now) {
+    if (!this->state_waiting_response_) {
+      return false;
+    }
+    if ((this->uart_->available() > 0) ||
+        ((this->rx_index_ > 0) && ((now - this->rx_timestamp_) < MEL_RESPONSE_WINDOW_MARGIN))) {
+      return true;
+    }
+    const uint32_t elapsed = now - this->tx_timestamp_;
+    return (elapsed >= this->response_time_) && (elapsed < (this->response_time_ + MEL_RESPONSE_WINDOW_MARGIN));
+  }
+  bool is_tick_due(uint32_t now) {
+    return (this->uart_->available() > 0) ||
+           (this->state_waiting_response_ && ((now - this->tx_timestamp_) > MEL_COMMAND_RECV_TIMEOUT));
+  }
 
   const struct MelCommand *response() const { return (MelCommand *) this->rx_buffer_; }
 
@@ -81,6 +214,7 @@ class MelConnectionManager {
 
   bool check_response_flags(uint8_t flags) { return (this->response()->flags & flags) == flags; }
   void clear_response_pending() { this->state_response_pending_ = false; }
+  void clear_response_timeout() { this->state_response_timeout_ = false; }
 
   void request_connect(void);
   void request_room_temperature(void);
@@ -89,7 +223,20 @@ class MelConnectionManager {
 
   void tick(void);
 
-  MelConnectionManager(uart::UARTDevice *uart) : uart_(uart){};
+  void set_min_frame_gap(uint32_t value) { this->min_frame_gap_ = value; }
+  void set_baud_rate(uint32_t value) { this->byte_time_ = (MEL_COMMAND_BITS_PER_BYTE * 1000000) / value; }
+  uint32_t get_min_frame_gap(void) const { return this->min_frame_gap_; }
+
+  const struct MelLinkStats &get_stats(void) const { return this->stats_; }
+  const struct MelRttStats *get_rtt_stats(void) const { return this->rtt_stats_; }
+  void dump_journal(const char *tag);
+  void dump_trace(const char *tag);
+  void dump_recovered_trace(const char *tag);
+  void trace_event(enum MelTraceType type, uint8_t count, uint16_t fields = 0, uint32_t time = 0);
+  void trace_snapshot_load(void);
+  bool trace_snapshot_save(void);
+
+  MelConnectionManager(uart::UARTDevice *uart) : uart_(uart) { this->trace_setup(); };
 };
 
 }  // namespace conn
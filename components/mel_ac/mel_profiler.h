@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace mel {
+
+static const uint8_t LOOP_PROFILE_BUCKET_COUNT = 12;
+static const uint32_t LOOP_PROFILE_BUCKET_LIMITS[LOOP_PROFILE_BUCKET_COUNT] = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 30000, 50000, UINT32_MAX,  // Upper bound in us of each bucket
+};
+
+struct LoopProfileStats {
+  uint32_t buckets[LOOP_PROFILE_BUCKET_COUNT] = {};  // Number of calls per bucket of LOOP_PROFILE_BUCKET_LIMITS
+  uint32_t count = 0;                                // Number of calls recorded
+  uint32_t min = UINT32_MAX;                         // Shortest call in us
+  uint32_t max = 0;                                  // Longest call in us
+  uint64_t total = 0;                                // Sum of all calls in us
+};
+
+/**
+ * Time spent in the phases of a loop. Every mark() records the time since the
+ * previous mark against a phase, end() records the whole call against the last
+ * of the 'N' phases. With 'Enabled' false the profiler compiles to nothing.
+ */
+template<size_t N, bool Enabled = true> class LoopProfiler {
+ public:
+  void begin(void) { this->start_ = this->last_ = micros(); }
+
+  void mark(size_t phase) {
+    const uint32_t now = micros();
+    this->record(phase, now - this->last_);
+    this->last_ = now;
+  }
+
+  void end(void) { this->record(N - 1, micros() - this->start_); }
+
+  const struct LoopProfileStats &stats(size_t phase) const { return this->stats_[phase]; }
+
+  uint32_t percentile(size_t phase, uint8_t percentile) const {
+    auto &stats = this->stats_[phase];
+    if (stats.count == 0) {
+      return 0;
+    }
+
+    const uint32_t rank = ((stats.count * (uint64_t) percentile) + 99) / 100;  // Round up, 1-based
+    uint32_t cumulative = 0;
+    for (int i = 0; i < (LOOP_PROFILE_BUCKET_COUNT - 1); i++) {
+      cumulative += stats.buckets[i];
+      if (cumulative >= rank) {
+        return std::min(LOOP_PROFILE_BUCKET_LIMITS[i], stats.max);
+      }
+    }
+    return stats.max;
+  }
+
+  void dump(const char *tag, const char *const (&names)[N]) const {
+    int width = 0;
+    for (auto *name : names) {
+      width = std::max(width, (int) strlen(name));
+    }
+
+    ESP_LOGCONFIG(tag, "  Loop Profile (us):");
+    for (size_t i = 0; i < N; i++) {
+      auto &stats = this->stats_[i];
+      if (stats.count == 0) {
+        continue;
+      }
+      ESP_LOGCONFIG(tag,
+                    "    %-*s: count=%" PRIu32 ", min=%" PRIu32 ", mean=%" PRIu32 ", p99=%" PRIu32 ", max=%" PRIu32,
+                    width, names[i], stats.count, stats.min, (uint32_t) (stats.total / stats.count),
+                    this->percentile(i, 99), stats.max);
+    }
+  }
+
+ protected:
+  void record(size_t phase, uint32_t elapsed) {
+    auto &stats = this->stats_[phase];
+
+    uint8_t bucket = 0;
+    while ((bucket < (LOOP_PROFILE_BUCKET_COUNT - 1)) && (elapsed > LOOP_PROFILE_BUCKET_LIMITS[bucket])) {
+      bucket++;
+    }
+
+    stats.buckets[bucket]++;
+    stats.count++;
+    stats.total += elapsed;
+    stats.min = std::min(stats.min, elapsed);
+    stats.max = std::max(stats.max, elapsed);
+  }
+
+  struct LoopProfileStats stats_[N];
+  uint32_t start_ = 0;  // Time in us of begin()
+  uint32_t last_ = 0;   // Time in us of the last mark
+};
+
+template<size_t N> class LoopProfiler<N, false> {
+ public:
+  void begin(void) {}
+  void mark(size_t phase) {}
+  void end(void) {}
+  void dump(const char *tag, const char *const (&names)[N]) const {}
+};
+
+}  // namespace mel
+}  // namespace esphome
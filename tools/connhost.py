@@ -0,0 +1,217 @@
+"""
+Python bindings of the host harness in tools/host.
+
+The library is built, or rebuilt when a component source changed, with
+'make -C tools/host lib' on first use, so the tools always run against the
+current kdk_conn.cpp and mel_conn.cpp.
+"""
+
+import ctypes
+import os
+import subprocess
+
+HOST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "host")
+HOST_LIBRARY = os.path.join(HOST_DIR, "build", "libconnhost.so")
+
+FRAME_BUFFER_SIZE = 512
+
+KDK_FEED_NONE = 0
+KDK_FEED_FRAME = 1
+KDK_FEED_SYNC = 2
+
+
+class KdkCounters(ctypes.Structure):
+    _fields_ = [
+        ("rx_frames", ctypes.c_uint32),
+        ("checksum_errors", ctypes.c_uint32),
+        ("oversize_frames", ctypes.c_uint32),
+        ("byte_timeouts", ctypes.c_uint32),
+    ]
+
+
+class MelCounters(ctypes.Structure):
+    _fields_ = [
+        ("requests", ctypes.c_uint32),
+        ("responses", ctypes.c_uint32),
+        ("timeouts", ctypes.c_uint32),
+        ("checksum_errors", ctypes.c_uint32),
+        ("version_errors", ctypes.c_uint32),
+        ("mismatches", ctypes.c_uint32),
+    ]
+
+
+_lib = None
+
+
+def library():
+    global _lib
+    if _lib is not None:
+        return _lib
+
+    result = subprocess.run(["make", "-s", "-C", HOST_DIR, "lib"], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            text=True)
+    if result.returncode != 0:
+        raise OSError(f"failed to build {HOST_LIBRARY}:\n{result.stdout}")
+
+    lib = ctypes.CDLL(HOST_LIBRARY)
+    handle = ctypes.c_void_p
+    buffer = ctypes.c_char_p
+    size = ctypes.c_size_t
+    signatures = {
+        "host_set_time_us": (None, [ctypes.c_uint64]),
+        "host_set_log_level": (None, [ctypes.c_int]),
+        "kdk_host_new": (handle, []),
+        "kdk_host_free": (None, [handle]),
+        "kdk_host_feed": (ctypes.c_int, [handle, ctypes.c_uint8]),
+        "kdk_host_frame": (size, [handle, buffer, size]),
+        "kdk_host_respond": (size, [handle, buffer, size, buffer, size]),
+        "kdk_host_counters": (None, [handle, ctypes.POINTER(KdkCounters)]),
+        "kdk_host_set_table_id": (None, [handle, ctypes.c_uint32]),
+        "kdk_host_clear_parameters": (None, [handle]),
+        "kdk_host_define_parameter": (None, [handle, ctypes.c_uint16, buffer, ctypes.c_uint8, ctypes.c_uint8]),
+        "kdk_host_parameter": (ctypes.c_int, [handle, ctypes.c_uint16, buffer, size]),
+        "kdk_host_stage_0810": (None, [handle, buffer]),
+        "kdk_host_encode_0810": (size, [handle, ctypes.c_uint8, buffer, size]),
+        "kdk_host_encode_0910": (size, [handle, ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint16), size, buffer, size]),
+        "kdk_host_encode_0210": (size, [handle, ctypes.c_uint8, ctypes.POINTER(ctypes.c_uint16), size, buffer, size]),
+        "kdk_host_decode": (None, [handle, buffer]),
+        "mel_host_new": (handle, []),
+        "mel_host_free": (None, [handle]),
+        "mel_host_feed": (ctypes.c_int, [handle, ctypes.c_uint8]),
+        "mel_host_frame": (size, [handle, buffer, size]),
+        "mel_host_tick": (None, [handle]),
+        "mel_host_busy": (ctypes.c_int, [handle]),
+        "mel_host_send": (size, [handle, ctypes.c_uint8, buffer, ctypes.c_uint8, buffer, size]),
+        "mel_host_counters": (None, [handle, ctypes.POINTER(MelCounters)]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+
+    _lib = lib
+    return lib
+
+
+def set_time_us(now):
+    library().host_set_time_us(int(now))
+
+
+def set_log_level(level):
+    """ESPHome log level of the components, 0 = NONE to 5 = DEBUG, printed to stderr."""
+    library().host_set_log_level(level)
+
+
+class _Host:
+    NEW = None
+    FREE = None
+
+    def __init__(self):
+        self.lib = library()
+        self.handle = getattr(self.lib, self.NEW)()
+        self.buffer = ctypes.create_string_buffer(FRAME_BUFFER_SIZE)
+
+    def __del__(self):
+        if getattr(self, "handle", None):
+            getattr(self.lib, self.FREE)(self.handle)
+            self.handle = None
+
+    def _take(self, length):
+        return bytes(self.buffer.raw[:length])
+
+
+class KdkHost(_Host):
+    """KdkConnectionManager, see KdkHost in tools/host/host.h."""
+
+    NEW = "kdk_host_new"
+    FREE = "kdk_host_free"
+
+    def feed(self, byte):
+        """receiver_process_byte(), returns KDK_FEED_NONE, KDK_FEED_FRAME or KDK_FEED_SYNC."""
+        return self.lib.kdk_host_feed(self.handle, byte)
+
+    def frame(self):
+        """The pending frame, or None."""
+        length = self.lib.kdk_host_frame(self.handle, self.buffer, len(self.buffer))
+        return self._take(length) if length else None
+
+    def respond(self, request):
+        """The response of the component to the device request 'request', or None."""
+        length = self.lib.kdk_host_respond(self.handle, bytes(request), len(request), self.buffer, len(self.buffer))
+        return self._take(length) if length else None
+
+    def set_table_id(self, table_id):
+        self.lib.kdk_host_set_table_id(self.handle, table_id)
+
+    def clear_parameters(self):
+        self.lib.kdk_host_clear_parameters(self.handle)
+
+    def define_parameter(self, parameter_id, data, metadata=0):
+        self.lib.kdk_host_define_parameter(self.handle, parameter_id, bytes(data), len(data), metadata)
+
+    def parameter(self, parameter_id):
+        """The data of a parameter, or None when it is not defined."""
+        length = self.lib.kdk_host_parameter(self.handle, parameter_id, self.buffer, len(self.buffer))
+        return self._take(length) if length >= 0 else None
+
+    def stage_0810(self, entries):
+        """Make 'entries', the captured entries from the count on, the in-flight write."""
+        self.lib.kdk_host_stage_0810(self.handle, bytes(entries))
+
+    def encode_0810(self, counter):
+        """send_message_0810() of the staged write, returns the frame."""
+        return self._take(self.lib.kdk_host_encode_0810(self.handle, counter, self.buffer, len(self.buffer)))
+
+    def encode_0910(self, counter, ids):
+        """send_message_0910(), returns the frame."""
+        id_list = (ctypes.c_uint16 * len(ids))(*ids)
+        return self._take(self.lib.kdk_host_encode_0910(self.handle, counter, id_list, len(ids), self.buffer,
+                                                        len(self.buffer)))
+
+    def encode_0210(self, counter, ids):
+        """send_message_0210_init() with 'ids' as the parameter table, returns the frame."""
+        id_list = (ctypes.c_uint16 * len(ids))(*ids)
+        return self._take(self.lib.kdk_host_encode_0210(self.handle, counter, id_list, len(ids), self.buffer,
+                                                        len(self.buffer)))
+
+    def decode(self, buffer):
+        """parse_parameter_response(), 'buffer' starts from the entry count."""
+        self.lib.kdk_host_decode(self.handle, bytes(buffer))
+
+    def counters(self):
+        counters = KdkCounters()
+        self.lib.kdk_host_counters(self.handle, ctypes.byref(counters))
+        return {name: getattr(counters, name) for name, _ in KdkCounters._fields_}
+
+
+class MelHost(_Host):
+    """MelConnectionManager, see MelHost in tools/host/host.h."""
+
+    NEW = "mel_host_new"
+    FREE = "mel_host_free"
+
+    def feed(self, byte):
+        """receiver_process_byte(), returns True when a response to the outstanding request is pending."""
+        return bool(self.lib.mel_host_feed(self.handle, byte))
+
+    def frame(self):
+        length = self.lib.mel_host_frame(self.handle, self.buffer, len(self.buffer))
+        return self._take(length) if length else None
+
+    def tick(self):
+        self.lib.mel_host_tick(self.handle)
+
+    def busy(self):
+        """True while a request waits for its response."""
+        return bool(self.lib.mel_host_busy(self.handle))
+
+    def send(self, flags, payload):
+        """send_command(), 'flags' without the OUT bit. Returns the frame written to the UART."""
+        length = self.lib.mel_host_send(self.handle, flags, bytes(payload), len(payload), self.buffer,
+                                        len(self.buffer))
+        return self._take(length)
+
+    def counters(self):
+        counters = MelCounters()
+        self.lib.mel_host_counters(self.handle, ctypes.byref(counters))
+        return {name: getattr(counters, name) for name, _ in MelCounters._fields_}
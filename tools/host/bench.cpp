@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "esphome/core/log.h"
+#include "host.h"
+
+/* Micro-benchmarks of the connection managers on the host.
+ *
+ * Every benchmark runs its operation ITERATIONS times, REPEATS times over, and
+ * keeps the fastest repeat. Operations that need an untimed setup are timed
+ * one by one, the others as a batch. Heap allocations are counted by
+ * replacing the global operator new.
+ */
+
+using namespace esphome;
+using namespace esphome::host;
+
+static const int BENCH_REPEATS = 15;
+static const int BENCH_DEFAULT_ITERATIONS = 5000;
+static const double BENCH_DEFAULT_THRESHOLD = 50.0;  // Allowed slowdown in percent over the baseline
+
+static uint64_t bench_allocations = 0;
+
+void *operator new(size_t size) {
+  bench_allocations++;
+  void *ptr = malloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t size) noexcept { free(ptr); }
+
+struct BenchResult {
+  std::string name;
+  std::string unit;
+  double ns_per_unit;
+  double ns_per_op;
+  double p99_ns;  // 99th percentile of a single operation, negative when timed as a batch
+  double max_ns;  // Longest single operation, negative when timed as a batch
+  double allocs_per_op;
+};
+
+static std::vector<struct BenchResult> bench_results;
+static int bench_iterations = BENCH_DEFAULT_ITERATIONS;
+
+static uint64_t now_ns(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Time 'op', 'units' is the number of units (bytes, frames...) per operation.
+ * When 'setup' is set it runs untimed before every operation.
+ */
+static void bench(const char *name, const char *unit, double units, const std::function<void()> &op,
+                  const std::function<void()> &setup = nullptr) {
+  double best = -1;
+  double p99_ns = -1;
+  double max_ns = -1;
+  uint64_t allocations = 0;
+  std::vector<uint64_t> samples;
+  samples.reserve(setup ? bench_iterations : 0);
+
+  for (int r = 0; r < BENCH_REPEATS; r++) {
+    uint64_t total = 0;
+    const uint64_t allocs = bench_allocations;
+    if (setup) {
+      samples.clear();
+      for (int i = 0; i < bench_iterations; i++) {
+        setup();
+        const uint64_t start = now_ns();
+        op();
+        const uint64_t elapsed = now_ns() - start;
+        total += elapsed;
+        samples.push_back(elapsed);
+      }
+    } else {
+      const uint64_t start = now_ns();
+      for (int i = 0; i < bench_iterations; i++) {
+        op();
+      }
+      total = now_ns() - start;
+    }
+    allocations = bench_allocations - allocs;
+
+    const double mean = (double) total / bench_iterations;
+    if ((best < 0) || (mean < best)) {
+      best = mean;
+      if (setup) {
+        std::sort(samples.begin(), samples.end());
+        p99_ns = samples[(samples.size() * 99) / 100];
+        max_ns = samples.back();
+      }
+    }
+  }
+
+  // Allocations of the untimed setup are counted too
+  bench_results.push_back(
+      {name, unit, best / units, best, p99_ns, max_ns, (double) allocations / bench_iterations});
+}
+
+static uint8_t mel_checksum(const std::vector<uint8_t> &frame) {
+  uint8_t sum = 0;
+  for (auto byte : frame) {
+    sum += byte;
+  }
+  return mel::conn::MEL_COMMAND_START - sum;
+}
+
+/*******************************************************************************
+ * Captured frames, see components/kdk/NOTES.md
+ ******************************************************************************/
+
+// 0910 poll request and its response, 15 parameters
+static const uint16_t KDK_0910_IDS[] = {0x8000, 0xF000, 0x8600, 0x8800, 0xF800, 0xF200, 0xF100, 0xF900,
+                                        0xFA00, 0xFB00, 0xF300, 0xF500, 0xF400, 0xF700, 0xF600};
+static const std::vector<uint8_t> KDK_8910_FRAME = {
+    0x5A, 0x20, 0x10, 0x89, 0x00, 0x76, 0x00, 0x01, 0x3A, 0x01, 0x0F, 0x00, 0x80, 0x01, 0x31, 0x00, 0xF0, 0x01, 0x32,
+    0x00, 0x86, 0x2E, 0x2A, 0x00, 0x00, 0xFE, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x88, 0x01, 0x42, 0x00, 0xF8, 0x04, 0x31,
+    0x31, 0x00, 0x00, 0x00, 0xF2, 0x01, 0x31, 0x00, 0xF1, 0x01, 0x41, 0x00, 0xF9, 0x02, 0x00, 0x00, 0x00, 0xFA, 0x04,
+    0x31, 0x40, 0x00, 0x00, 0x00, 0xFB, 0x02, 0x00, 0x00, 0x00, 0xF3, 0x01, 0x31, 0x00, 0xF5, 0x01, 0x01, 0x00, 0xF4,
+    0x01, 0x42, 0x00, 0xF7, 0x01, 0x01, 0x00, 0xF6, 0x01, 0x58, 0xF8,
+};
+
+// 0810 request writing 9 parameters
+static const std::vector<uint8_t> KDK_0810_FRAME = {
+    0x5A, 0x21, 0x10, 0x08, 0x00, 0x2C, 0x02, 0x01, 0x3A, 0x01, 0x09, 0x00, 0xFD, 0x01, 0x03, 0x00, 0xFC, 0x01,
+    0x30, 0x00, 0xFE, 0x01, 0x40, 0x00, 0x80, 0x01, 0x30, 0x00, 0xF0, 0x01, 0x32, 0x00, 0xF2, 0x01, 0x31, 0x00,
+    0xF1, 0x01, 0x41, 0x00, 0xF3, 0x01, 0x31, 0x00, 0xF8, 0x04, 0x31, 0x31, 0xFF, 0xFF, 0xE1,
+};
+
+// 0A10 notification of a light state change
+static const std::vector<uint8_t> KDK_0A10_FRAME = {
+    0x5A, 0x0C, 0x10, 0x0A, 0x00, 0x09, 0x00, 0x01, 0x3A, 0x01, 0x01, 0x00, 0xF3, 0x01, 0x30, 0x16,
+};
+
+static const uint32_t KDK_TABLE_ID = 0x013A01;
+
+/*******************************************************************************
+ * Benchmarks
+ ******************************************************************************/
+
+static void bench_kdk(void) {
+  KdkHost kdk;
+  uint8_t buffer[kdk::KDK_MESSAGE_BUFFER_SIZE];
+
+  kdk.set_table_id(KDK_TABLE_ID);
+  for (auto &entry : kdk_parse_entries(&KDK_8910_FRAME[10])) {
+    kdk.define_parameter(entry.id, entry.data.size());
+  }
+
+  bench("kdk.rx_8910", "byte", KDK_8910_FRAME.size(), [&]() {
+    for (auto byte : KDK_8910_FRAME) {
+      kdk.feed(byte);
+    }
+    kdk.frame(buffer, sizeof(buffer));
+  });
+
+  bench("kdk.decode_8910", "frame", 1, [&]() { kdk.decode(&KDK_8910_FRAME[10]); });
+
+  kdk.stage_0810(kdk_parse_entries(&KDK_0810_FRAME[10]));
+  bench("kdk.encode_0810", "frame", 1, [&]() { kdk.encode_0810(0x21, buffer, sizeof(buffer)); });
+
+  bench("kdk.encode_0910", "frame", 1, [&]() {
+    kdk.encode_0910(0x20, KDK_0910_IDS, sizeof(KDK_0910_IDS) / sizeof(KDK_0910_IDS[0]), buffer, sizeof(buffer));
+  });
+
+  bench("kdk.encode_0910_poll", "frame", 1, [&]() { kdk.encode_0910_poll(0x20, buffer, sizeof(buffer)); });
+
+  // IDLE to INIT_SYNC on a recovery, then INIT_SYNC to INIT_0C00 on the SYNC_OK of its loop handler
+  bench(
+      "kdk.fsm_run", "transition", 2,
+      [&]() {
+        kdk.push_event(kdk::KDK_COMM_FSM_EVENT_SYNC_RECOVERY);
+        kdk.run_fsm();
+        kdk.run_fsm();
+      },
+      [&]() { kdk.idle(); });
+
+  // A tick handling a notification: receive, decode and queue the response and the verification read
+  bench(
+      "kdk.update_0A10", "tick", 1, [&]() { kdk.update(); },
+      [&]() {
+        kdk.idle();
+        kdk.receive(KDK_0A10_FRAME.data(), KDK_0A10_FRAME.size());
+      });
+
+  // A tick sending the queued response and starting the verification read
+  bench(
+      "kdk.update_dispatch", "tick", 1, [&]() { kdk.update(); },
+      [&]() {
+        kdk.idle();
+        kdk.receive(KDK_0A10_FRAME.data(), KDK_0A10_FRAME.size());
+        kdk.update();
+      });
+
+  // An idle tick, nothing received and nothing due
+  bench(
+      "kdk.update_idle", "tick", 1, [&]() { kdk.update(); }, [&]() { kdk.idle(); });
+}
+
+static void bench_mel(void) {
+  MelHost mel;
+  uint8_t buffer[mel::conn::MEL_COMMAND_BUFFER_SIZE];
+
+  uint8_t request[16] = {mel::conn::MEL_COMMAND_TYPE_GET_PARAMS};
+  // GET_PARAMS response, power ON in COOL mode
+  std::vector<uint8_t> response = {0xFC, 0x62, 0x01, 0x30, 0x10, 0x02, 0x00, 0x00, 0x01, 0x03, 0x08,
+                                   0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  response.push_back(mel_checksum(response));
+
+  bench("mel.encode_get", "frame", 1,
+        [&]() { mel.send(mel::conn::MEL_COMMAND_FLAGS_GET, request, sizeof(request), buffer, sizeof(buffer)); });
+
+  bench(
+      "mel.rx_get", "byte", response.size(),
+      [&]() {
+        for (auto byte : response) {
+          mel.feed(byte);
+        }
+      },
+      [&]() {
+        mel.frame(buffer, sizeof(buffer));
+        mel.send(mel::conn::MEL_COMMAND_FLAGS_GET, request, sizeof(request), buffer, sizeof(buffer));
+      });
+
+  bench(
+      "mel.tick_get", "tick", 1, [&]() { mel.tick(); },
+      [&]() {
+        mel.frame(buffer, sizeof(buffer));
+        mel.send(mel::conn::MEL_COMMAND_FLAGS_GET, request, sizeof(request), buffer, sizeof(buffer));
+        mel.receive(response.data(), response.size());
+      });
+}
+
+/*******************************************************************************
+ * Baseline
+ ******************************************************************************/
+
+static bool baseline_save(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "# name ns_per_unit allocs_per_op\n");
+  for (auto &result : bench_results) {
+    fprintf(f, "%s %.2f %.2f\n", result.name.c_str(), result.ns_per_unit, result.allocs_per_op);
+  }
+  fclose(f);
+  return true;
+}
+
+/**
+ * Compare the results with the baseline. A benchmark regresses when it
+ * allocates more or, unless 'allocs_only', is slower by more than 'threshold'
+ * percent. The timings only compare against a baseline of the same machine and
+ * build, the allocations against any baseline.
+ */
+static int baseline_check(const char *path, double threshold, bool allocs_only) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    perror(path);
+    return 2;
+  }
+
+  std::map<std::string, std::pair<double, double>> baseline;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != nullptr) {
+    char name[128];
+    double ns;
+    double allocs;
+    if ((line[0] != '#') && (sscanf(line, "%127s %lf %lf", name, &ns, &allocs) == 3)) {
+      baseline[name] = {ns, allocs};
+    }
+  }
+  fclose(f);
+
+  int regressions = 0;
+  if (allocs_only) {
+    printf("\nBaseline %s, allocations only:\n", path);
+  } else {
+    printf("\nBaseline %s, threshold %.0f%%:\n", path, threshold);
+  }
+  for (auto &result : bench_results) {
+    auto it = baseline.find(result.name);
+    if (it == baseline.end()) {
+      printf("  %-22s not in the baseline\n", result.name.c_str());
+      continue;
+    }
+    const double change = 100.0 * (result.ns_per_unit - it->second.first) / it->second.first;
+    const bool slower = !allocs_only && (change > threshold);
+    const bool allocates = result.allocs_per_op > (it->second.second + 0.005);
+    printf("  %-22s %+7.1f%%  allocs %.2f -> %.2f%s\n", result.name.c_str(), change, it->second.second,
+           result.allocs_per_op, (slower || allocates) ? "  REGRESSION" : "");
+    regressions += (slower || allocates) ? 1 : 0;
+  }
+  return (regressions > 0) ? 1 : 0;
+}
+
+/*******************************************************************************
+ * Main
+ ******************************************************************************/
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n ITERATIONS] [--save FILE] [--check FILE] [--threshold PERCENT] [--allocs-only] [-v]\n"
+          "  --save FILE          write the results as the new baseline\n"
+          "  --check FILE         exit with 1 when a result regresses from the baseline\n"
+          "  --threshold PERCENT  allowed slowdown over the baseline, default %.0f\n"
+          "  --allocs-only        only check the allocations against the baseline\n"
+          "  -v                   print the component logs, use with a small -n\n",
+          name, BENCH_DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char **argv) {
+  const char *save = nullptr;
+  const char *check = nullptr;
+  double threshold = BENCH_DEFAULT_THRESHOLD;
+  bool allocs_only = false;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+      bench_iterations = std::max(1, atoi(argv[++i]));
+    } else if ((strcmp(argv[i], "--save") == 0) && (i + 1 < argc)) {
+      save = argv[++i];
+    } else if ((strcmp(argv[i], "--check") == 0) && (i + 1 < argc)) {
+      check = argv[++i];
+    } else if ((strcmp(argv[i], "--threshold") == 0) && (i + 1 < argc)) {
+      threshold = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--allocs-only") == 0) {
+      allocs_only = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      host_set_log_level(ESPHOME_LOG_LEVEL_DEBUG);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  bench_kdk();
+  bench_mel();
+
+  printf("%-22s %-10s %9s %9s %9s %9s %9s\n", "benchmark", "unit", "ns/unit", "ns/op", "p99 ns", "max ns",
+         "allocs/op");
+  for (auto &result : bench_results) {
+    char p99_str[16] = "-";
+    char max_str[16] = "-";
+    if (result.max_ns >= 0) {
+      snprintf(p99_str, sizeof(p99_str), "%.0f", result.p99_ns);
+      snprintf(max_str, sizeof(max_str), "%.0f", result.max_ns);
+    }
+    printf("%-22s %-10s %9.1f %9.1f %9s %9s %9.2f\n", result.name.c_str(), result.unit.c_str(), result.ns_per_unit,
+           result.ns_per_op, p99_str, max_str, result.allocs_per_op);
+  }
+
+  if ((save != nullptr) && !baseline_save(save)) {
+    return 2;
+  }
+  if (check != nullptr) {
+    return baseline_check(check, threshold, allocs_only);
+  }
+  return 0;
+}
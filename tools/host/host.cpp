@@ -0,0 +1,231 @@
+#include <cstdarg>
+#include <cstdio>
+
+#include "esphome/core/log.h"
+#include "host.h"
+
+namespace esphome {
+
+static uint64_t host_time_us = 0;
+static int host_log_level = ESPHOME_LOG_LEVEL_NONE;
+
+uint32_t millis() { return (uint32_t) (host_time_us / 1000); }
+uint32_t micros() { return (uint32_t) host_time_us; }
+
+void host_log(int level, const char *tag, const char *format, ...) {
+  if (level > host_log_level) {
+    return;
+  }
+
+  static const char levels[] = "-EWICD";
+  fprintf(stderr, "[%c][%s] ", levels[level], tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+namespace host {
+
+void host_set_time_us(uint64_t now) { host_time_us = now; }
+void host_set_log_level(int level) { host_log_level = level; }
+
+std::vector<struct kdk::KdkParamUpdate> kdk_parse_entries(const uint8_t *buffer) {
+  std::vector<struct kdk::KdkParamUpdate> entries;
+  size_t index = 1;
+  for (int i = 0; i < buffer[0]; i++) {
+    const uint16_t id = buffer[index] | (buffer[index + 1] << 8);
+    const uint8_t length = buffer[index + 2];
+    index += 3;
+    entries.push_back({id, std::vector<uint8_t>(&buffer[index], &buffer[index + length])});
+    index += length;
+  }
+  return entries;
+}
+
+/*******************************************************************************
+ * KdkHost
+ ******************************************************************************/
+
+void KdkHost::define_parameter(uint16_t id, uint8_t size, uint8_t metadata, const uint8_t *data) {
+  auto &param = this->state_.parameters[id];
+  param.id = id;
+  param.metadata = metadata;
+  param.size = size;
+  if (data != nullptr) {
+    param.data.assign(data, data + size);
+  } else {
+    param.data.assign(size, 0);
+  }
+}
+
+enum KdkHostFeedResult KdkHost::feed(uint8_t byte) {
+  const uint8_t events = this->fsm_.event_count;
+  this->receiver_process_byte(byte);
+
+  // SYNC is only reported to the FSM, drop the event so the queue never fills up
+  if (this->fsm_.event_count != events) {
+    this->fsm_.event_count = 0;
+    return KDK_HOST_FEED_SYNC;
+  }
+  return this->is_message_pending() ? KDK_HOST_FEED_FRAME : KDK_HOST_FEED_NONE;
+}
+
+size_t KdkHost::frame(uint8_t *buffer, size_t size) {
+  if (!this->is_message_pending()) {
+    return 0;
+  }
+  const size_t length = std::min(sizeof(struct kdk::KdkMsg) + this->message()->length + kdk::KDK_MESSAGE_CHECKSUM_SIZE,
+                                 size);
+  memcpy(buffer, this->rx_.buffer, length);
+  this->state_.message_pending = false;
+  return length;
+}
+
+/**
+ * Handle the device request 'request' from the steady state as update() does
+ * and return the response that was sent, if any. Requests started by the
+ * request, e.g. the 0910 read after an 0A10, are dropped.
+ */
+size_t KdkHost::respond(const uint8_t *request, size_t length, uint8_t *buffer, size_t size) {
+  if ((length < sizeof(struct kdk::KdkMsg)) || (length > sizeof(this->rx_.buffer))) {
+    return 0;
+  }
+
+  this->idle();
+  memcpy(this->rx_.buffer, request, length);
+  this->state_.message_pending = true;
+  this->process_message();
+  this->scheduler_dispatch(millis());
+
+  // Posted responses are sent first
+  auto &sent = this->host_sent();
+  auto *msg = (const struct kdk::KdkMsg *) sent.data();
+  if ((sent.size() <= sizeof(struct kdk::KdkMsg)) || ((msg->command & 0x8000) == 0)) {
+    sent.clear();
+  } else {
+    sent.resize(std::min(sent.size(), sizeof(struct kdk::KdkMsg) + msg->length + kdk::KDK_MESSAGE_CHECKSUM_SIZE));
+  }
+  const size_t response_length = this->take_sent(buffer, size);
+  this->idle();
+  return response_length;
+}
+
+/**
+ * Make 'entries' the in-flight write of an anonymous client, as the scheduler
+ * does before send_message_0810().
+ */
+void KdkHost::stage_0810(const std::vector<struct kdk::KdkParamUpdate> &entries) {
+  for (auto &entry : entries) {
+    if (this->state_.parameters.find(entry.id) == this->state_.parameters.end()) {
+      this->define_parameter(entry.id, entry.data.size());
+    }
+  }
+
+  this->state_.write_debouncers.clear();
+  auto &debouncer = this->state_.write_debouncers[nullptr];
+  debouncer.parameters = entries;
+  debouncer.in_flight = true;
+}
+
+size_t KdkHost::encode_0810(uint8_t counter, uint8_t *buffer, size_t size) {
+  this->host_sent().clear();
+  this->tx_.counter = counter - 1;
+  this->send_message_0810();
+  this->clear_waiting_response();
+  return this->take_sent(buffer, size);
+}
+
+size_t KdkHost::encode_0910(uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer, size_t size) {
+  this->host_sent().clear();
+  this->tx_.counter = counter - 1;
+  this->send_message_0910(ids, count);
+  this->clear_waiting_response();
+  return this->take_sent(buffer, size);
+}
+
+size_t KdkHost::encode_0910_poll(uint8_t counter, uint8_t *buffer, size_t size) {
+  this->host_sent().clear();
+  this->tx_.counter = counter - 1;
+  this->send_message_0910_poll();
+  this->clear_waiting_response();
+  return this->take_sent(buffer, size);
+}
+
+/**
+ * send_message_0210_init() requests every parameter with metadata 40, the
+ * parameter table is replaced by 'ids'.
+ */
+size_t KdkHost::encode_0210(uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer, size_t size) {
+  this->clear_parameters();
+  for (size_t i = 0; i < count; i++) {
+    this->define_parameter(ids[i], 1, 0x40);
+  }
+
+  this->host_sent().clear();
+  this->tx_.counter = counter - 1;
+  this->send_message_0210_init();
+  this->clear_waiting_response();
+  return this->take_sent(buffer, size);
+}
+
+/**
+ * Return to the steady state with nothing queued, outstanding or due.
+ */
+void KdkHost::idle(void) {
+  this->host_sent().clear();
+  this->fsm_.state = kdk::KDK_COMM_STATE_IDLE;
+  this->fsm_.event_count = 0;
+  this->scheduler_reset();
+  this->clear_waiting_response();
+  this->clear_message_pending();
+  this->state_.last_update_timestamp = millis();
+}
+
+size_t KdkHost::take_sent(uint8_t *buffer, size_t size) {
+  auto &sent = this->host_sent();
+  const size_t length = std::min(sent.size(), size);
+  memcpy(buffer, sent.data(), length);
+  sent.clear();
+  return length;
+}
+
+/*******************************************************************************
+ * MelHost
+ ******************************************************************************/
+
+bool MelHost::feed(uint8_t byte) {
+  this->conn_.process_byte(byte);
+  return this->conn_.is_response_pending();
+}
+
+size_t MelHost::frame(uint8_t *buffer, size_t size) {
+  if (!this->conn_.is_response_pending()) {
+    return 0;
+  }
+  auto *cmd = this->conn_.response();
+  const size_t length =
+      std::min(sizeof(struct mel::conn::MelCommand) + cmd->length + mel::conn::MEL_COMMAND_CHECKSUM_SIZE, size);
+  memcpy(buffer, cmd, length);
+  this->conn_.clear_response_pending();
+  return length;
+}
+
+size_t MelHost::send(uint8_t flags, const uint8_t *payload, uint8_t length, uint8_t *buffer, size_t size) {
+  uint8_t data[mel::conn::MEL_COMMAND_BUFFER_SIZE];
+  length = std::min<size_t>(length, mel::conn::MEL_COMMAND_BUFFER_SIZE - sizeof(struct mel::conn::MelCommand) -
+                                        mel::conn::MEL_COMMAND_CHECKSUM_SIZE);
+  memcpy(data, payload, length);
+
+  auto &sent = this->uart_.host_sent();
+  sent.clear();
+  this->conn_.send_command(flags, data, length);
+  const size_t sent_length = std::min(sent.size(), size);
+  memcpy(buffer, sent.data(), sent_length);
+  sent.clear();
+  return sent_length;
+}
+
+}  // namespace host
+}  // namespace esphome
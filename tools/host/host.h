@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/components/kdk/kdk_conn.h"
+#include "esphome/components/mel_ac/mel_conn.h"
+
+namespace esphome {
+namespace host {
+
+/* Host harness of the connection managers.
+ *
+ * The component sources are compiled unmodified against the stubs in
+ * tools/host/stubs. The clock is virtual and only moves with
+ * host_set_time_us(), the UART is a pair of in-memory queues.
+ */
+
+void host_set_time_us(uint64_t now);
+void host_set_log_level(int level);
+
+// Entries of a parameter message, 'buffer' starts from the entry count as for parse_parameter_response()
+std::vector<struct kdk::KdkParamUpdate> kdk_parse_entries(const uint8_t *buffer);
+
+enum KdkHostFeedResult {
+  KDK_HOST_FEED_NONE = 0,   // Byte consumed, no frame completed
+  KDK_HOST_FEED_FRAME = 1,  // A valid frame is pending, read it with frame()
+  KDK_HOST_FEED_SYNC = 2,   // A SYNC frame was received
+};
+
+/**
+ * KdkConnectionManager with its protected receiver, encoders, decoder and FSM
+ * exposed to the harness.
+ */
+class KdkHost : public kdk::KdkConnectionManager {
+ public:
+  void set_table_id(uint32_t table_id) { this->state_.parameter_table_id = table_id; }
+  void set_state(kdk::KdkCommFsmState state) { this->fsm_.state = state; }
+  void define_parameter(uint16_t id, uint8_t size, uint8_t metadata = 0, const uint8_t *data = nullptr);
+  void clear_parameters(void) { this->state_.parameters.clear(); }
+  bool has_parameter(uint16_t id) const { return this->state_.parameters.count(id) > 0; }
+
+  // Receiver
+  enum KdkHostFeedResult feed(uint8_t byte);
+  size_t frame(uint8_t *buffer, size_t size);
+  size_t respond(const uint8_t *request, size_t length, uint8_t *buffer, size_t size);
+  const struct kdk::KdkLinkStats &counters(void) const { return this->link_.counters; }
+
+  // Encoders, the frames are sent with 'counter' and returned in 'buffer'
+  void stage_0810(const std::vector<struct kdk::KdkParamUpdate> &entries);
+  size_t encode_0810(uint8_t counter, uint8_t *buffer, size_t size);
+  size_t encode_0910(uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer, size_t size);
+  size_t encode_0910_poll(uint8_t counter, uint8_t *buffer, size_t size);
+  size_t encode_0210(uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer, size_t size);
+
+  // Decoder, 'buffer' starts from the entry count as for parse_parameter_response()
+  void decode(const uint8_t *buffer) { this->parse_parameter_response(buffer); }
+
+  void idle(void);
+  void run_fsm(void) { this->fsm_run(); }
+  void push_event(kdk::KdkCommFsmEvent event) { this->fsm_push_event(event); }
+
+  void receive(const uint8_t *data, size_t length) { this->host_receive(data, length); }
+  std::vector<uint8_t> &sent(void) { return this->host_sent(); }
+
+ protected:
+  size_t take_sent(uint8_t *buffer, size_t size);
+};
+
+/**
+ * MelConnectionManager with its own in-memory UART.
+ */
+class MelHost {
+ public:
+  MelHost() : conn_(&uart_) {}
+
+  // Receiver, returns true when a response matching the outstanding request is pending
+  bool feed(uint8_t byte);
+  size_t frame(uint8_t *buffer, size_t size);
+
+  // Encoder, 'flags' are the request flags without MEL_COMMAND_FLAGS_OUT
+  size_t send(uint8_t flags, const uint8_t *payload, uint8_t length, uint8_t *buffer, size_t size);
+
+  void tick(void) { this->conn_.tick(); }
+  void receive(const uint8_t *data, size_t length) { this->uart_.host_receive(data, length); }
+
+  mel::conn::MelConnectionManager &conn(void) { return this->conn_; }
+
+ protected:
+  uart::UARTDevice uart_;
+  mel::conn::MelConnectionManager conn_;
+};
+
+}  // namespace host
+}  // namespace esphome
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+
+#include "host.h"
+
+/* C API of the host harness for the Python tools, loaded with ctypes from
+ * build/libconnhost.so by tools/connhost.py. The handles are owned by the
+ * caller and released with the matching _free().
+ */
+
+using esphome::host::KdkHost;
+using esphome::host::MelHost;
+
+extern "C" {
+
+/*******************************************************************************
+ * Host
+ ******************************************************************************/
+
+void host_set_time_us(uint64_t now) { esphome::host::host_set_time_us(now); }
+void host_set_log_level(int level) { esphome::host::host_set_log_level(level); }
+
+/*******************************************************************************
+ * KDK
+ ******************************************************************************/
+
+struct KdkHostCounters {
+  uint32_t rx_frames;
+  uint32_t checksum_errors;
+  uint32_t oversize_frames;
+  uint32_t byte_timeouts;
+};
+
+KdkHost *kdk_host_new(void) { return new KdkHost(); }
+void kdk_host_free(KdkHost *host) { delete host; }
+
+int kdk_host_feed(KdkHost *host, uint8_t byte) { return host->feed(byte); }
+size_t kdk_host_frame(KdkHost *host, uint8_t *buffer, size_t size) { return host->frame(buffer, size); }
+
+size_t kdk_host_respond(KdkHost *host, const uint8_t *request, size_t length, uint8_t *buffer, size_t size) {
+  return host->respond(request, length, buffer, size);
+}
+
+void kdk_host_set_table_id(KdkHost *host, uint32_t table_id) { host->set_table_id(table_id); }
+void kdk_host_clear_parameters(KdkHost *host) { host->clear_parameters(); }
+
+void kdk_host_define_parameter(KdkHost *host, uint16_t id, const uint8_t *data, uint8_t size, uint8_t metadata) {
+  host->define_parameter(id, size, metadata, data);
+}
+
+// Returns the size of parameter 'id' with its data in 'buffer', or -1 when it is not defined
+int kdk_host_parameter(KdkHost *host, uint16_t id, uint8_t *buffer, size_t size) {
+  if (!host->has_parameter(id)) {
+    return -1;
+  }
+  auto data = host->get_parameter_data(id);
+  memcpy(buffer, data.data(), std::min(data.size(), size));
+  return data.size();
+}
+
+// 'entries' starts from the entry count, as in the captured 0810 requests
+void kdk_host_stage_0810(KdkHost *host, const uint8_t *entries) {
+  host->stage_0810(esphome::host::kdk_parse_entries(entries));
+}
+
+size_t kdk_host_encode_0810(KdkHost *host, uint8_t counter, uint8_t *buffer, size_t size) {
+  return host->encode_0810(counter, buffer, size);
+}
+
+size_t kdk_host_encode_0910(KdkHost *host, uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer,
+                            size_t size) {
+  return host->encode_0910(counter, ids, count, buffer, size);
+}
+
+size_t kdk_host_encode_0210(KdkHost *host, uint8_t counter, const uint16_t *ids, size_t count, uint8_t *buffer,
+                            size_t size) {
+  return host->encode_0210(counter, ids, count, buffer, size);
+}
+
+void kdk_host_decode(KdkHost *host, const uint8_t *buffer) { host->decode(buffer); }
+
+void kdk_host_counters(KdkHost *host, struct KdkHostCounters *counters) {
+  auto &link = host->counters();
+  counters->rx_frames = link.rx_frames;
+  counters->checksum_errors = link.checksum_errors;
+  counters->oversize_frames = link.oversize_frames;
+  counters->byte_timeouts = link.byte_timeouts;
+}
+
+/*******************************************************************************
+ * MEL
+ ******************************************************************************/
+
+struct MelHostCounters {
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t timeouts;
+  uint32_t checksum_errors;
+  uint32_t version_errors;
+  uint32_t mismatches;
+};
+
+MelHost *mel_host_new(void) { return new MelHost(); }
+void mel_host_free(MelHost *host) { delete host; }
+
+int mel_host_feed(MelHost *host, uint8_t byte) { return host->feed(byte) ? 1 : 0; }
+size_t mel_host_frame(MelHost *host, uint8_t *buffer, size_t size) { return host->frame(buffer, size); }
+void mel_host_tick(MelHost *host) { host->tick(); }
+int mel_host_busy(MelHost *host) { return host->conn().is_busy() ? 1 : 0; }
+
+size_t mel_host_send(MelHost *host, uint8_t flags, const uint8_t *payload, uint8_t length, uint8_t *buffer,
+                     size_t size) {
+  return host->send(flags, payload, length, buffer, size);
+}
+
+void mel_host_counters(MelHost *host, struct MelHostCounters *counters) {
+  auto &stats = host->conn().get_stats();
+  counters->requests = stats.requests;
+  counters->responses = stats.responses;
+  counters->timeouts = stats.timeouts;
+  counters->checksum_errors = stats.checksum_errors;
+  counters->version_errors = stats.version_errors;
+  counters->mismatches = stats.mismatches;
+}
+
+}  // extern "C"
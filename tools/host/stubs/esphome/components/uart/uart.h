@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/core/component.h"
+
+namespace esphome {
+namespace uart {
+
+enum UARTParityOptions {
+  UART_CONFIG_PARITY_NONE,
+  UART_CONFIG_PARITY_EVEN,
+  UART_CONFIG_PARITY_ODD,
+};
+
+/**
+ * In-memory UART of the host harness. Bytes queued with host_receive() are
+ * read by the component, bytes it writes are kept in host_sent().
+ */
+class UARTDevice {
+ public:
+  UARTDevice() = default;
+
+  void write_array(const uint8_t *data, size_t len) { this->tx_.insert(this->tx_.end(), data, data + len); }
+  bool read_byte(uint8_t *data) {
+    if (this->rx_index_ >= this->rx_.size()) {
+      return false;
+    }
+    *data = this->rx_[this->rx_index_++];
+    return true;
+  }
+  int available() { return this->rx_.size() - this->rx_index_; }
+  void flush() {}
+  void check_uart_settings(uint32_t baud_rate, uint8_t stop_bits = 1,
+                           UARTParityOptions parity = UART_CONFIG_PARITY_NONE, uint8_t data_bits = 8) {}
+
+  void host_receive(const uint8_t *data, size_t len) {
+    if (this->rx_index_ >= this->rx_.size()) {
+      this->rx_.clear();
+      this->rx_index_ = 0;
+    }
+    this->rx_.insert(this->rx_.end(), data, data + len);
+  }
+  std::vector<uint8_t> &host_sent() { return this->tx_; }
+
+ protected:
+  std::vector<uint8_t> rx_;
+  size_t rx_index_{0};
+  std::vector<uint8_t> tx_;
+};
+
+}  // namespace uart
+}  // namespace esphome
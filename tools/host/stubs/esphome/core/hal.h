@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+
+// Virtual clock of the host harness, set with host_set_time_us()
+uint32_t millis();
+uint32_t micros();
+
+}  // namespace esphome
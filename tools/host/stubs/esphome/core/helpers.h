@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "esphome/core/hal.h"
+
+#define PACKED __attribute__((packed))
+
+#define ONOFF(b) ((b) ? "ON" : "OFF")
+#define TRUEFALSE(b) ((b) ? "TRUE" : "FALSE")
+#define YESNO(b) ((b) ? "YES" : "NO")
+
+namespace esphome {
+
+template<typename T> class Parented {
+ public:
+  Parented() {}
+  Parented(T *parent) : parent_(parent) {}
+
+  T *get_parent() const { return this->parent_; }
+  void set_parent(T *parent) { this->parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+class HighFrequencyLoopRequester {
+ public:
+  void start() { this->started_ = true; }
+  void stop() { this->started_ = false; }
+  bool is_started() const { return this->started_; }
+
+ protected:
+  bool started_{false};
+};
+
+}  // namespace esphome
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+
+// The preferences are only used by the ESP32 trace snapshots, which the host
+// build leaves out. The object is kept so the component headers compile.
+class ESPPreferenceObject {};
+
+}  // namespace esphome
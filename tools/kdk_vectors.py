@@ -0,0 +1,365 @@
+#!/usr/bin/env python3
+"""
+Golden vectors for the kdk component, extracted from components/kdk/NOTES.md.
+
+Every frame of the fenced capture blocks in NOTES.md becomes a vector. The
+frames are checked for framing errors, then the parameter messages are replayed
+through KdkConnectionManager, built for the host by tools/host:
+
+  0810 request   encoded by send_message_0810(), byte for byte
+  0910 request   encoded by send_message_0910(), byte for byte
+  0210 request   encoded by send_message_0210_init(), byte for byte
+  0810/0910/0210 responses and 0A10 notifications
+                 decoded by parse_parameter_response(), every entry must be
+                 stored with its captured data
+  0A10 response  sent by the component to the captured notification
+
+Responses are also paired with their request: a 0910/0210 response must return
+the requested IDs and a 0810 response must acknowledge the written IDs.
+
+The host library is built with make and a C++ compiler on first use. The
+timing of the encoders and the decoder is measured by 'make -C tools/host
+bench'.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+import connhost
+
+KDK_FRAME_HEADER_SIZE = 6
+KDK_MSG_TYPE = 0x02  # First payload byte of the 0810/0910 requests
+
+FRAME_LINE_RE = re.compile(r"^(MOD|FAN)\s*([<>])\s*(MOD|FAN)\s*:\s*(.*)$")
+HEX_BYTE_RE = re.compile(r"^[0-9A-Fa-f]{2}$")
+SECTION_RE = re.compile(r"^#+\s+(.*)$")
+
+
+# -----------------------------------------------------------------------------
+# Extraction
+# -----------------------------------------------------------------------------
+
+
+def hex_bytes(text):
+    """Leading hex bytes of a line, annotations such as '<= number of attributes?' end the list."""
+    data = bytearray()
+    for token in text.split():
+        if not HEX_BYTE_RE.match(token):
+            break
+        data.append(int(token, 16))
+    return data
+
+
+def extract(path):
+    """Return the frames of the fenced blocks as (section, line, initiator, is_request, bytes)."""
+    frames = []
+    section = ""
+    in_block = False
+    current = None
+
+    def flush():
+        if current is not None:
+            frames.append(current)
+
+    with open(path, encoding="utf-8") as f:
+        for number, line in enumerate(f, 1):
+            line = line.rstrip("\n")
+            if line.startswith("```"):
+                flush()
+                current = None
+                in_block = not in_block
+                continue
+            if not in_block:
+                m = SECTION_RE.match(line)
+                if m:
+                    section = m.group(1).strip()
+                continue
+
+            m = FRAME_LINE_RE.match(line)
+            if m:
+                flush()
+                # 'MOD > FAN' is a request of MOD, 'MOD < FAN' the response of FAN to it
+                current = {
+                    "section": section,
+                    "line": number,
+                    "initiator": m.group(1),
+                    "request": m.group(2) == ">",
+                    "frame": hex_bytes(m.group(4)),
+                }
+            elif current is not None and line.startswith(" "):
+                current["frame"] += hex_bytes(line)
+    flush()
+    return frames
+
+
+# -----------------------------------------------------------------------------
+# Parameter Messages
+# -----------------------------------------------------------------------------
+
+
+def table_id_value(data):
+    return data[0] | (data[1] << 8) | (data[2] << 16)
+
+
+def split_entries(buffer):
+    """
+    Split the entries of a parameter message, 'buffer' starts from 'count'.
+    Returns the (id, data) entries and the number of bytes they cover, the
+    values themselves are checked by the component.
+    """
+    index = 0
+    count = buffer[index]
+    index += 1
+    entries = []
+    for _ in range(count):
+        if index + 3 > len(buffer):
+            return entries, len(buffer) + 1
+        i = buffer[index] | (buffer[index + 1] << 8)
+        length = buffer[index + 2]
+        index += 3
+        entries.append((i, bytes(buffer[index:index + length])))
+        index += length
+    return entries, index
+
+
+def split_request(payload, offset):
+    """Split a parameter message, 'offset' is where the table ID starts. Returns table ID, entries, size."""
+    table_id = table_id_value(payload[offset:offset + 3])
+    entries, size = split_entries(payload[offset + 3:])
+    return table_id, entries, offset + 3 + size
+
+
+# -----------------------------------------------------------------------------
+# Vectors
+# -----------------------------------------------------------------------------
+
+
+class Vector:
+    def __init__(self, frame):
+        self.section = frame["section"]
+        self.line = frame["line"]
+        self.initiator = frame["initiator"]
+        self.request = frame["request"]
+        self.frame = bytes(frame["frame"])
+        self.counter = self.frame[1] if len(self.frame) > 1 else 0
+        self.command = (self.frame[2] | (self.frame[3] << 8)) if len(self.frame) > 3 else 0
+        self.payload = self.frame[KDK_FRAME_HEADER_SIZE:-1]
+        self.kind = None  # Message type the vector is checked as, e.g. '0810' or '8910'
+        self.table_id = None
+        self.entries = None
+
+    @property
+    def base_command(self):
+        return self.command & 0x7FFF
+
+    def where(self):
+        return f"NOTES.md:{self.line} ({self.section})"
+
+    def to_json(self):
+        result = {
+            "section": self.section,
+            "line": self.line,
+            "initiator": self.initiator,
+            "request": self.request,
+            "counter": self.counter,
+            "command": f"{self.command:04X}",
+            "frame": self.frame.hex(" ").upper(),
+        }
+        if self.entries is not None:
+            result["table_id"] = f"{self.table_id:06X}"
+            result["entries"] = [{"id": f"{i:04X}", "data": data.hex(" ").upper()} for i, data in self.entries]
+        return result
+
+
+class Checker:
+    def __init__(self):
+        self.errors = []
+        self.skipped = []
+        self.checked = {}  # kind -> count
+        self.host = connhost.KdkHost()  # Encodes and decodes
+        self.device = connhost.KdkHost()  # Responds to the device requests
+
+    def error(self, vector, message):
+        self.errors.append(f"{vector.where()}: {message}")
+
+    def skip(self, vector, message):
+        self.skipped.append(f"{vector.where()}: {message}")
+
+    def passed(self, vector, kind):
+        vector.kind = kind
+        self.checked[kind] = self.checked.get(kind, 0) + 1
+
+    def compare(self, vector, kind, frame):
+        if frame != vector.frame:
+            self.error(vector, f"{kind} encode mismatch\n  exp {vector.frame.hex(' ').upper()}"
+                       f"\n  got {frame.hex(' ').upper()}")
+            return False
+        return True
+
+    def decode(self, vector, kind, entries):
+        """Decode the entries of 'vector' with parse_parameter_response(), every entry must be stored."""
+        host = self.host
+        host.clear_parameters()
+        expected = {}
+        for i, data in entries:
+            # Defined with other data, the decoder must overwrite it
+            host.define_parameter(i, bytes((~b) & 0xFF for b in data))
+            expected[i] = data
+        host.decode(vector.payload[4:])
+        for i, data in expected.items():
+            decoded = host.parameter(i)
+            if decoded != data:
+                self.error(vector, f"{kind} decode mismatch of {i:04X}, exp {data.hex(' ').upper()}, "
+                           f"got {decoded.hex(' ').upper()}")
+                return False
+        return True
+
+    def framing(self, vector):
+        frame = vector.frame
+        if frame[:1] == b"\x66":
+            return False  # SYNC, not a 5A frame
+        if len(frame) < KDK_FRAME_HEADER_SIZE + 1 or frame[0] != 0x5A:
+            self.error(vector, "not a 5A frame")
+            return False
+        if len(frame) != KDK_FRAME_HEADER_SIZE + frame[5] + 1:
+            self.error(vector, f"length field {frame[5]} does not match {len(frame) - KDK_FRAME_HEADER_SIZE - 1} "
+                       "payload bytes")
+            return False
+        if sum(frame) & 0xFF:
+            self.error(vector, f"checksum error, sum={sum(frame) & 0xFF:02X}")
+            return False
+        self.passed(vector, "frame")
+        return True
+
+    def request(self, vector):
+        payload = vector.payload
+        command = vector.command
+        if command in (0x0810, 0x0910, 0x0A10):
+            table_id, entries, size = split_request(payload, 1)
+        elif command == 0x0210:
+            table_id, entries, size = split_request(payload, 0)
+        else:
+            return
+        if size != len(payload):
+            self.error(vector, f"{command:04X} entries cover {size} of {len(payload)} payload bytes")
+            return
+
+        vector.table_id = table_id
+        vector.entries = entries
+        kind = f"{command:04X}"
+        if command in (0x0810, 0x0910) and payload[0] != KDK_MSG_TYPE:
+            # Sent by another client, the component always sends type 02
+            self.skip(vector, f"{kind} type {payload[0]:02X} is not produced by the component")
+            return
+
+        host = self.host
+        host.set_table_id(table_id)
+        if command == 0x0810:
+            host.clear_parameters()
+            host.stage_0810(payload[4:])
+            ok = self.compare(vector, kind, host.encode_0810(vector.counter))
+        elif command == 0x0910:
+            if any(data for _, data in entries):
+                self.error(vector, "0910 request entries carry data")
+                return
+            ok = self.compare(vector, kind, host.encode_0910(vector.counter, [i for i, _ in entries]))
+        elif command == 0x0210:
+            ok = self.compare(vector, kind, host.encode_0210(vector.counter, [i for i, _ in entries]))
+        else:
+            # 0A10 is sent by the FAN, the module only decodes it
+            ok = self.decode(vector, kind, entries)
+        if ok:
+            self.passed(vector, kind)
+
+    def response(self, vector, request):
+        payload = vector.payload
+        command = vector.base_command
+        if command not in (0x0810, 0x0910, 0x0210, 0x0A10):
+            return
+        if request is None:
+            self.error(vector, f"response {vector.command:04X} CNT={vector.counter:02X} without a request")
+            return
+        if command == 0x0A10:
+            response = self.device.respond(request.frame)
+            if response != vector.frame:
+                sent = response.hex(" ").upper() if response else "nothing"
+                self.error(vector, f"0A10 response differs, the component sends {sent}")
+            else:
+                self.passed(vector, "8A10")
+            return
+
+        table_id, entries, size = split_request(payload, 1)
+        kind = f"{vector.command:04X}"
+        if size != len(payload):
+            self.error(vector, f"{kind} entries cover {size} of {len(payload)} payload bytes")
+            return
+        vector.table_id = table_id
+        vector.entries = entries
+        if not self.decode(vector, kind, entries):
+            return
+
+        requested = [i for i, _ in request.entries or []]
+        returned = [i for i, _ in entries]
+        if command == 0x0810:
+            # The FAN acknowledges the written IDs in its own order, with no data
+            if sorted(requested) != sorted(returned) or any(data for _, data in entries):
+                self.error(vector, "0810 response does not acknowledge the written IDs")
+                return
+        elif requested != returned:
+            self.error(vector, f"{kind} response IDs do not match the request")
+            return
+        self.passed(vector, kind)
+
+    def run(self, vectors):
+        requests = {}  # (initiator, command, counter) -> request vector
+        for vector in vectors:
+            if not self.framing(vector):
+                continue
+            if vector.request:
+                self.request(vector)
+                requests[(vector.initiator, vector.command, vector.counter)] = vector
+            else:
+                key = (vector.initiator, vector.base_command, vector.counter)
+                self.response(vector, requests.pop(key, None))
+
+
+# -----------------------------------------------------------------------------
+# Main
+# -----------------------------------------------------------------------------
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1], formatter_class=argparse.RawTextHelpFormatter)
+    parser.add_argument("notes", nargs="?", default="components/kdk/NOTES.md")
+    parser.add_argument("-o", "--output", help="Write the vectors as JSON")
+    args = parser.parse_args()
+
+    try:
+        vectors = [Vector(f) for f in extract(args.notes)]
+        checker = Checker()
+    except OSError as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 2
+
+    checker.run(vectors)
+
+    print(f"{len(vectors)} frames in {args.notes}")
+    for kind in sorted(checker.checked):
+        print(f"  {kind:<6} {checker.checked[kind]:4d} passed")
+    for s in checker.skipped:
+        print(f"SKIP {s}")
+    for e in checker.errors:
+        print(f"FAIL {e}")
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump([v.to_json() for v in vectors], f, indent=2)
+            f.write("\n")
+
+    return 1 if checker.errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,568 @@
+#!/usr/bin/env python3
+"""
+UART capture tool for the kdk and mel_ac components.
+
+Converts recorded UART sessions into a compact binary capture file and replays
+captures through KdkConnectionManager and MelConnectionManager, built for the
+host by tools/host, using the capture timestamps as the clock. The replay
+reports framing errors, protocol divergences and throughput.
+
+CAPTURE FORMAT (all values little-endian)
+
+  Header, 16 bytes:
+    magic     4 bytes   b"UCAP"
+    version   1 byte    1
+    protocol  1 byte    1 = KDK, 2 = MEL
+    reserved  2 bytes
+    baud      4 bytes   UART baud rate
+    reserved  4 bytes
+
+  Record, repeated until the end of the file:
+    delta     4 bytes   Time in us since the previous record
+    direction 1 byte    0 = RX (device to module), 1 = TX (module to device)
+    length    1 byte    Number of data bytes, 1 to 255
+    data      length    Bytes received back to back, one byte time apart
+
+SOURCES
+
+  convert-csv    Logic analyzer exports, e.g. the Saleae "Async Serial" CSV.
+                 A single file with a channel column, or one file per direction
+                 given as PATH:rx and PATH:tx.
+  convert-trace  Logs of dump_trace(). Only frames whose payload was not
+                 truncated by the trace can be rebuilt, the others are skipped.
+
+REPLAY
+
+  kdk  Both directions are framed by receiver_process_byte(). The responses of
+       the module to the device requests are compared with the responses the
+       component sends to the same requests.
+  mel  The module requests are re-sent with send_command() and compared with
+       the captured bytes, the unit bytes are received by
+       receiver_process_byte(), which drops responses that do not match the
+       outstanding request.
+
+The host library is built with make and a C++ compiler on first use.
+"""
+
+import argparse
+import csv
+import re
+import struct
+import sys
+import time
+
+import connhost
+
+CAPTURE_MAGIC = b"UCAP"
+CAPTURE_VERSION = 1
+CAPTURE_HEADER = struct.Struct("<4sBBxxIxxxx")
+CAPTURE_RECORD = struct.Struct("<IBB")
+
+PROTOCOL_KDK = 1
+PROTOCOL_MEL = 2
+PROTOCOLS = {"kdk": PROTOCOL_KDK, "mel": PROTOCOL_MEL}
+PROTOCOL_DEFAULT_BAUD = {PROTOCOL_KDK: 9600, PROTOCOL_MEL: 2400}
+
+DIR_RX = 0
+DIR_TX = 1
+DIR_NAMES = {DIR_RX: "RX", DIR_TX: "TX"}
+
+UART_BITS_PER_BYTE = 11  # START + 8 DATA + PARITY + STOP
+
+
+def byte_time_us(baud):
+    return (UART_BITS_PER_BYTE * 1000000) // baud
+
+
+# -----------------------------------------------------------------------------
+# Capture File
+# -----------------------------------------------------------------------------
+
+
+class Capture:
+    def __init__(self, protocol, baud):
+        self.protocol = protocol
+        self.baud = baud
+        self.records = []  # (timestamp_us, direction, bytes)
+
+    def add_byte(self, timestamp_us, direction, byte):
+        """Append a byte, merging it into the last record when it follows back to back."""
+        if self.records:
+            last_ts, last_dir, last_data = self.records[-1]
+            gap = timestamp_us - (last_ts + (len(last_data) * byte_time_us(self.baud)))
+            if (last_dir == direction) and (len(last_data) < 255) and (gap <= 2 * byte_time_us(self.baud)):
+                last_data.append(byte)
+                return
+        self.records.append((timestamp_us, direction, bytearray([byte])))
+
+    def add_frame(self, timestamp_us, direction, frame):
+        for i, byte in enumerate(frame):
+            self.add_byte(timestamp_us + (i * byte_time_us(self.baud)), direction, byte)
+
+    def bytes(self):
+        """Yield (timestamp_us, direction, byte) for every byte of the capture."""
+        bt = byte_time_us(self.baud)
+        for timestamp, direction, data in self.records:
+            for i, byte in enumerate(data):
+                yield timestamp + (i * bt), direction, byte
+
+    def save(self, path):
+        self.records.sort(key=lambda r: r[0])
+        with open(path, "wb") as f:
+            f.write(CAPTURE_HEADER.pack(CAPTURE_MAGIC, CAPTURE_VERSION, self.protocol, self.baud))
+            previous = 0
+            for timestamp, direction, data in self.records:
+                f.write(CAPTURE_RECORD.pack(timestamp - previous, direction, len(data)))
+                f.write(data)
+                previous = timestamp
+
+    @staticmethod
+    def load(path):
+        with open(path, "rb") as f:
+            raw = f.read()
+        if len(raw) < CAPTURE_HEADER.size:
+            raise ValueError(f"{path}: file too short")
+        magic, version, protocol, baud = CAPTURE_HEADER.unpack_from(raw, 0)
+        if magic != CAPTURE_MAGIC:
+            raise ValueError(f"{path}: not a capture file")
+        if version != CAPTURE_VERSION:
+            raise ValueError(f"{path}: unsupported capture version {version}")
+
+        capture = Capture(protocol, baud)
+        offset = CAPTURE_HEADER.size
+        timestamp = 0
+        while offset < len(raw):
+            if offset + CAPTURE_RECORD.size > len(raw):
+                raise ValueError(f"{path}: truncated record at offset {offset}")
+            delta, direction, length = CAPTURE_RECORD.unpack_from(raw, offset)
+            offset += CAPTURE_RECORD.size
+            data = raw[offset:offset + length]
+            if len(data) != length:
+                raise ValueError(f"{path}: truncated record at offset {offset}")
+            offset += length
+            timestamp += delta
+            capture.records.append((timestamp, direction, bytearray(data)))
+        return capture
+
+
+# -----------------------------------------------------------------------------
+# Importers
+# -----------------------------------------------------------------------------
+
+CSV_TIME_COLUMNS = ["start_time", "Time [s]", "time", "Time"]
+CSV_DATA_COLUMNS = ["data", "Value", "value", "Data"]
+CSV_CHANNEL_COLUMNS = ["name", "Channel", "channel", "Name"]
+
+
+def find_column(fieldnames, candidates, option):
+    for name in [option] if option else candidates:
+        if name in fieldnames:
+            return name
+    return None
+
+
+def parse_csv_byte(value):
+    value = value.strip().strip("'\"")
+    if value.lower().startswith("0x"):
+        return int(value, 16)
+    return int(value, 16) if re.fullmatch(r"[0-9A-Fa-f]{2}", value) else int(value)
+
+
+def convert_csv(args):
+    protocol = PROTOCOLS[args.protocol]
+    capture = Capture(protocol, args.baud or PROTOCOL_DEFAULT_BAUD[protocol])
+    channels = {args.rx_channel: DIR_RX, args.tx_channel: DIR_TX}
+
+    events = []
+    for source in args.inputs:
+        path, _, fixed = source.rpartition(":") if source.endswith((":rx", ":tx")) else (source, "", "")
+        with open(path, newline="") as f:
+            reader = csv.DictReader(f)
+            time_col = find_column(reader.fieldnames, CSV_TIME_COLUMNS, args.time_column)
+            data_col = find_column(reader.fieldnames, CSV_DATA_COLUMNS, args.data_column)
+            channel_col = find_column(reader.fieldnames, CSV_CHANNEL_COLUMNS, args.channel_column)
+            if (time_col is None) or (data_col is None):
+                raise ValueError(f"{path}: time or data column not found in {reader.fieldnames}")
+            if not fixed and (channel_col is None):
+                raise ValueError(f"{path}: no channel column, use {path}:rx or {path}:tx")
+
+            for row in reader:
+                if fixed:
+                    direction = DIR_RX if fixed == "rx" else DIR_TX
+                elif row[channel_col] in channels:
+                    direction = channels[row[channel_col]]
+                else:
+                    continue
+                if not row[data_col].strip():
+                    continue
+                events.append((float(row[time_col]), direction, parse_csv_byte(row[data_col])))
+
+    events.sort(key=lambda e: e[0])
+    if not events:
+        raise ValueError("no bytes found in the inputs")
+    start = events[0][0]
+    for seconds, direction, byte in events:
+        capture.add_byte(int(round((seconds - start) * 1000000)), direction, byte)
+
+    capture.save(args.output)
+    print(f"{args.output}: {len(events)} bytes in {len(capture.records)} records")
+
+
+TRACE_KDK_RE = re.compile(
+    r"TRACE>\s+(\d+)\s+(RX|TX)\s+CNT=([0-9A-F]{2})\s+CMD=([0-9A-F]{4})\s+LEN=(\d+)\s*((?:[0-9A-F]{2}\s*)*)(\.\.\.)?")
+TRACE_MEL_RE = re.compile(r"TRACE>\s+(\d+)\s+(RX|TX)\s+FLAGS=([0-9A-F]{2})\s+LEN=(\d+)\s*((?:[0-9A-F]{2}\s*)*)(\.\.\.)?")
+
+
+def build_kdk_frame(counter, command, payload):
+    frame = bytearray([0x5A, counter, command & 0xFF, command >> 8, 0x00, len(payload)]) + payload
+    frame.append((-sum(frame)) & 0xFF)
+    return frame
+
+
+def build_mel_frame(flags, payload):
+    frame = bytearray([0xFC, flags, 0x01, 0x30, len(payload)]) + payload
+    frame.append((0xFC - sum(frame)) & 0xFF)
+    return frame
+
+
+def convert_trace(args):
+    protocol = PROTOCOLS[args.protocol]
+    capture = Capture(protocol, args.baud or PROTOCOL_DEFAULT_BAUD[protocol])
+    frames = 0
+    truncated = 0
+    with open(args.input, errors="replace") as f:
+        for line in f:
+            if protocol == PROTOCOL_KDK:
+                m = TRACE_KDK_RE.search(line)
+                if not m:
+                    continue
+                timestamp, direction, counter, command, length, data, more = m.groups()
+            else:
+                m = TRACE_MEL_RE.search(line)
+                if not m:
+                    continue
+                timestamp, direction, flags, length, data, more = m.groups()
+
+            payload = bytearray.fromhex(data)
+            if more or (len(payload) != int(length)):
+                truncated += 1
+                continue
+
+            if protocol == PROTOCOL_KDK:
+                frame = build_kdk_frame(int(counter, 16), int(command, 16), payload)
+            else:
+                frame = build_mel_frame(int(flags, 16), payload)
+            # Entries are recorded once the whole frame went through the UART
+            start = (int(timestamp) * 1000) - (len(frame) * byte_time_us(capture.baud))
+            capture.add_frame(max(0, start), DIR_RX if direction == "RX" else DIR_TX, frame)
+            frames += 1
+
+    capture.save(args.output)
+    print(f"{args.output}: {frames} frames, {truncated} truncated frames skipped")
+
+
+# -----------------------------------------------------------------------------
+# Protocol Replays
+# -----------------------------------------------------------------------------
+
+
+class KdkReplay:
+    """
+    Frames both directions with the receiver of KdkConnectionManager and checks
+    the frames against the module behavior: responses must echo the counter and
+    command of the request, the module request counter advances by one
+    (retransmissions repeat it) and restarts after SYNC, and the module
+    responses to the device requests are the ones the component sends.
+    """
+
+    RECV_TIMEOUT_MS = 300
+    SYNC_SIZE = 6
+
+    def __init__(self, report):
+        self.report = report
+        self.hosts = {DIR_RX: connhost.KdkHost(), DIR_TX: connhost.KdkHost()}
+        self.syncs = {DIR_RX: 0, DIR_TX: 0}
+        self.recent = {DIR_RX: b"", DIR_TX: b""}  # Last bytes of each direction, the receiver drops SYNC frames
+        self.pending = {DIR_RX: None, DIR_TX: None}  # Outstanding request per direction
+        self.expected = None  # Response of the component to the outstanding device request
+        self.last_tx_request = None
+        self.rtt = {}
+
+    def feed(self, direction, byte, now):
+        """Returns the frame completed by 'byte', or None."""
+        self.recent[direction] = (self.recent[direction] + bytes([byte]))[-self.SYNC_SIZE:]
+        result = self.hosts[direction].feed(byte)
+        if result == connhost.KDK_FEED_SYNC:
+            self.syncs[direction] += 1
+            frame = self.recent[direction]
+        elif result == connhost.KDK_FEED_FRAME:
+            frame = self.hosts[direction].frame()
+        else:
+            return None
+        self.frame(direction, frame, now)
+        return frame
+
+    def stats(self, direction):
+        return dict(self.hosts[direction].counters(), sync=self.syncs[direction])
+
+    def frame(self, direction, frame, now):
+        if frame[0] == 0x66:
+            self.report(now, direction, "SYNC", frame)
+            self.last_tx_request = None
+            self.pending = {DIR_RX: None, DIR_TX: None}
+            self.expected = None
+            return
+
+        counter = frame[1]
+        command = frame[2] | (frame[3] << 8)
+
+        if command & 0x8000:
+            request = self.pending[DIR_TX if direction == DIR_RX else DIR_RX]
+            if request is None:
+                self.report(now, direction, "unexpected response", frame)
+                return
+            req_counter, req_command, req_time = request
+            if (counter != req_counter) or (command != (req_command | 0x8000)):
+                self.report(now, direction, f"response does not match request {req_counter:02X}/{req_command:04X}",
+                            frame)
+                return
+            self.rtt.setdefault(req_command, []).append(now - req_time)
+            self.pending[DIR_TX if direction == DIR_RX else DIR_RX] = None
+
+            if direction == DIR_TX:
+                if self.expected is None:
+                    self.report(now, direction, "the component does not respond to this request", frame)
+                elif frame != self.expected:
+                    self.report(now, direction,
+                                f"response differs, the component sends {self.expected.hex(' ').upper()}", frame)
+                self.expected = None
+            return
+
+        previous = self.pending[direction]
+        if (previous is not None) and ((now - previous[2]) < self.RECV_TIMEOUT_MS) and (previous[0] != counter):
+            self.report(now, direction, "request sent while the previous one is outstanding", frame)
+
+        if direction == DIR_RX:
+            self.expected = self.hosts[DIR_RX].respond(frame)
+        else:
+            if self.last_tx_request is not None:
+                if frame == self.last_tx_request:
+                    self.report(now, direction, "retransmission", frame, error=False)
+                elif counter != ((self.last_tx_request[1] + 1) & 0xFF):
+                    self.report(now, direction,
+                                f"request counter {counter:02X}, expected {(self.last_tx_request[1] + 1) & 0xFF:02X}",
+                                frame)
+            self.last_tx_request = frame
+
+        self.pending[direction] = (counter, command, now)
+
+
+class MelReplay:
+    """
+    Re-sends every module request with send_command() of MelConnectionManager,
+    the request must be encoded to the captured bytes, then receives the unit
+    bytes with its receiver. The receiver drops responses that do not match the
+    outstanding request, their flags must be the request flags with the IN bit
+    set and GET responses must echo the requested type.
+    """
+
+    HEADER_SIZE = 5
+    MAX_LENGTH = 26
+    ERRORS = {"checksum_errors": "checksum error", "version_errors": "version error",
+              "mismatches": "response does not match the outstanding request"}
+
+    def __init__(self, report):
+        self.report = report
+        self.host = connhost.MelHost()
+        self.tx = bytearray()  # Module request being framed
+        self.rx = bytearray()  # Unit bytes since the last frame, for the reports
+        self.tx_stats = {"frames": 0, "encode_mismatches": 0}
+        self.pending = None  # Type and time of the outstanding request
+        self.rtt = {}
+
+    def feed(self, direction, byte, now):
+        """Returns the frame completed by 'byte', or None."""
+        self.host.tick()
+        if direction == DIR_TX:
+            return self.feed_request(byte, now)
+
+        self.rx.append(byte)
+        before = self.host.counters()
+        if self.host.feed(byte):
+            frame = self.host.frame()
+            self.rx.clear()
+            if self.pending is not None:
+                self.rtt.setdefault(self.pending[0], []).append(now - self.pending[1])
+                self.pending = None
+            return frame
+
+        after = self.host.counters()
+        for key, message in self.ERRORS.items():
+            if after[key] != before[key]:
+                start = self.rx.find(0xFC)
+                self.report(now, direction, message, bytes(self.rx[max(start, 0):]))
+                self.rx.clear()
+        return None
+
+    def feed_request(self, byte, now):
+        # The module requests are only split here, send_command() checks their bytes
+        if not self.tx and byte != 0xFC:
+            return None
+        self.tx.append(byte)
+        if len(self.tx) < self.HEADER_SIZE:
+            return None
+        if self.tx[4] > self.MAX_LENGTH:
+            self.report(now, DIR_TX, f"length {self.tx[4]} is larger than {self.MAX_LENGTH}", bytes(self.tx))
+            self.tx.clear()
+            return None
+        if len(self.tx) < self.HEADER_SIZE + self.tx[4] + 1:
+            return None
+
+        frame = bytes(self.tx)
+        self.tx.clear()
+        self.tx_stats["frames"] += 1
+
+        if self.host.busy():
+            self.report(now, DIR_TX, "request sent without a response to the previous one", frame, error=False)
+
+        payload = frame[self.HEADER_SIZE:-1]
+        sent = self.host.send(frame[1] & ~0x40, payload)
+        if sent != frame:
+            self.tx_stats["encode_mismatches"] += 1
+            self.report(now, DIR_TX, f"request differs, send_command() sends {sent.hex(' ').upper()}", frame)
+        self.pending = (payload[0] if payload else 0, now)
+        return frame
+
+    def stats(self, direction):
+        if direction == DIR_TX:
+            return self.tx_stats
+        counters = self.host.counters()
+        return {key: counters[key] for key in ("responses", "timeouts", "checksum_errors", "version_errors",
+                                               "mismatches")}
+
+
+# -----------------------------------------------------------------------------
+# Replay
+# -----------------------------------------------------------------------------
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, (len(values) * p) // 100)]
+
+
+def replay(args):
+    capture = Capture.load(args.capture)
+    if capture.protocol == PROTOCOL_KDK:
+        replay_class = KdkReplay
+    elif capture.protocol == PROTOCOL_MEL:
+        replay_class = MelReplay
+    else:
+        raise ValueError(f"{args.capture}: unknown protocol {capture.protocol}")
+
+    divergences = []
+
+    def report(now, direction, message, frame, error=True):
+        if error:
+            divergences.append((now, direction, message))
+        if error or args.verbose:
+            print(f"{now:10.1f} ms {DIR_NAMES[direction]} {'!!' if error else '--'} {message}: "
+                  f"{frame.hex(' ').upper()}")
+
+    if args.log_level:
+        connhost.set_log_level(args.log_level)
+    protocol = replay_class(report)
+    total_bytes = {DIR_RX: 0, DIR_TX: 0}
+    frames = 0
+    last_timestamp = 0
+
+    start = time.perf_counter()
+    for timestamp, direction, byte in capture.bytes():
+        now = timestamp / 1000.0
+        total_bytes[direction] += 1
+        last_timestamp = timestamp
+        connhost.set_time_us(timestamp)
+        frame = protocol.feed(direction, byte, now)
+        if frame is None:
+            continue
+        frames += 1
+        if args.verbose:
+            print(f"{now:10.1f} ms {DIR_NAMES[direction]}    {frame.hex(' ').upper()}")
+    elapsed = time.perf_counter() - start
+
+    duration = last_timestamp / 1000000.0
+    print()
+    print(f"Capture: {args.capture}, {duration:.3f} s at {capture.baud} baud")
+    for direction in (DIR_RX, DIR_TX):
+        stats = ", ".join(f"{k}={v}" for k, v in protocol.stats(direction).items())
+        busy = (total_bytes[direction] * UART_BITS_PER_BYTE) / capture.baud
+        utilization = (100.0 * busy / duration) if duration > 0 else 0.0
+        print(f"  {DIR_NAMES[direction]}: bytes={total_bytes[direction]}, {stats}, utilization={utilization:.1f}%")
+    for key, values in sorted(protocol.rtt.items()):
+        print(f"  RTT {key:04X}: count={len(values)}, p50={percentile(values, 50):.1f} ms, "
+              f"p95={percentile(values, 95):.1f} ms, max={max(values):.1f} ms")
+    rate = (sum(total_bytes.values()) / elapsed) if elapsed > 0 else 0.0
+    print(f"  Replay throughput: {rate:.0f} bytes/s, {(frames / elapsed) if elapsed > 0 else 0.0:.0f} frames/s")
+    print(f"  Divergences: {len(divergences)}")
+
+    return 1 if divergences else 0
+
+
+def dump(args):
+    capture = Capture.load(args.capture)
+    protocol = {v: k for k, v in PROTOCOLS.items()}.get(capture.protocol, "?")
+    print(f"protocol={protocol}, baud={capture.baud}, records={len(capture.records)}")
+    for timestamp, direction, data in capture.records:
+        print(f"{timestamp / 1000.0:10.1f} ms {DIR_NAMES.get(direction, '??')} {data.hex(' ').upper()}")
+    return 0
+
+
+# -----------------------------------------------------------------------------
+# Main
+# -----------------------------------------------------------------------------
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[1], formatter_class=argparse.RawTextHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("convert-csv", help="Convert logic analyzer CSV exports into a capture")
+    p.add_argument("output")
+    p.add_argument("inputs", nargs="+", help="CSV files, PATH:rx or PATH:tx for single channel exports")
+    p.add_argument("--protocol", choices=PROTOCOLS.keys(), required=True)
+    p.add_argument("--baud", type=int)
+    p.add_argument("--rx-channel", default="RX", help="Channel name of the bytes sent by the device")
+    p.add_argument("--tx-channel", default="TX", help="Channel name of the bytes sent by the module")
+    p.add_argument("--time-column")
+    p.add_argument("--data-column")
+    p.add_argument("--channel-column")
+    p.set_defaults(func=convert_csv)
+
+    p = sub.add_parser("convert-trace", help="Convert a dump_trace() log into a capture")
+    p.add_argument("input")
+    p.add_argument("output")
+    p.add_argument("--protocol", choices=PROTOCOLS.keys(), required=True)
+    p.add_argument("--baud", type=int)
+    p.set_defaults(func=convert_trace)
+
+    p = sub.add_parser("replay", help="Replay a capture through the component connection managers")
+    p.add_argument("capture")
+    p.add_argument("-v", "--verbose", action="store_true")
+    p.add_argument("--log-level", type=int, choices=range(6), default=0,
+                   help="Print the component logs up to this ESPHome level, 5 = DEBUG")
+    p.set_defaults(func=replay)
+
+    p = sub.add_parser("dump", help="Print the records of a capture")
+    p.add_argument("capture")
+    p.set_defaults(func=dump)
+
+    args = parser.parse_args()
+    try:
+        return args.func(args) or 0
+    except (OSError, ValueError) as e:
+        print(f"error: {e}", file=sys.stderr)
+        return 2
+
+
+if __name__ == "__main__":
+    sys.exit(main())